@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ansi.h"
+#include "dbg.h"
+
+/* Alternate screen on and cursor off; and the reverse for leaving */
+#define ANSI_ENTER "\033[?1049h\033[?25l"
+#define ANSI_LEAVE "\033[?25h\033[?1049l"
+
+/* Clear the screen */
+#define ANSI_CLEAR "\033[H\033[2J"
+
+/* Switch to the DEC line-drawing character set and back to ASCII */
+#define ANSI_LINES_ON "\033(0"
+#define ANSI_LINES_OFF "\033(B"
+
+/* Reverse the whole screen, for a visual alert, and back */
+#define ANSI_FLASH_ON "\033[?5h"
+#define ANSI_FLASH_OFF "\033[?5l"
+
+/* How long a visual alert keeps the screen reversed */
+#define FLASH_NS 100000000L
+
+/* Terminal size to assume when the terminal will not say */
+#define DEFAULT_ROWS 24
+#define DEFAULT_COLS 80
+
+/* Where ansi_run writes: a row of the screen */
+typedef struct {
+    Ansi *a;
+    int y;
+} screen_row;
+
+/*
+ * Write out everything buffered, as one synchronized frame if sync_output
+ * is set.
+ */
+static void ansi_write_out(Ansi *a) {
+    if (a->out_len == 0) {
+        return;
+    }
+    if (a->base.sync_output) {
+        struct iovec iov[] = {
+            { .iov_base = SYNC_BEGIN, .iov_len = strlen(SYNC_BEGIN) },
+            { .iov_base = a->out, .iov_len = a->out_len },
+            { .iov_base = SYNC_END, .iov_len = strlen(SYNC_END) }
+        };
+        ssize_t n = writev(a->out_fd, iov, 3);
+        /* Finish off a short write one piece at a time */
+        size_t done = n > 0 ? n : 0;
+        for (int i = 0; i < 3; i++) {
+            if (done >= iov[i].iov_len) {
+                done -= iov[i].iov_len;
+                continue;
+            }
+            Frontend_write_all(a->out_fd, (char *)iov[i].iov_base + done,
+                    iov[i].iov_len - done);
+            done = 0;
+        }
+    } else {
+        Frontend_write_all(a->out_fd, a->out, a->out_len);
+    }
+    a->out_len = 0;
+}
+
+/*
+ * Add bytes to the output buffer, writing it out first if they would not
+ * fit.
+ */
+static void ansi_put(Ansi *a, const char *buf, size_t len) {
+    if (a->out_len + len > ANSI_OUT_MAX) {
+        ansi_write_out(a);
+    }
+    if (len > ANSI_OUT_MAX) {
+        Frontend_write_all(a->out_fd, buf, len);
+        return;
+    }
+    memcpy(a->out + a->out_len, buf, len);
+    a->out_len += len;
+}
+
+static void ansi_puts(Ansi *a, const char *s) {
+    ansi_put(a, s, strlen(s));
+}
+
+/* Move the cursor to row y, column x, counting from 0 */
+static void ansi_move(Ansi *a, int y, int x) {
+    char seq[32];
+    int len = snprintf(seq, sizeof(seq), "\033[%d;%dH", y + 1, x + 1);
+    ansi_put(a, seq, len);
+}
+
+static void ansi_run(void *ctx, int x, const char *run, int len) {
+    screen_row *row = ctx;
+    if (row->a->hidden) {
+        return;
+    }
+    ansi_move(row->a, row->y, x);
+    ansi_put(row->a, run, len);
+}
+
+/*
+ * Put a line of text centered on row y of the screen, rewriting only the
+ * cells that differ from what the line last held.
+ */
+static void put_line(Ansi *a, int y, UiLine *line, const char *text) {
+    screen_row row = { .a = a, .y = y };
+    Frontend_update_line(line, a->cols, text, ansi_run, &row);
+}
+
+/* Row of the screen the time left goes on: the middle of the timer pane */
+static int time_row(Ansi *a) {
+    return UI_STATUS_HEIGHT + (a->rows - UI_STATUS_HEIGHT) / 2 - 1;
+}
+
+/*
+ * Draw a box from row top to row bottom across the whole width.
+ */
+static void draw_box(Ansi *a, int top, int bottom) {
+    ansi_move(a, top, 0);
+    ansi_puts(a, "l");
+    ansi_puts(a, a->hline);
+    ansi_puts(a, "k");
+    for (int y = top + 1; y < bottom; y++) {
+        ansi_move(a, y, 0);
+        ansi_puts(a, "x");
+        ansi_move(a, y, a->cols - 1);
+        ansi_puts(a, "x");
+    }
+    ansi_move(a, bottom, 0);
+    ansi_puts(a, "m");
+    ansi_puts(a, a->hline);
+    ansi_puts(a, "j");
+}
+
+/*
+ * Put a line back on screen after the screen was cleared, wherever its text
+ * now centers.
+ */
+static void replay_line(Ansi *a, int y, UiLine *line) {
+    char text[UI_LINE_MAX];
+    memcpy(text, line->text, line->len);
+    text[line->len] = '\0';
+    memset(line, 0, sizeof(UiLine));
+    put_line(a, y, line, text);
+}
+
+/*
+ * Clear the screen and draw both pane borders and the status lines for a
+ * new terminal size. The time left line is left blank for the next
+ * Frontend_present. A terminal shorter than UI_MIN_ROWS is left blank.
+ */
+static int ansi_resize(Frontend *f, int rows, int cols) {
+    Ansi *a = (Ansi *)f;
+    check(a != NULL, "Got NULL Ansi pointer");
+    a->rows = rows;
+    a->cols = cols;
+    a->hidden = rows < UI_MIN_ROWS || cols < 2;
+    ansi_puts(a, ANSI_CLEAR);
+    memset(&a->time_line, 0, sizeof(UiLine));
+    if (a->hidden) {
+        return 0;
+    }
+
+    free(a->hline);
+    a->hline = malloc(cols - 1);
+    check_mem(a->hline);
+    memset(a->hline, 'q', cols - 2);
+    a->hline[cols - 2] = '\0';
+
+    ansi_puts(a, ANSI_LINES_ON);
+    draw_box(a, 0, UI_STATUS_HEIGHT - 1);
+    draw_box(a, UI_STATUS_HEIGHT, rows - 1);
+    ansi_puts(a, ANSI_LINES_OFF);
+    replay_line(a, UI_STATUS_HEIGHT / 2 - 1, &a->set_line);
+    replay_line(a, UI_STATUS_HEIGHT / 2, &a->state_line);
+
+    return 0;
+error:
+    a->hidden = true;
+    return -1;
+}
+
+static int ansi_alert(Frontend *f, ALERT_TYPE type) {
+    Ansi *a = (Ansi *)f;
+    check(type == ALERT_BEEP || type == ALERT_FLASH,
+            "Invalid alert type %d. Choose ALERT_BEEP or ALERT_FLASH", type);
+    if (type == ALERT_BEEP) {
+        ansi_puts(a, "\a");
+        return 0;
+    }
+    ansi_puts(a, ANSI_FLASH_ON);
+    ansi_write_out(a);
+    struct timespec flash = { .tv_sec = 0, .tv_nsec = FLASH_NS };
+    nanosleep(&flash, NULL);
+    ansi_puts(a, ANSI_FLASH_OFF);
+    return 0;
+error:
+    return -1;
+}
+
+static void ansi_show_message(Frontend *f, const char *msg) {
+    Ansi *a = (Ansi *)f;
+    put_line(a, UI_STATUS_HEIGHT / 2 - 1, &a->set_line, "");
+    put_line(a, UI_STATUS_HEIGHT / 2, &a->state_line, msg);
+}
+
+static void ansi_show_time_left(Frontend *f, int time_left, int tenths,
+        bool paused) {
+    Ansi *a = (Ansi *)f;
+    char msg[UI_LINE_MAX];
+    Frontend_format_time(msg, sizeof(msg), time_left, tenths, paused,
+            a->base.low_power);
+    put_line(a, time_row(a), &a->time_line, msg);
+}
+
+static void ansi_show_session(Frontend *f, STATE state, int set_num,
+        int missed, int time_left) {
+    Ansi *a = (Ansi *)f;
+    char msg[UI_LINE_MAX];
+    if (missed > 0) {
+        snprintf(msg, sizeof(msg),
+                "Current set: %d (%d phases elapsed while suspended)",
+                set_num, missed);
+    } else {
+        snprintf(msg, sizeof(msg), "Current set: %d", set_num);
+    }
+    put_line(a, UI_STATUS_HEIGHT / 2 - 1, &a->set_line, msg);
+    put_line(a, UI_STATUS_HEIGHT / 2, &a->state_line,
+            pomodoro_status(state));
+
+    if (state == POMODORO_DONE) {
+        put_line(a, time_row(a), &a->time_line, "");
+    } else {
+        ansi_show_time_left(f, time_left, -1, false);
+    }
+}
+
+static void ansi_flush(Frontend *f) {
+    ansi_write_out((Ansi *)f);
+}
+
+static int ansi_read_key(Frontend *f) {
+    Ansi *a = (Ansi *)f;
+    unsigned char c;
+    ssize_t n;
+    while ((n = read(a->in_fd, &c, 1)) == -1 && errno == EINTR);
+    return n == 1 ? c : -1;
+}
+
+int Ansi_init(Ansi *a, int in_fd, int out_fd) {
+    check(a != NULL, "Got NULL Ansi pointer");
+    memset(a, 0, sizeof(Ansi));
+    a->in_fd = in_fd;
+    a->out_fd = out_fd;
+    a->base = (Frontend) {
+        .alert = ansi_alert,
+        .show_message = ansi_show_message,
+        .show_session = ansi_show_session,
+        .show_time_left = ansi_show_time_left,
+        .flush = ansi_flush,
+        .resize = ansi_resize,
+        .read_key = ansi_read_key,
+        .low_power = false,
+        .fps = 0,
+        .sync_output = false,
+        .tick = 0
+    };
+
+    int rows = DEFAULT_ROWS;
+    int cols = DEFAULT_COLS;
+    struct winsize ws;
+    if (ioctl(out_fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0
+            && ws.ws_col > 0) {
+        rows = ws.ws_row;
+        cols = ws.ws_col;
+    }
+    check(rows >= UI_MIN_ROWS, "Terminal must be >=%d rows tall", UI_MIN_ROWS);
+
+    int rc = tcgetattr(in_fd, &a->termios);
+    check(rc == 0, "Failed to read the terminal settings");
+    a->saved = true;
+    /* Like curses' cbreak() and noecho(), and reads never wait */
+    struct termios raw = a->termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    rc = tcsetattr(in_fd, TCSANOW, &raw);
+    check(rc == 0, "Failed to put the terminal in raw mode");
+
+    ansi_puts(a, ANSI_ENTER);
+    rc = ansi_resize(&a->base, rows, cols);
+    check(rc == 0, "Failed to lay out the panes");
+
+    return 0;
+error:
+    if (a != NULL) {
+        Ansi_destroy(a);
+    }
+    return -1;
+}
+
+void Ansi_destroy(Ansi *a) {
+    check(a != NULL, "Got NULL Ansi pointer");
+    if (a->saved) {
+        a->out_len = 0;
+        a->base.sync_output = false;
+        ansi_puts(a, ANSI_LEAVE);
+        ansi_write_out(a);
+        tcsetattr(a->in_fd, TCSANOW, &a->termios);
+        a->saved = false;
+    }
+    free(a->hline);
+    a->hline = NULL;
+error:
+    return;
+}
@@ -0,0 +1,72 @@
+#ifndef ANSI_H
+#define ANSI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <termios.h>
+
+#include "frontend.h"
+
+/* Most bytes of output held back for one write(2) */
+#define ANSI_OUT_MAX 16384
+
+/*
+ * The raw-ANSI frontend. It draws the same status and timer panes as the
+ * curses one, showing the time left as a line of text, straight onto a
+ * VT100-compatible terminal: no terminfo, no curses screen copies, just a
+ * handful of fixed escape sequences and one buffered write per frame. Like
+ * the curses frontend it only rewrites the cells of a line that changed.
+ */
+typedef struct {
+    /* Operations and display settings; must come first */
+    Frontend base;
+    int in_fd;
+    int out_fd;
+    /* Terminal settings to put back on exit, if saved is set */
+    struct termios termios;
+    bool saved;
+    int rows;
+    int cols;
+    /* Whether the terminal is too small to draw on */
+    bool hidden;
+    /* "Current set" line of the status pane */
+    UiLine set_line;
+    /* Status message line of the status pane */
+    UiLine state_line;
+    /* Time left line of the timer pane */
+    UiLine time_line;
+    /* Horizontal border, cols - 2 line-drawing characters; kept per width */
+    char *hline;
+    /* Output not yet written to out_fd */
+    char out[ANSI_OUT_MAX];
+    size_t out_len;
+} Ansi;
+
+/*
+ * Take over a terminal: switch it to unbuffered, unechoed input, move to
+ * the alternate screen, hide the cursor and lay out the panes for its
+ * current size. Nothing reaches the terminal until the first flush.
+ * Low-power display, the sub-second display and synchronized output all
+ * start off.
+ *
+ * Parameters:
+ *     a: the Ansi to set up
+ *     in_fd: the terminal to read keys from
+ *     out_fd: the terminal to draw on
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Ansi_init(Ansi *a, int in_fd, int out_fd);
+
+/*
+ * Give the terminal back the way Ansi_init found it. Safe to call on an
+ * Ansi that failed to set up.
+ *
+ * Parameters:
+ *     a: the Ansi to tear down
+ */
+void Ansi_destroy(Ansi *a);
+
+#endif
@@ -0,0 +1,70 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+
+/* Sync the directory a file is in, so a rename in it is on the disk */
+static int sync_dir(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+    int fd = open(dir[0] != '\0' ? dir : "/", O_RDONLY | O_DIRECTORY
+            | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int AtomicFile_open(AtomicFile *f, const char *path) {
+    f->path = path;
+    f->made = false;
+    f->fd = -1;
+    int len = snprintf(f->tmp_path, sizeof(f->tmp_path), "%s.%d", path,
+            (int)getpid());
+    if (len >= (int)sizeof(f->tmp_path)) {
+        return -1;
+    }
+    f->fd = open(f->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0644);
+    if (f->fd == -1) {
+        return -1;
+    }
+    f->made = true;
+
+    return 0;
+}
+
+int AtomicFile_commit(AtomicFile *f) {
+    /* The data must be on the disk before the rename that points at it */
+    int rc = fdatasync(f->fd);
+    int closed = close(f->fd);
+    f->fd = -1;
+    if (rc != 0 || closed != 0 || rename(f->tmp_path, f->path) != 0) {
+        return -1;
+    }
+    f->made = false;
+    /* Best effort: if this fails a crash can only bring back the old file */
+    sync_dir(f->path);
+
+    return 0;
+}
+
+void AtomicFile_abort(AtomicFile *f) {
+    if (f->fd != -1) {
+        close(f->fd);
+        f->fd = -1;
+    }
+    if (f->made) {
+        unlink(f->tmp_path);
+        f->made = false;
+    }
+}
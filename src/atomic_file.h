@@ -0,0 +1,62 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <limits.h>
+#include <stdbool.h>
+
+/*
+ * A file being written in full and then put in place of another. The data
+ * goes to a temporary file next to the target, which is synced and renamed
+ * over it, and the directory is then synced, so a crash leaves either the
+ * old file or the whole new one.
+ *
+ * Start one as AtomicFile f = { .fd = -1 }, so AtomicFile_abort is safe
+ * before AtomicFile_open has been called.
+ */
+typedef struct {
+    /* The file being replaced */
+    const char *path;
+    /* The temporary file, and whether it has been made */
+    char tmp_path[PATH_MAX];
+    bool made;
+    /* Open for writing between AtomicFile_open and AtomicFile_commit */
+    int fd;
+} AtomicFile;
+
+/*
+ * Make the temporary file for a replacement of path. Nothing is logged on
+ * failure, so callers that must stay quiet can use it.
+ *
+ * Parameters:
+ *     f: the AtomicFile to start
+ *     path: the file to replace, which must outlive f
+ *
+ * Returns:
+ *     on success, 0, with f->fd open for writing
+ *     on failure, -1
+ */
+int AtomicFile_open(AtomicFile *f, const char *path);
+
+/*
+ * Sync the data written to f->fd, close it and move it in place of the old
+ * file. Nothing is logged on failure.
+ *
+ * Parameters:
+ *     f: an AtomicFile started by AtomicFile_open
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1, leaving the old file as it was
+ */
+int AtomicFile_commit(AtomicFile *f);
+
+/*
+ * Give up on a replacement, closing and removing the temporary file if it
+ * is still there. Does nothing after a successful AtomicFile_commit.
+ *
+ * Parameters:
+ *     f: the AtomicFile to give up on
+ */
+void AtomicFile_abort(AtomicFile *f);
+
+#endif
@@ -0,0 +1,66 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+#include "checkpoint.h"
+#include "dbg.h"
+
+/* Marks a file as a checkpoint: "PCKP" */
+#define CHECKPOINT_MAGIC 0x504b4350u
+
+/* Bump whenever the layout of a Checkpoint changes */
+#define CHECKPOINT_VERSION 1
+
+int Checkpoint_save(const char *path, Checkpoint *cp) {
+    AtomicFile out = { .fd = -1 };
+    check(path != NULL, "Got NULL checkpoint path");
+    check(cp != NULL, "Got NULL Checkpoint pointer");
+
+    cp->magic = CHECKPOINT_MAGIC;
+    cp->version = CHECKPOINT_VERSION;
+    int rc = AtomicFile_open(&out, path);
+    check(rc == 0, "Failed to open checkpoint '%s'", out.tmp_path);
+    ssize_t written = write(out.fd, cp, sizeof(Checkpoint));
+    check(written == (ssize_t)sizeof(Checkpoint), "Failed to write checkpoint");
+    rc = AtomicFile_commit(&out);
+    check(rc == 0, "Failed to move checkpoint into place");
+
+    return 0;
+error:
+    AtomicFile_abort(&out);
+    return -1;
+}
+
+int Checkpoint_load(const char *path, Checkpoint *cp) {
+    check(path != NULL, "Got NULL checkpoint path");
+    check(cp != NULL, "Got NULL Checkpoint pointer");
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t got = read(fd, cp, sizeof(Checkpoint));
+    close(fd);
+    check(got == (ssize_t)sizeof(Checkpoint)
+            && cp->magic == CHECKPOINT_MAGIC
+            && cp->version == CHECKPOINT_VERSION,
+            "Checkpoint '%s' is damaged or from another version", path);
+    check(memchr(cp->profile, '\0', sizeof(cp->profile)) != NULL,
+            "Bad profile name in checkpoint '%s'", path);
+
+    return 0;
+error:
+    return -1;
+}
+
+int Checkpoint_clear(const char *path) {
+    check(path != NULL, "Got NULL checkpoint path");
+    int rc = unlink(path);
+    check(rc == 0 || errno == ENOENT, "Failed to remove checkpoint '%s'",
+            path);
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,68 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * Where a running day had got to, saved so a later start can pick it up
+ * after a crash. The record is a fixed size, and only written when a phase
+ * starts or the day is paused, resumed or rescheduled.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* Schedule_hash of the schedule the day was running */
+    uint64_t schedule_hash;
+    int32_t phase_index;
+    int32_t paused;
+    /* Wall-clock time the phase ends at, in ns since the epoch */
+    int64_t deadline_ns;
+    /* Time left in the phase when it was paused, in ns */
+    int64_t remaining_ns;
+    /* Profile in use, or "" for none */
+    char profile[CONFIG_NAME_MAX];
+} Checkpoint;
+
+/*
+ * Save a checkpoint. It is written to a temporary file, synced and renamed
+ * over the old one, so a crash leaves either the old record or the new.
+ *
+ * Parameters:
+ *     path: the checkpoint file
+ *     cp: the checkpoint to save; its magic and version are filled in
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Checkpoint_save(const char *path, Checkpoint *cp);
+
+/*
+ * Load a checkpoint with a single read(2).
+ *
+ * Parameters:
+ *     path: the checkpoint file
+ *     cp: filled in with the checkpoint
+ *
+ * Returns:
+ *     on success, 0
+ *     if there is no checkpoint, or it is from another version, -1
+ */
+int Checkpoint_load(const char *path, Checkpoint *cp);
+
+/*
+ * Remove a checkpoint, once there is nothing left to resume. A missing
+ * checkpoint is not an error.
+ *
+ * Parameters:
+ *     path: the checkpoint file
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Checkpoint_clear(const char *path);
+
+#endif
@@ -0,0 +1,492 @@
+#include <fcntl.h>
+#include <ini.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+#include "config.h"
+#include "dbg.h"
+
+/* Marks a file as a compiled config cache: "PCFG" */
+#define CACHE_MAGIC 0x47464350u
+
+/* Bump whenever the layout of the cache changes */
+#define CACHE_VERSION 2
+
+/* Prefix of the sections that hold a profile */
+#define PROFILE_PREFIX "profile."
+
+/*
+ * Start of a compiled config cache. The records follow it, then the
+ * schedule text they point into.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* sizeof(cache_record) when written, so a changed layout is stale */
+    uint32_t record_size;
+    uint32_t count;
+    /* Size and modification time of the config file the cache came from */
+    int64_t source_size;
+    int64_t source_mtime_ns;
+    /* Bytes of schedule text after the records */
+    uint32_t text_len;
+} cache_header;
+
+/* One ConfigSection of a cache, with its schedule moved out to the text */
+typedef struct {
+    ConfigSection section;
+    /* Offset of the schedule in the text, or -1 for none */
+    int32_t schedule_off;
+    int32_t schedule_len;
+} cache_record;
+
+TIMER_CLOCK parse_timer_clock(const char *name) {
+    if (strncmp(name, "monotonic", 16) == 0) {
+        return TIMER_CLOCK_MONOTONIC;
+    } else if (strncmp(name, "boottime", 16) == 0) {
+        return TIMER_CLOCK_BOOTTIME;
+    } else if (strncmp(name, "realtime", 16) == 0) {
+        return TIMER_CLOCK_REALTIME;
+    }
+    return TIMER_CLOCK_UNSET;
+}
+
+FRONTEND_KIND parse_frontend(const char *name) {
+    if (strncmp(name, "curses", 16) == 0) {
+        return FRONTEND_CURSES;
+    } else if (strncmp(name, "ansi", 16) == 0) {
+        return FRONTEND_ANSI;
+    }
+    return FRONTEND_UNSET;
+}
+
+/* Empty a section, leaving it with no settings */
+static void clear_section(ConfigSection *s, const char *name) {
+    memset(s, 0, sizeof(ConfigSection));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->values.alert_type = ALERT_UNSET;
+    s->values.timer_clock = TIMER_CLOCK_UNSET;
+    s->values.schedule = NULL;
+    s->values.frontend = FRONTEND_UNSET;
+}
+
+ConfigFile *Config_alloc() {
+    ConfigFile *cf = malloc(sizeof(ConfigFile));
+    check_mem(cf);
+    cf->count = 1;
+    clear_section(&cf->sections[0], "");
+
+    return cf;
+error:
+    return NULL;
+}
+
+void Config_destroy(ConfigFile *cf) {
+    if (cf != NULL) {
+        for (int i = 0; i < cf->count; i++) {
+            free(cf->sections[i].values.schedule);
+        }
+        free(cf);
+    }
+}
+
+int Config_find(const ConfigFile *cf, const char *name) {
+    for (int i = 0; i < cf->count; i++) {
+        if (strcmp(cf->sections[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Find a section by profile name, adding it if it is not there yet.
+ *
+ * Returns: the index of the section, or -1 if there is no room for it
+ */
+static int find_or_add(ConfigFile *cf, const char *name) {
+    int i = Config_find(cf, name);
+    if (i != -1) {
+        return i;
+    }
+    check(cf->count < CONFIG_MAX_SECTIONS, "More than %d profiles",
+            CONFIG_MAX_SECTIONS - 1);
+    clear_section(&cf->sections[cf->count], name);
+    return cf->count++;
+error:
+    return -1;
+}
+
+/*
+ * Copy the settings a section gives onto a configuration.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int apply_section(configuration *dst, const ConfigSection *s) {
+    const configuration *src = &s->values;
+    if (s->set & CONFIG_SHORT_BREAK_LENGTH) {
+        dst->short_break_length = src->short_break_length;
+    }
+    if (s->set & CONFIG_LONG_BREAK_LENGTH) {
+        dst->long_break_length = src->long_break_length;
+    }
+    if (s->set & CONFIG_SET_COUNT) {
+        dst->set_count = src->set_count;
+    }
+    if (s->set & CONFIG_POMODOROS_PER_SET) {
+        dst->pomodoros_per_set = src->pomodoros_per_set;
+    }
+    if (s->set & CONFIG_WORK_LENGTH) {
+        dst->work_length = src->work_length;
+    }
+    if (s->set & CONFIG_ALERT_TYPE) {
+        dst->alert_type = src->alert_type;
+    }
+    if (s->set & CONFIG_CLOCK) {
+        dst->timer_clock = src->timer_clock;
+    }
+    if (s->set & CONFIG_SCHEDULE) {
+        free(dst->schedule);
+        dst->schedule = strndup(src->schedule, CONFIG_SCHEDULE_MAX);
+        check_mem(dst->schedule);
+    }
+    if (s->set & CONFIG_LOW_POWER) {
+        dst->low_power = src->low_power;
+    }
+    if (s->set & CONFIG_FPS) {
+        dst->fps = src->fps;
+    }
+    if (s->set & CONFIG_FRONTEND) {
+        dst->frontend = src->frontend;
+    }
+    if (s->set & CONFIG_PROFILE) {
+        memcpy(dst->profile, src->profile, CONFIG_NAME_MAX);
+    }
+    if (s->set & CONFIG_COMPACT_AFTER) {
+        dst->compact_after = src->compact_after;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Set one setting of a configuration from its text in the config file.
+ *
+ * Returns: the CONFIG_KEY of the setting, or 0 if it is bad
+ */
+static CONFIG_KEY set_value(configuration *c, const char *name,
+        const char *value) {
+    if (strcmp(name, "short_break_length") == 0) {
+        c->short_break_length = atoi(value);
+        return CONFIG_SHORT_BREAK_LENGTH;
+    } else if (strcmp(name, "long_break_length") == 0) {
+        c->long_break_length = atoi(value);
+        return CONFIG_LONG_BREAK_LENGTH;
+    } else if (strcmp(name, "set_count") == 0) {
+        c->set_count = atoi(value);
+        return CONFIG_SET_COUNT;
+    } else if (strcmp(name, "pomodoros_per_set") == 0) {
+        c->pomodoros_per_set = atoi(value);
+        return CONFIG_POMODOROS_PER_SET;
+    } else if (strcmp(name, "work_length") == 0) {
+        c->work_length = atoi(value);
+        return CONFIG_WORK_LENGTH;
+    } else if (strcmp(name, "alert_type") == 0) {
+        if (strncmp(value, "beep", 16) == 0) {
+            c->alert_type = ALERT_BEEP;
+        } else if (strncmp(value, "flash", 16) == 0) {
+            c->alert_type = ALERT_FLASH;
+        } else {
+            sentinel("Bad alert type %s. Choose 'beep' or 'flash'.", value);
+        }
+        return CONFIG_ALERT_TYPE;
+    } else if (strcmp(name, "schedule") == 0) {
+        free(c->schedule);
+        c->schedule = strndup(value, CONFIG_SCHEDULE_MAX);
+        check_mem(c->schedule);
+        return CONFIG_SCHEDULE;
+    } else if (strcmp(name, "clock") == 0) {
+        c->timer_clock = parse_timer_clock(value);
+        check(c->timer_clock != TIMER_CLOCK_UNSET,
+                "Bad clock %s. Choose 'monotonic', 'boottime' or 'realtime'.",
+                value);
+        return CONFIG_CLOCK;
+    } else if (strcmp(name, "low_power") == 0) {
+        if (strncmp(value, "yes", 16) == 0 || strncmp(value, "true", 16) == 0) {
+            c->low_power = true;
+        } else if (strncmp(value, "no", 16) == 0
+                || strncmp(value, "false", 16) == 0) {
+            c->low_power = false;
+        } else {
+            sentinel("Bad low_power value %s. Choose 'yes' or 'no'.", value);
+        }
+        return CONFIG_LOW_POWER;
+    } else if (strcmp(name, "fps") == 0) {
+        c->fps = atoi(value);
+        check(c->fps >= 0 && c->fps <= UI_MAX_FPS,
+                "Bad fps %s. Choose 0 (off) to %d.", value, UI_MAX_FPS);
+        return CONFIG_FPS;
+    } else if (strcmp(name, "frontend") == 0) {
+        c->frontend = parse_frontend(value);
+        check(c->frontend != FRONTEND_UNSET,
+                "Bad frontend %s. Choose 'curses' or 'ansi'.", value);
+        return CONFIG_FRONTEND;
+    } else if (strcmp(name, "profile") == 0) {
+        check(strlen(value) < CONFIG_NAME_MAX, "Profile name %s too long",
+                value);
+        snprintf(c->profile, sizeof(c->profile), "%s", value);
+        return CONFIG_PROFILE;
+    } else if (strcmp(name, "compact_after") == 0) {
+        c->compact_after = atoi(value);
+        check(c->compact_after >= 0, "Bad compact_after %s. Choose 0 (off) "
+                "or a number of days.", value);
+        return CONFIG_COMPACT_AFTER;
+    }
+    sentinel("Unknown setting %s", name);
+error:
+    return 0;
+}
+
+static int handler(void *user, const char *section, const char *name,
+        const char *value) {
+    ConfigFile *cf = (ConfigFile *)user;
+    int i = -1;
+    if (strcmp(section, "timer") == 0) {
+        i = 0;
+    } else if (strncmp(section, PROFILE_PREFIX, strlen(PROFILE_PREFIX)) == 0) {
+        const char *profile = section + strlen(PROFILE_PREFIX);
+        check(profile[0] != '\0' && strlen(profile) < CONFIG_NAME_MAX,
+                "Bad profile name in [%s]", section);
+        check(strcmp(name, "profile") != 0,
+                "A profile cannot pick a profile: %s[%s]", section, name);
+        i = find_or_add(cf, profile);
+        check(i != -1, "No room for [%s]", section);
+    } else {
+        sentinel("Bad section in config: [%s]", section);
+    }
+
+    CONFIG_KEY key = set_value(&cf->sections[i].values, name, value);
+    check(key != 0, "Bad value in config: %s[%s]", section, name);
+    cf->sections[i].set |= key;
+    return 1;
+error:
+    return 0;
+}
+
+int Config_parse(ConfigFile *cf, const char *path) {
+    check(cf != NULL, "Got NULL ConfigFile pointer");
+    int rc = ini_parse(path, handler, cf);
+    check(rc != -1, "Error opening config file '%s'", path);
+    check(rc != -2, "ini_parse memory error");
+    check(rc == 0, "Error on line %d of config file '%s'", rc, path);
+
+    return 0;
+error:
+    return -1;
+}
+
+int Config_merge(ConfigFile *dst, const ConfigFile *src) {
+    check(dst != NULL && src != NULL, "Got NULL ConfigFile pointer");
+    for (int i = 0; i < src->count; i++) {
+        int j = find_or_add(dst, src->sections[i].name);
+        check(j != -1, "No room for profile %s", src->sections[i].name);
+        int rc = apply_section(&dst->sections[j].values, &src->sections[i]);
+        check(rc == 0, "Failed to merge profile %s", src->sections[i].name);
+        dst->sections[j].set |= src->sections[i].set;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Config_resolve(const ConfigFile *cf, int index, configuration *out) {
+    check(cf != NULL, "Got NULL ConfigFile pointer");
+    check(out != NULL, "Got NULL configuration pointer");
+    ConfigSection empty;
+    clear_section(&empty, "");
+    *out = empty.values;
+    check(index >= 0 && index < cf->count, "No config section %d", index);
+    int rc = apply_section(out, &cf->sections[0]);
+    check(rc == 0, "Failed to apply [timer]");
+    if (index > 0) {
+        rc = apply_section(out, &cf->sections[index]);
+        check(rc == 0, "Failed to apply profile %s", cf->sections[index].name);
+    }
+
+    return 0;
+error:
+    if (out != NULL) {
+        free(out->schedule);
+        out->schedule = NULL;
+    }
+    return -1;
+}
+
+/*
+ * Fill a ConfigFile from a compiled cache, if the cache was made from a
+ * file of the given size and modification time.
+ *
+ * Returns: 0 if the cache was good, -1 if not
+ */
+static int read_cache(ConfigFile *cf, const char *cache_path,
+        const struct stat *source) {
+    char *buf = NULL;
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(cache_header)) {
+        goto error;
+    }
+    buf = malloc(st.st_size);
+    check_mem(buf);
+    if (read(fd, buf, st.st_size) != st.st_size) {
+        goto error;
+    }
+    close(fd);
+    fd = -1;
+
+    cache_header *h = (cache_header *)buf;
+    int64_t mtime_ns = (int64_t)source->st_mtim.tv_sec * 1000000000LL
+            + source->st_mtim.tv_nsec;
+    if (h->magic != CACHE_MAGIC || h->version != CACHE_VERSION
+            || h->record_size != sizeof(cache_record)
+            || h->source_size != source->st_size
+            || h->source_mtime_ns != mtime_ns
+            || h->count < 1 || h->count > CONFIG_MAX_SECTIONS
+            || (off_t)(sizeof(cache_header) + h->count * sizeof(cache_record)
+                    + h->text_len) != st.st_size) {
+        goto error;
+    }
+    cache_record *records = (cache_record *)(buf + sizeof(cache_header));
+    const char *text = (const char *)(records + h->count);
+    for (uint32_t i = 0; i < h->count; i++) {
+        cf->sections[i] = records[i].section;
+        cf->sections[i].values.schedule = NULL;
+        cf->count = i + 1;
+        if (records[i].schedule_off < 0) {
+            continue;
+        }
+        if (records[i].schedule_len < 0 || (uint32_t)records[i].schedule_off
+                + records[i].schedule_len > h->text_len) {
+            goto error;
+        }
+        cf->sections[i].values.schedule = strndup(
+                text + records[i].schedule_off, records[i].schedule_len);
+        check_mem(cf->sections[i].values.schedule);
+    }
+    free(buf);
+
+    return 0;
+error:
+    if (fd != -1) {
+        close(fd);
+    }
+    free(buf);
+    for (int i = 0; i < cf->count; i++) {
+        free(cf->sections[i].values.schedule);
+    }
+    cf->count = 1;
+    clear_section(&cf->sections[0], "");
+    return -1;
+}
+
+/*
+ * Write a ConfigFile out as a compiled cache. The cache is an AtomicFile,
+ * so readers never see half of it.
+ * Failures are quiet: without a cache the file is simply parsed again.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int write_cache(const ConfigFile *cf, const char *cache_path,
+        const struct stat *source) {
+    AtomicFile out = { .fd = -1 };
+    char *buf = NULL;
+
+    size_t text_len = 0;
+    for (int i = 0; i < cf->count; i++) {
+        if (cf->sections[i].values.schedule != NULL) {
+            text_len += strlen(cf->sections[i].values.schedule);
+        }
+    }
+    size_t size = sizeof(cache_header) + cf->count * sizeof(cache_record)
+            + text_len;
+    /* Zeroed, so padding bytes never carry stale memory to disk */
+    buf = calloc(1, size);
+    check_mem(buf);
+
+    cache_header *h = (cache_header *)buf;
+    h->magic = CACHE_MAGIC;
+    h->version = CACHE_VERSION;
+    h->record_size = sizeof(cache_record);
+    h->count = cf->count;
+    h->source_size = source->st_size;
+    h->source_mtime_ns = (int64_t)source->st_mtim.tv_sec * 1000000000LL
+            + source->st_mtim.tv_nsec;
+    h->text_len = text_len;
+    cache_record *records = (cache_record *)(buf + sizeof(cache_header));
+    char *text = (char *)(records + cf->count);
+    size_t text_off = 0;
+    for (int i = 0; i < cf->count; i++) {
+        const ConfigSection *s = &cf->sections[i];
+        memcpy(records[i].section.name, s->name, CONFIG_NAME_MAX);
+        records[i].section.set = s->set;
+        records[i].section.values = s->values;
+        records[i].section.values.schedule = NULL;
+        records[i].schedule_off = -1;
+        records[i].schedule_len = 0;
+        if (s->values.schedule != NULL) {
+            size_t n = strlen(s->values.schedule);
+            memcpy(text + text_off, s->values.schedule, n);
+            records[i].schedule_off = text_off;
+            records[i].schedule_len = n;
+            text_off += n;
+        }
+    }
+
+    if (AtomicFile_open(&out, cache_path) != 0
+            || write(out.fd, buf, size) != (ssize_t)size
+            || AtomicFile_commit(&out) != 0) {
+        goto error;
+    }
+    free(buf);
+
+    return 0;
+error:
+    AtomicFile_abort(&out);
+    free(buf);
+    return -1;
+}
+
+int Config_load(ConfigFile *cf, const char *path) {
+    check(cf != NULL, "Got NULL ConfigFile pointer");
+    check(cf->count == 1 && cf->sections[0].set == 0,
+            "Can only load into an empty ConfigFile");
+    char cache_path[PATH_MAX];
+    int len = snprintf(cache_path, sizeof(cache_path), "%s.cache", path);
+    check(len < (int)sizeof(cache_path), "Config path too long");
+    struct stat source;
+    check(stat(path, &source) == 0, "Error opening config file '%s'", path);
+
+    if (read_cache(cf, cache_path, &source) == 0) {
+        return 0;
+    }
+    int rc = Config_parse(cf, path);
+    check(rc == 0, "Failed to parse config file '%s'", path);
+    /* A read-only config directory just means no cache */
+    write_cache(cf, cache_path, &source);
+
+    return 0;
+error:
+    return -1;
+}
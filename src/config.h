@@ -0,0 +1,206 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+#include "frontend.h"
+
+/* Longest schedule description, not including NUL terminator */
+#define CONFIG_SCHEDULE_MAX 4095
+
+/* Longest profile name, including NUL terminator */
+#define CONFIG_NAME_MAX 32
+
+/* Most sections in a config file: [timer] and up to 31 profiles */
+#define CONFIG_MAX_SECTIONS 32
+
+typedef enum {
+    TIMER_CLOCK_UNSET = 0,
+    TIMER_CLOCK_MONOTONIC = 1,
+    TIMER_CLOCK_BOOTTIME = 2,
+    TIMER_CLOCK_REALTIME = 3
+} TIMER_CLOCK;
+
+typedef enum {
+    FRONTEND_UNSET = 0,
+    FRONTEND_CURSES = 1,
+    FRONTEND_ANSI = 2,
+    FRONTEND_HEADLESS = 3,
+    FRONTEND_DAEMON = 4
+} FRONTEND_KIND;
+
+/* Settings a config section can give; combined as bit flags */
+typedef enum {
+    CONFIG_SHORT_BREAK_LENGTH = 1 << 0,
+    CONFIG_LONG_BREAK_LENGTH = 1 << 1,
+    CONFIG_SET_COUNT = 1 << 2,
+    CONFIG_POMODOROS_PER_SET = 1 << 3,
+    CONFIG_WORK_LENGTH = 1 << 4,
+    CONFIG_ALERT_TYPE = 1 << 5,
+    CONFIG_CLOCK = 1 << 6,
+    CONFIG_SCHEDULE = 1 << 7,
+    CONFIG_LOW_POWER = 1 << 8,
+    CONFIG_FPS = 1 << 9,
+    CONFIG_FRONTEND = 1 << 10,
+    CONFIG_PROFILE = 1 << 11,
+    CONFIG_COMPACT_AFTER = 1 << 12
+} CONFIG_KEY;
+
+typedef struct {
+    int short_break_length;
+    int long_break_length;
+    int set_count;
+    int pomodoros_per_set;
+    int work_length;
+    ALERT_TYPE alert_type;
+    TIMER_CLOCK timer_clock;
+    /* Schedule description for Schedule_compile, or NULL; from strndup() */
+    char *schedule;
+    bool low_power;
+    /* Frame rate cap of the sub-second display; 0 leaves it off */
+    int fps;
+    FRONTEND_KIND frontend;
+    /* Profile to use when none is asked for, or "" */
+    char profile[CONFIG_NAME_MAX];
+    /* Days of history to keep in full when compacting it on start; 0 never */
+    int compact_after;
+} configuration;
+
+/* One section of a config file, holding only the settings it gives */
+typedef struct {
+    /* Profile name, or "" for the [timer] section */
+    char name[CONFIG_NAME_MAX];
+    /* CONFIG_KEY flags of the settings the section gives */
+    unsigned set;
+    configuration values;
+} ConfigSection;
+
+/*
+ * A parsed config file: the [timer] section, which is always first, then
+ * each [profile.NAME] section in the order they first appear. A profile
+ * holds the same settings as [timer] and overrides them where it gives
+ * them.
+ */
+typedef struct {
+    int count;
+    ConfigSection sections[CONFIG_MAX_SECTIONS];
+} ConfigFile;
+
+/*
+ * Parse the name of a timer clock.
+ *
+ * Parameters:
+ *     name: one of "monotonic", "boottime" or "realtime"
+ *
+ * Returns:
+ *     On success, the matching TIMER_CLOCK
+ *     On failure, TIMER_CLOCK_UNSET
+ */
+TIMER_CLOCK parse_timer_clock(const char *name);
+
+/*
+ * Parse the name of a frontend.
+ *
+ * Parameters:
+ *     name: one of "curses" or "ansi"
+ *
+ * Returns:
+ *     On success, the matching FRONTEND_KIND
+ *     On failure, FRONTEND_UNSET
+ */
+FRONTEND_KIND parse_frontend(const char *name);
+
+/*
+ * Allocates memory for a ConfigFile holding an empty [timer] section.
+ *
+ * Parameters: none
+ *
+ * Returns:
+ *     on success, a pointer to the new ConfigFile
+ *     on failure, NULL
+ */
+ConfigFile *Config_alloc();
+
+/*
+ * Destroy a ConfigFile object
+ *
+ * Parameters:
+ *     cf: the ConfigFile to destroy
+ * Returns: none
+ */
+void Config_destroy(ConfigFile *cf);
+
+/*
+ * Parse an ini file on top of whatever a ConfigFile already holds.
+ *
+ * Parameters:
+ *     cf: the ConfigFile to fill
+ *     path: the file to parse
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Config_parse(ConfigFile *cf, const char *path);
+
+/*
+ * Load a config file into an empty ConfigFile, from the compiled cache
+ * next to it (path with ".cache" on the end) if the cache was made from a
+ * file of the same size and modification time. Otherwise the file is
+ * parsed and the cache written again; a cache that cannot be written is
+ * not an error. A good cache is read with a single read(2).
+ *
+ * Parameters:
+ *     cf: the ConfigFile to fill; must be fresh from Config_alloc
+ *     path: the config file to load
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Config_load(ConfigFile *cf, const char *path);
+
+/*
+ * Add the sections of one ConfigFile to another, as if the second file
+ * had been parsed on top of the first.
+ *
+ * Parameters:
+ *     dst: the ConfigFile to add to
+ *     src: the ConfigFile to add
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Config_merge(ConfigFile *dst, const ConfigFile *src);
+
+/*
+ * Find a section by profile name.
+ *
+ * Parameters:
+ *     cf: the ConfigFile to search
+ *     name: the profile name, or "" for [timer]
+ *
+ * Returns:
+ *     on success, the index of the section
+ *     if there is no such profile, -1
+ */
+int Config_find(const ConfigFile *cf, const char *name);
+
+/*
+ * Work out the settings of one profile: [timer], with the profile's own
+ * settings on top. Anything neither gives is left 0 or unset.
+ *
+ * Parameters:
+ *     cf: the ConfigFile to read
+ *     index: the section of the profile, or 0 for [timer] alone
+ *     out: filled in with the settings; its schedule, if any, is the
+ *          caller's to free
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Config_resolve(const ConfigFile *cf, int index, configuration *out);
+
+#endif
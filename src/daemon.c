@@ -0,0 +1,439 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "dbg.h"
+
+/* epoll data of the listening socket; clients are known by their slot */
+#define LISTEN_SLOT DAEMON_MAX_CLIENTS
+
+/* Fill in the address of a socket file */
+static int socket_address(struct sockaddr_un *addr, const char *path) {
+    check(path != NULL, "Got NULL socket path");
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    check(strlen(path) < sizeof(addr->sun_path), "Socket path '%s' too long",
+            path);
+    strcpy(addr->sun_path, path);
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Connect to a socket file without complaining if nobody is there */
+static int try_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (socket_address(&addr, path) != 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void daemon_drop(Daemon *d, int slot) {
+    DaemonClient *c = &d->clients[slot];
+    epoll_ctl(d->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+    d->client_count--;
+}
+
+/* Send to one client, dropping it if it cannot take the whole line */
+static void daemon_send(Daemon *d, int slot, const char *buf, size_t len) {
+    ssize_t sent = send(d->clients[slot].fd, buf, len,
+            MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent != (ssize_t)len) {
+        daemon_drop(d, slot);
+    }
+}
+
+/* Write where the day stands as a start or state line */
+static int daemon_snapshot(Daemon *d, const char *kind, char *line,
+        size_t size) {
+    int64_t left_ms = 0;
+    if (d->paused) {
+        left_ms = (int64_t)d->paused_left * 1000;
+    } else if (d->state != POMODORO_DONE) {
+        int64_t left = d->timer->deadline_ns - Timer_now(d->timer);
+        left_ms = left > 0 ? left / 1000000 : 0;
+    }
+    return snprintf(line, size, "%s %s %d %d %lld %d\n", kind,
+            Pomodoro_state_name(d->state), d->set_num, d->missed,
+            (long long)left_ms, d->paused);
+}
+
+/* Add a line to the events for the next flush */
+static void daemon_put(Daemon *d, const char *line, int len) {
+    if (len <= 0 || len >= DAEMON_LINE_MAX) {
+        return;
+    }
+    if (d->out_len + len > DAEMON_OUT_MAX) {
+        d->base.flush(&d->base);
+    }
+    memcpy(d->out + d->out_len, line, len);
+    d->out_len += len;
+}
+
+static void daemon_accept(Daemon *d) {
+    int fd;
+    while ((fd = accept(d->listen_fd, NULL, NULL)) != -1) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        int slot = 0;
+        while (slot < DAEMON_MAX_CLIENTS && d->clients[slot].fd != -1) {
+            slot++;
+        }
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP,
+                .data.u32 = slot };
+        if (slot == DAEMON_MAX_CLIENTS
+                || epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            continue;
+        }
+        d->clients[slot].fd = fd;
+        d->clients[slot].len = 0;
+        d->client_count++;
+
+        char line[DAEMON_LINE_MAX];
+        int len = daemon_snapshot(d, "state", line, sizeof(line));
+        daemon_send(d, slot, line, len);
+    }
+}
+
+static void daemon_command(Daemon *d, int slot, const char *cmd) {
+    static const struct {
+        const char *name;
+        char key;
+    } commands[] = {
+        { "pause", 'p' }, { "skip", 's' }, { "profile", 'n' },
+        { "info", 'i' }, { "stop", 'q' }
+    };
+    char line[DAEMON_LINE_MAX];
+    if (strcmp(cmd, "status") == 0) {
+        int len = daemon_snapshot(d, "state", line, sizeof(line));
+        daemon_send(d, slot, line, len);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(cmd, commands[i].name) == 0) {
+            if (d->key_count < DAEMON_KEYS_MAX) {
+                d->keys[(d->key_head + d->key_count) % DAEMON_KEYS_MAX] =
+                        commands[i].key;
+                d->key_count++;
+            }
+            return;
+        }
+    }
+    int len = snprintf(line, sizeof(line), "message Unknown command %.32s\n",
+            cmd);
+    daemon_send(d, slot, line, len);
+}
+
+/* Take in what a client sent, acting on each whole line */
+static void daemon_read(Daemon *d, int slot) {
+    DaemonClient *c = &d->clients[slot];
+    for (;;) {
+        ssize_t n = read(c->fd, c->in + c->len, sizeof(c->in) - c->len);
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        } else if (n <= 0) {
+            daemon_drop(d, slot);
+            return;
+        }
+        c->len += n;
+        char *start = c->in;
+        char *nl;
+        while ((nl = memchr(start, '\n', c->in + c->len - start)) != NULL) {
+            *nl = '\0';
+            daemon_command(d, slot, start);
+            if (c->fd == -1) {
+                return;
+            }
+            start = nl + 1;
+        }
+        c->len -= start - c->in;
+        memmove(c->in, start, c->len);
+        if (c->len == sizeof(c->in)) {
+            /* No command is this long */
+            daemon_drop(d, slot);
+            return;
+        }
+    }
+}
+
+/* Handle whatever the sockets have waiting, without blocking */
+static void daemon_poll(Daemon *d) {
+    struct epoll_event events[DAEMON_EVENTS_MAX];
+    int n = epoll_wait(d->epoll_fd, events, DAEMON_EVENTS_MAX, 0);
+    for (int i = 0; i < n; i++) {
+        int slot = events[i].data.u32;
+        if (slot == LISTEN_SLOT) {
+            daemon_accept(d);
+        } else if (d->clients[slot].fd != -1) {
+            daemon_read(d, slot);
+        }
+    }
+}
+
+static int daemon_alert(Frontend *f, ALERT_TYPE type) {
+    char line[DAEMON_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "alert %s\n",
+            type == ALERT_BEEP ? "beep" : "flash");
+    daemon_put((Daemon *)f, line, len);
+    return 0;
+}
+
+static void daemon_show_message(Frontend *f, const char *msg) {
+    char line[DAEMON_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "message %.*s\n",
+            DAEMON_LINE_MAX - 10, msg);
+    daemon_put((Daemon *)f, line, len);
+}
+
+static void daemon_show_session(Frontend *f, STATE state, int set_num,
+        int missed, int time_left) {
+    (void)time_left;
+    Daemon *d = (Daemon *)f;
+    d->state = state;
+    d->set_num = set_num;
+    d->missed = missed;
+    d->paused = false;
+    char line[DAEMON_LINE_MAX];
+    int len = daemon_snapshot(d, "start", line, sizeof(line));
+    daemon_put(d, line, len);
+}
+
+/* Clients count down by themselves; only pauses and resumes go out */
+static void daemon_show_time_left(Frontend *f, int time_left, int tenths,
+        bool paused) {
+    (void)tenths;
+    Daemon *d = (Daemon *)f;
+    if (paused != d->paused) {
+        d->paused = paused;
+        d->paused_left = time_left;
+        char line[DAEMON_LINE_MAX];
+        int len = daemon_snapshot(d, "state", line, sizeof(line));
+        daemon_put(d, line, len);
+    }
+}
+
+static void daemon_flush(Frontend *f) {
+    Daemon *d = (Daemon *)f;
+    if (d->out_len == 0) {
+        return;
+    }
+    for (int slot = 0; slot < DAEMON_MAX_CLIENTS && d->client_count > 0;
+            slot++) {
+        if (d->clients[slot].fd != -1) {
+            daemon_send(d, slot, d->out, d->out_len);
+        }
+    }
+    d->out_len = 0;
+}
+
+static int daemon_read_key(Frontend *f) {
+    Daemon *d = (Daemon *)f;
+    if (d->key_count == 0) {
+        daemon_poll(d);
+        /* New clients get where the day stands straight away */
+        daemon_flush(f);
+    }
+    if (d->key_count == 0) {
+        return -1;
+    }
+    int key = d->keys[d->key_head];
+    d->key_head = (d->key_head + 1) % DAEMON_KEYS_MAX;
+    d->key_count--;
+    return key;
+}
+
+int Daemon_listen(const char *path) {
+    int fd = -1;
+    struct sockaddr_un addr;
+    check(socket_address(&addr, path) == 0, "Bad socket path");
+    int probe = try_connect(path);
+    if (probe != -1) {
+        close(probe);
+        sentinel("A daemon is already running on %s", path);
+    }
+    /* Left behind by a daemon that died; nobody answers on it */
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    check(fd != -1, "Failed to make a socket");
+    /* Only the user may attach */
+    mode_t mask = umask(077);
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    check(rc == 0, "Failed to bind %s", path);
+    rc = listen(fd, SOMAXCONN);
+    check(rc == 0, "Failed to listen on %s", path);
+
+    return fd;
+error:
+    if (fd != -1) {
+        close(fd);
+    }
+    return -1;
+}
+
+int Daemon_init(Daemon *d, int listen_fd, const char *socket_path, Timer *t) {
+    check(d != NULL, "Got NULL Daemon pointer");
+    check(t != NULL, "Got NULL Timer pointer");
+    memset(d, 0, sizeof(Daemon));
+    d->listen_fd = listen_fd;
+    d->socket_path = socket_path;
+    d->timer = t;
+    d->state = POMODORO_WORK;
+    d->epoll_fd = -1;
+    d->clients = malloc(DAEMON_MAX_CLIENTS * sizeof(DaemonClient));
+    check_mem(d->clients);
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        d->clients[i].fd = -1;
+        d->clients[i].len = 0;
+    }
+    d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    check(d->epoll_fd != -1, "Failed to set up epoll");
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = LISTEN_SLOT };
+    int rc = epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    check(rc == 0, "Failed to watch the socket");
+    d->base = (Frontend) {
+        .alert = daemon_alert,
+        .show_message = daemon_show_message,
+        .show_session = daemon_show_session,
+        .show_time_left = daemon_show_time_left,
+        .flush = daemon_flush,
+        .resize = NULL,
+        .read_key = daemon_read_key,
+        .input_fd = d->epoll_fd,
+        .leave_when_done = true,
+        .low_power = false,
+        .fps = 0,
+        .sync_output = false,
+        .tick = -1
+    };
+
+    return 0;
+error:
+    if (d != NULL) {
+        if (d->epoll_fd != -1) {
+            close(d->epoll_fd);
+        }
+        free(d->clients);
+        d->clients = NULL;
+    }
+    return -1;
+}
+
+void Daemon_destroy(Daemon *d) {
+    if (d == NULL || d->clients == NULL) {
+        return;
+    }
+    for (int slot = 0; slot < DAEMON_MAX_CLIENTS; slot++) {
+        if (d->clients[slot].fd != -1) {
+            daemon_drop(d, slot);
+        }
+    }
+    free(d->clients);
+    d->clients = NULL;
+    close(d->epoll_fd);
+    close(d->listen_fd);
+    unlink(d->socket_path);
+}
+
+int Daemon_connect(const char *path) {
+    int fd = try_connect(path);
+    check(fd != -1, "No daemon is running on %s", path);
+
+    return fd;
+error:
+    return -1;
+}
+
+int Daemon_send_command(int fd, const char *cmd) {
+    char line[DAEMON_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "%s\n", cmd);
+    check(len > 0 && len < DAEMON_LINE_MAX, "Command too long");
+    for (int off = 0; off < len;) {
+        ssize_t n = send(fd, line + off, len - off, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        check(n > 0, "Failed to send '%s' to the daemon", cmd);
+        off += n;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+const char *Daemon_command(int key) {
+    switch (key) {
+        case 'p':
+        case ' ':
+            return "pause";
+        case 's':
+            return "skip";
+        case 'n':
+            return "profile";
+        case 'i':
+            return "info";
+        default:
+            return NULL;
+    }
+}
+
+int Daemon_parse_event(const char *line, DaemonEvent *ev) {
+    char kind[16];
+    char phase[16];
+    long long left_ms;
+    int paused;
+    int end = 0;
+    check(line != NULL && ev != NULL, "Got NULL line or event");
+    memset(ev, 0, sizeof(*ev));
+
+    if (strncmp(line, "message ", 8) == 0) {
+        ev->kind = DAEMON_EV_MESSAGE;
+        snprintf(ev->text, sizeof(ev->text), "%s", line + 8);
+        return 0;
+    } else if (strcmp(line, "alert beep") == 0
+            || strcmp(line, "alert flash") == 0) {
+        ev->kind = DAEMON_EV_ALERT;
+        ev->alert = line[6] == 'b' ? ALERT_BEEP : ALERT_FLASH;
+        return 0;
+    }
+    int rc = sscanf(line, "%15s %15s %d %d %lld %d%n", kind, phase,
+            &ev->set_num, &ev->missed, &left_ms, &paused, &end);
+    check(rc == 6 && line[end] == '\0', "Bad line from the daemon: %s", line);
+    check(strcmp(kind, "start") == 0 || strcmp(kind, "state") == 0,
+            "Bad line from the daemon: %s", line);
+    ev->kind = strcmp(kind, "start") == 0 ? DAEMON_EV_START
+            : DAEMON_EV_STATE;
+    ev->state = Pomodoro_state_parse(phase);
+    check(ev->state != POMODORO_ERROR, "Bad phase from the daemon: %s",
+            phase);
+    ev->left_ns = left_ms * 1000000LL;
+    ev->paused = paused != 0;
+
+    return 0;
+error:
+    return -1;
+}
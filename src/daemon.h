@@ -0,0 +1,192 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frontend.h"
+#include "pomodoro.h"
+
+/* Most clients attached at once; any more are turned away */
+#define DAEMON_MAX_CLIENTS 1024
+
+/* Longest line either way, newline included */
+#define DAEMON_LINE_MAX 256
+
+/* Most bytes of events held back for one send to each client */
+#define DAEMON_OUT_MAX 4096
+
+/* Most commands waiting for the event loop to take them */
+#define DAEMON_KEYS_MAX 64
+
+/* Socket connections and client lines handled per epoll_wait */
+#define DAEMON_EVENTS_MAX 64
+
+/* What a line from the daemon says */
+typedef enum {
+    /* A phase began: start PHASE SET MISSED LEFT_MS PAUSED */
+    DAEMON_EV_START,
+    /* Where the phase stands: state PHASE SET MISSED LEFT_MS PAUSED */
+    DAEMON_EV_STATE,
+    /* The phase ran out: alert beep|flash */
+    DAEMON_EV_ALERT,
+    /* Something to show over the status pane: message TEXT */
+    DAEMON_EV_MESSAGE
+} DAEMON_EVENT;
+
+/* One line from the daemon, parsed */
+typedef struct {
+    DAEMON_EVENT kind;
+    STATE state;
+    int set_num;
+    int missed;
+    /* Time left in the phase when the line was sent */
+    int64_t left_ns;
+    bool paused;
+    ALERT_TYPE alert;
+    char text[DAEMON_LINE_MAX];
+} DaemonEvent;
+
+/* A client attached to the daemon */
+typedef struct {
+    /* The connection, or -1 if the slot is free */
+    int fd;
+    /* The part of a command line read so far */
+    size_t len;
+    char in[DAEMON_LINE_MAX];
+} DaemonClient;
+
+/*
+ * The daemon frontend. It draws nothing itself: it owns the day and
+ * sends what happens to it, as lines of text, to every client attached
+ * to a Unix domain socket. Each client is sent where the day stands as
+ * soon as it connects, then each event as it happens. Clients send back
+ * commands, one per line:
+ *     pause: pause or resume the phase
+ *     skip: skip to the next phase
+ *     profile: switch to the next profile
+ *     info: show today's time focused to every client
+ *     status: send where the day stands again, to this client only
+ *     stop: end the day and the daemon
+ * All of the sockets are watched by one epoll instance, whose fd stands in
+ * for the terminal in the event loop, so the daemon sleeps until a
+ * deadline or a client wakes it, however many clients there are. A client
+ * that stops reading until its socket buffer fills up is dropped.
+ */
+typedef struct {
+    /* Operations and display settings; must come first */
+    Frontend base;
+    int listen_fd;
+    int epoll_fd;
+    /* The socket file, removed by Daemon_destroy */
+    const char *socket_path;
+    /* The timer the day runs on, for the time left */
+    Timer *timer;
+    /* The phase being reported on */
+    STATE state;
+    int set_num;
+    int missed;
+    bool paused;
+    /* Seconds left when the phase was paused */
+    int paused_left;
+    DaemonClient *clients;
+    int client_count;
+    /* Commands from clients, as keys for the event loop, in a ring */
+    char keys[DAEMON_KEYS_MAX];
+    int key_head;
+    int key_count;
+    /* Events not yet sent to the clients */
+    char out[DAEMON_OUT_MAX];
+    size_t out_len;
+} Daemon;
+
+/*
+ * Make the socket clients attach to. A socket file left by a daemon that
+ * died is replaced; one a daemon still answers on is not.
+ *
+ * Parameters:
+ *     path: the socket file
+ *
+ * Returns:
+ *     On success, the listening socket
+ *     On failure, or if a daemon is already running, -1
+ */
+int Daemon_listen(const char *path);
+
+/*
+ * Set up a daemon frontend on a listening socket. It wakes up only at the
+ * end of each phase and when clients connect or send commands, and the
+ * event loop ends as soon as the day is done.
+ *
+ * Parameters:
+ *     d: the Daemon to set up
+ *     listen_fd: a socket from Daemon_listen, which the Daemon takes over
+ *     socket_path: the socket file, which must outlive d
+ *     t: the timer the day runs on
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Daemon_init(Daemon *d, int listen_fd, const char *socket_path, Timer *t);
+
+/*
+ * Detach every client, close the socket and remove its file.
+ *
+ * Parameters:
+ *     d: the Daemon to tear down
+ * Returns: none
+ */
+void Daemon_destroy(Daemon *d);
+
+/*
+ * Attach to a running daemon.
+ *
+ * Parameters:
+ *     path: the socket file
+ *
+ * Returns:
+ *     On success, the connected socket
+ *     On failure, or if no daemon is running, -1
+ */
+int Daemon_connect(const char *path);
+
+/*
+ * Send a command to the daemon. A daemon that has gone away makes this
+ * fail rather than raise SIGPIPE.
+ *
+ * Parameters:
+ *     fd: a socket from Daemon_connect
+ *     cmd: the command, without its newline, e.g. from Daemon_command
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Daemon_send_command(int fd, const char *cmd);
+
+/*
+ * The command a key sends to the daemon.
+ *
+ * Parameters:
+ *     key: a key as the event loop takes it, e.g. 'p'
+ *
+ * Returns: the command, or NULL if the key has none
+ */
+const char *Daemon_command(int key);
+
+/*
+ * Parse a line from the daemon.
+ *
+ * Parameters:
+ *     line: the line, without its newline
+ *     ev: filled in with what it says
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Daemon_parse_event(const char *line, DaemonEvent *ev);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "export.h"
+#include "frontend.h"
+#include "pomodoro.h"
+#include "stats.h"
+
+/* Room kept free in the buffer for the longest line or event written */
+#define EXPORT_LINE_MAX 512
+
+/* Records read between handing the pages behind them back to the kernel */
+#define EXPORT_CHUNK 4096
+
+/* A date and time of day, broken out of seconds since the epoch */
+typedef struct {
+    int year;
+    int month;
+    int mday;
+    int hour;
+    int min;
+    int sec;
+} civil_time;
+
+/*
+ * Days since 1970-01-01 of a date in the proleptic Gregorian calendar,
+ * counted in 400-year eras of 146097 days that start on 1 March.
+ */
+static int32_t days_from_civil(int year, int month, int mday) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/* The inverse of days_from_civil, with the time of day added */
+static void civil_from_time(int64_t time, civil_time *out) {
+    int64_t days = time / SECONDS_PER_DAY;
+    int64_t secs = time % SECONDS_PER_DAY;
+    if (secs < 0) {
+        secs += SECONDS_PER_DAY;
+        days--;
+    }
+    out->hour = secs / 3600;
+    out->min = secs / 60 % 60;
+    out->sec = secs % 60;
+
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int doe = days - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    out->mday = doy - (153 * mp + 2) / 5 + 1;
+    out->month = mp < 10 ? mp + 3 : mp - 9;
+    out->year = yoe + era * 400 + (out->month <= 2);
+}
+
+/* Name of a phase as an event title */
+static const char *phase_title(uint8_t state) {
+    switch (state) {
+        case POMODORO_WORK:
+            return "Work session";
+        case POMODORO_SHORT_REST:
+            return "Short break";
+        case POMODORO_LONG_REST:
+            return "Long break";
+        default:
+            return "Pomodoro phase";
+    }
+}
+
+/* Name of a HISTORY_OUTCOME */
+static const char *outcome_name(uint8_t outcome) {
+    switch (outcome) {
+        case HISTORY_COMPLETED:
+            return "completed";
+        case HISTORY_SKIPPED:
+            return "skipped";
+        case HISTORY_MISSED:
+            return "missed";
+        case HISTORY_INTERRUPTED:
+            return "interrupted";
+        default:
+            return "unknown";
+    }
+}
+
+static int export_flush(Exporter *e) {
+    if (e->len > 0) {
+        int rc = Frontend_write_all(e->fd, e->buf, e->len);
+        check(rc == 0, "Failed to write the export");
+        e->len = 0;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Add a string to the output buffer */
+static char *put_str(char *p, const char *str) {
+    while (*str != '\0') {
+        *p++ = *str++;
+    }
+    return p;
+}
+
+/* Add a number to the output buffer, padded with zeroes to width digits */
+static char *put_uint(char *p, uint64_t n, int width) {
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    while (len < width) {
+        digits[len++] = '0';
+    }
+    while (len > 0) {
+        *p++ = digits[--len];
+    }
+    return p;
+}
+
+/*
+ * Add a date and time to the output buffer, as YYYY-MM-DD HH:MM:SS, or as
+ * iCalendar's YYYYMMDDTHHMMSSZ if ics is set.
+ */
+static char *put_time(char *p, int64_t time, int ics) {
+    civil_time t;
+    civil_from_time(time, &t);
+    p = put_uint(p, t.year, 4);
+    if (!ics) {
+        *p++ = '-';
+    }
+    p = put_uint(p, t.month, 2);
+    if (!ics) {
+        *p++ = '-';
+    }
+    p = put_uint(p, t.mday, 2);
+    *p++ = ics ? 'T' : ' ';
+    p = put_uint(p, t.hour, 2);
+    if (!ics) {
+        *p++ = ':';
+    }
+    p = put_uint(p, t.min, 2);
+    if (!ics) {
+        *p++ = ':';
+    }
+    p = put_uint(p, t.sec, 2);
+    if (ics) {
+        *p++ = 'Z';
+    }
+    return p;
+}
+
+/*
+ * One CSV line; times are local, as a spreadsheet would show them. The
+ * buffer must have at least EXPORT_LINE_MAX bytes free.
+ */
+static void export_csv(Exporter *e, const HistoryRecord *r) {
+    char *p = e->buf + e->len;
+    p = put_uint(p, e->source, 1);
+    *p++ = ',';
+    p = put_time(p, r->start + e->utc_offset, 0);
+    *p++ = ',';
+    p = put_time(p, r->start + r->duration + r->paused + e->utc_offset, 0);
+    *p++ = ',';
+    p = put_str(p, Pomodoro_state_name((STATE)r->state));
+    *p++ = ',';
+    p = put_uint(p, r->set_num, 1);
+    *p++ = ',';
+    p = put_uint(p, r->phase_index, 1);
+    *p++ = ',';
+    p = put_uint(p, r->duration, 1);
+    *p++ = ',';
+    p = put_uint(p, r->planned, 1);
+    *p++ = ',';
+    p = put_uint(p, r->paused, 1);
+    *p++ = ',';
+    p = put_str(p, outcome_name(r->outcome));
+    int work = r->state == POMODORO_WORK && r->outcome != HISTORY_MISSED;
+    p = put_str(p, !work ? ",0,0,0\n" : r->outcome == HISTORY_COMPLETED
+            ? ",1,1,0\n" : ",1,0,1\n");
+    e->len = p - e->buf;
+}
+
+/*
+ * One CSV line for a day's summary, with the columns that only apply to a
+ * single phase left empty.
+ */
+static void export_csv_summary(Exporter *e, const HistorySummary *s) {
+    char *p = e->buf + e->len;
+    p = put_uint(p, e->source, 1);
+    *p++ = ',';
+    p = put_time(p, s->start + e->utc_offset, 0);
+    *p++ = ',';
+    p = put_time(p, s->start + s->span + e->utc_offset, 0);
+    p = put_str(p, ",day,,,");
+    p = put_uint(p, s->focused, 1);
+    p = put_str(p, ",,,summary,");
+    p = put_uint(p, s->started, 1);
+    *p++ = ',';
+    p = put_uint(p, s->completed, 1);
+    *p++ = ',';
+    p = put_uint(p, s->interrupted, 1);
+    *p++ = '\n';
+    e->len = p - e->buf;
+}
+
+/*
+ * One iCalendar event, in UTC; lines end in CRLF, as RFC 5545 requires.
+ * The buffer must have at least EXPORT_LINE_MAX bytes free.
+ */
+static void export_ics(Exporter *e, const HistoryRecord *r) {
+    char *p = e->buf + e->len;
+    p = put_str(p, "BEGIN:VEVENT\r\nUID:");
+    p = put_uint(p, r->start, 1);
+    *p++ = '-';
+    p = put_uint(p, r->phase_index, 1);
+    *p++ = '-';
+    p = put_uint(p, e->source, 1);
+    p = put_str(p, "@pomodoro_curses\r\nDTSTAMP:");
+    p = put_str(p, e->stamp);
+    p = put_str(p, "\r\nDTSTART:");
+    p = put_time(p, r->start, 1);
+    p = put_str(p, "\r\nDTEND:");
+    p = put_time(p, r->start + r->duration + r->paused, 1);
+    p = put_str(p, "\r\nSUMMARY:");
+    p = put_str(p, phase_title(r->state));
+    p = put_str(p, " (");
+    p = put_str(p, outcome_name(r->outcome));
+    p = put_str(p, ")\r\nEND:VEVENT\r\n");
+    e->len = p - e->buf;
+}
+
+/* A day's summary, as an all-day event on its local date */
+static void export_ics_summary(Exporter *e, const HistorySummary *s) {
+    civil_time date;
+    civil_from_time(s->start + e->utc_offset, &date);
+    char *p = e->buf + e->len;
+    p = put_str(p, "BEGIN:VEVENT\r\nUID:");
+    p = put_uint(p, s->start, 1);
+    p = put_str(p, "-day-");
+    p = put_uint(p, e->source, 1);
+    p = put_str(p, "@pomodoro_curses\r\nDTSTAMP:");
+    p = put_str(p, e->stamp);
+    p = put_str(p, "\r\nDTSTART;VALUE=DATE:");
+    p = put_uint(p, date.year, 4);
+    p = put_uint(p, date.month, 2);
+    p = put_uint(p, date.mday, 2);
+    p = put_str(p, "\r\nSUMMARY:");
+    p = put_uint(p, s->completed, 1);
+    p = put_str(p, " of ");
+    p = put_uint(p, s->started, 1);
+    p = put_str(p, " work sessions done, ");
+    p = put_uint(p, s->focused / SECONDS_PER_MINUTE, 1);
+    p = put_str(p, " minutes focused\r\nEND:VEVENT\r\n");
+    e->len = p - e->buf;
+}
+
+int Export_parse_format(const char *name) {
+    if (name == NULL) {
+        return -1;
+    } else if (strcmp(name, "csv") == 0) {
+        return EXPORT_CSV;
+    } else if (strcmp(name, "ics") == 0) {
+        return EXPORT_ICS;
+    }
+    return -1;
+}
+
+int Export_parse_date(const char *text, int32_t *day) {
+    int year;
+    int month;
+    int mday;
+    int end = 0;
+    check(text != NULL, "Got NULL date");
+    int rc = sscanf(text, "%4d-%2d-%2d%n", &year, &month, &mday, &end);
+    check(rc == 3 && text[end] == '\0', "Bad date '%s'; use YYYY-MM-DD",
+            text);
+    check(month >= 1 && month <= 12 && mday >= 1 && mday <= 31,
+            "Bad date '%s'", text);
+    *day = days_from_civil(year, month, mday);
+
+    return 0;
+error:
+    return -1;
+}
+
+int Export_begin(Exporter *e, int fd, EXPORT_FORMAT format,
+        int64_t utc_offset, int32_t from, int32_t to) {
+    check(e != NULL, "Got NULL Exporter pointer");
+    check(format == EXPORT_CSV || format == EXPORT_ICS,
+            "Bad export format %d", format);
+    e->fd = fd;
+    e->format = format;
+    e->utc_offset = utc_offset;
+    e->from = from;
+    e->to = to;
+    *put_time(e->stamp, time(NULL), 1) = '\0';
+    e->source = 0;
+    e->len = 0;
+
+    char *p = e->buf;
+    if (format == EXPORT_CSV) {
+        p = put_str(p, "log,start,end,phase,set,index,duration,planned,"
+                "paused,outcome,started,completed,interrupted\n");
+    } else {
+        p = put_str(p, "BEGIN:VCALENDAR\r\n"
+                "VERSION:2.0\r\n"
+                "PRODID:-//pomodoro_curses//history export//EN\r\n"
+                "CALSCALE:GREGORIAN\r\n");
+    }
+    e->len = p - e->buf;
+
+    return 0;
+error:
+    return -1;
+}
+
+long Export_history(Exporter *e, const HistoryMap *m) {
+    check(e != NULL, "Got NULL Exporter pointer");
+    check(m != NULL, "Got NULL HistoryMap pointer");
+    e->source++;
+    long written = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    const char *released = m->map;
+
+    for (size_t i = 0; i < m->count; i++) {
+        /*
+         * Drop the pages already read, so the log is never all resident;
+         * done first, so records that are passed over count too
+         */
+        if (i > 0 && i % EXPORT_CHUNK == 0) {
+            const char *done = (const char *)&m->records[i];
+            size_t whole = (done - released) / page * page;
+            if (whole > 0) {
+                madvise((void *)released, whole, MADV_DONTNEED);
+                released += whole;
+            }
+        }
+        const HistoryRecord *r = &m->records[i];
+        if (!History_record_ok(r)) {
+            continue;
+        }
+        int32_t day = Stats_day_of(r->start, e->utc_offset);
+        if (day < e->from || day > e->to) {
+            continue;
+        }
+        if (e->format == EXPORT_ICS && r->outcome == HISTORY_MISSED) {
+            continue;
+        }
+        if (EXPORT_BUFFER - e->len < EXPORT_LINE_MAX) {
+            check(export_flush(e) == 0, "Failed to flush the export");
+        }
+        if (r->outcome == HISTORY_SUMMARY) {
+            const HistorySummary *sum = (const HistorySummary *)r;
+            if (e->format == EXPORT_CSV) {
+                export_csv_summary(e, sum);
+            } else {
+                export_ics_summary(e, sum);
+            }
+        } else if (e->format == EXPORT_CSV) {
+            export_csv(e, r);
+        } else {
+            export_ics(e, r);
+        }
+        written++;
+    }
+
+    return written;
+error:
+    return -1;
+}
+
+int Export_end(Exporter *e) {
+    check(e != NULL, "Got NULL Exporter pointer");
+    if (e->format == EXPORT_ICS) {
+        if (EXPORT_BUFFER - e->len < EXPORT_LINE_MAX) {
+            check(export_flush(e) == 0, "Failed to flush the export");
+        }
+        e->len = put_str(e->buf + e->len, "END:VCALENDAR\r\n") - e->buf;
+    }
+    check(export_flush(e) == 0, "Failed to flush the export");
+
+    return 0;
+error:
+    return -1;
+}
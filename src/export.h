@@ -0,0 +1,112 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "history.h"
+
+/* Bytes of output held before they are written out */
+#define EXPORT_BUFFER 65536
+
+typedef enum {
+    /* One line per phase, for spreadsheets */
+    EXPORT_CSV,
+    /* One iCalendar event per phase that ran, for calendars */
+    EXPORT_ICS
+} EXPORT_FORMAT;
+
+/*
+ * Writes history logs out as CSV or iCalendar in a single pass. Output
+ * goes through a buffer of fixed size, so memory use does not grow with
+ * the history, however many logs are written or how long they are.
+ */
+typedef struct {
+    int fd;
+    EXPORT_FORMAT format;
+    /* Offset from UTC, in s, that days and CSV times are given in */
+    int64_t utc_offset;
+    /* Only phases started from this day to that one, inclusive */
+    int32_t from;
+    int32_t to;
+    /* When the export was made, for iCalendar's DTSTAMP */
+    char stamp[24];
+    /* Logs written so far, to tell their phases apart */
+    int source;
+    size_t len;
+    char buf[EXPORT_BUFFER];
+} Exporter;
+
+/*
+ * Map an export format name onto its EXPORT_FORMAT.
+ *
+ * Parameters:
+ *     name: 'csv' or 'ics'
+ *
+ * Returns:
+ *     on success, the EXPORT_FORMAT
+ *     on failure, -1
+ */
+int Export_parse_format(const char *name);
+
+/*
+ * Parse a date given as YYYY-MM-DD.
+ *
+ * Parameters:
+ *     text: the date
+ *     day: set to the day, in days since 1970-01-01, as from Stats_day_of
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Export_parse_date(const char *text, int32_t *day);
+
+/*
+ * Set up an Exporter and write the start of the output.
+ *
+ * Parameters:
+ *     e: the Exporter to set up
+ *     fd: the file to write to
+ *     format: the EXPORT_FORMAT
+ *     utc_offset: the local offset from UTC, in s
+ *     from: the first day to export, as from Stats_day_of
+ *     to: the last day to export, inclusive
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Export_begin(Exporter *e, int fd, EXPORT_FORMAT format,
+        int64_t utc_offset, int32_t from, int32_t to);
+
+/*
+ * Write out the phases of a history log that started within the days
+ * asked for. Records that fail their checksum are left out, as are missed
+ * phases in iCalendar. Days that were compacted come out as one line in
+ * CSV and as an all-day event in iCalendar. The log is read front to back, and the parts of
+ * the mapping already read are given back to the kernel as it goes.
+ *
+ * Parameters:
+ *     e: the Exporter
+ *     m: the mapped history log
+ *
+ * Returns:
+ *     on success, the number of phases written
+ *     on failure, -1
+ */
+long Export_history(Exporter *e, const HistoryMap *m);
+
+/*
+ * Write the end of the output and flush what is left of it.
+ *
+ * Parameters:
+ *     e: the Exporter
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Export_end(Exporter *e);
+
+#endif
@@ -0,0 +1,246 @@
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "frontend.h"
+
+/* Length of a tenth of a second, in nanoseconds */
+#define TENTH_NS (NSEC_PER_SEC / 10)
+
+/* Most unchanged cells Frontend_update_line rewrites to join two runs */
+#define LINE_RUN_GAP 6
+
+/* How long to wait for the terminal to answer Frontend_probe_sync_output */
+#define PROBE_TIMEOUT_MS 200
+
+char *pomodoro_status(STATE state) {
+    switch (state) {
+        case POMODORO_WORK:
+            return "Working, working, working...";
+        case POMODORO_SHORT_REST:
+            return "Taking a little break :)";
+        case POMODORO_LONG_REST:
+            return "Relaxing for a while :D";
+        case POMODORO_DONE:
+            return "All done! Press any key to exit.";
+        case POMODORO_ERROR:
+            return "Something went wrong :(";
+        default:
+            sentinel("Invalid STATE value");
+    }
+error:
+    return NULL;
+}
+
+void Frontend_format_time(char *buf, size_t size, int time_left, int tenths,
+        bool paused, bool low_power) {
+    int hours = time_left / (SECONDS_PER_MINUTE * MINUTES_PER_HOUR);
+    int minutes = (time_left / SECONDS_PER_MINUTE) % MINUTES_PER_HOUR;
+    int seconds = time_left % SECONDS_PER_MINUTE;
+    if (low_power && time_left > 0 && seconds == 0) {
+        snprintf(buf, size, "%sTime left: %d min",
+                paused ? "[Paused] " : "", time_left / SECONDS_PER_MINUTE);
+    } else if (tenths >= 0) {
+        snprintf(buf, size, "%sTime left: %02d:%02d:%02d.%d",
+                paused ? "[Paused] " : "", hours, minutes, seconds, tenths);
+    } else {
+        snprintf(buf, size, "%sTime left: %02d:%02d:%02d",
+                paused ? "[Paused] " : "", hours, minutes, seconds);
+    }
+}
+
+void Frontend_update_line(UiLine *line, int width, const char *text,
+        line_writer put, void *ctx) {
+    /* Stay clear of the border columns */
+    int room = width - 2 < UI_LINE_MAX - 1 ? width - 2 : UI_LINE_MAX - 1;
+    if (room <= 0) {
+        return;
+    }
+    int len = strnlen(text, room);
+    int x = (width - len) / 2;
+
+    int from = line->len > 0 && line->x < x ? line->x : x;
+    int old_end = line->x + line->len;
+    int to = old_end > x + len ? old_end : x + len;
+
+    /*
+     * Walk the union of the old and new spans, writing runs of changes. A
+     * run carries on over a short gap of unchanged cells, since rewriting
+     * them costs less than moving the cursor past them.
+     */
+    int run_start = -1;
+    /* One past the last changed cell of the run */
+    int run_end = -1;
+    char run[UI_LINE_MAX];
+    for (int col = from; col <= to; col++) {
+        char new_c = ' ';
+        char old_c = ' ';
+        bool changed = false;
+        if (col < to) {
+            if (col >= x && col < x + len) {
+                new_c = text[col - x];
+            }
+            if (col >= line->x && col < old_end) {
+                old_c = line->text[col - line->x];
+            }
+            changed = new_c != old_c;
+        }
+        if (changed) {
+            if (run_start == -1) {
+                run_start = col;
+            }
+            run_end = col + 1;
+        } else if (run_start != -1
+                && (col == to || col - run_end >= LINE_RUN_GAP)) {
+            put(ctx, run_start, run, run_end - run_start);
+            run_start = -1;
+        }
+        if (run_start != -1) {
+            run[col - run_start] = new_c;
+        }
+    }
+
+    line->x = x;
+    line->len = len;
+    memcpy(line->text, text, len);
+}
+
+int64_t Frontend_present(Frontend *f, Timer *t, PomodoroStatus *status,
+        ALERT_TYPE type) {
+    check(f != NULL, "Got NULL Frontend pointer");
+    check(t != NULL, "Got NULL Timer pointer");
+    check(status != NULL, "Got NULL PomodoroStatus pointer");
+    int rc = 0;
+
+    if (status->events & POMODORO_EV_PHASE_END) {
+        rc = f->alert(f, type);
+        check(rc == 0, "Terminal alert failure!");
+    }
+
+    rc = Timer_set_deadline(t, status->deadline_ns);
+    check(rc == 0, "Failed to set main timer.");
+    if (status->paused) {
+        t->seconds = (status->remaining_ns + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+    }
+    int step = f->low_power ? Timer_coarse_step(t) : TIMER_PULSE;
+    int shown = (t->seconds + step - 1) / step * step;
+    int tenths = -1;
+    bool fine = f->fps > 0 && !f->low_power && !status->paused
+            && status->state != POMODORO_DONE
+            && t->seconds <= SECONDS_PER_MINUTE;
+    if (fine) {
+        int64_t left = t->deadline_ns - Timer_now(t);
+        int64_t left_tenths = left > 0 ? (left + TENTH_NS - 1) / TENTH_NS : 0;
+        shown = left_tenths / 10;
+        tenths = left_tenths % 10;
+    }
+    if (status->events & (POMODORO_EV_PHASE_START | POMODORO_EV_DONE)
+            || status->state == POMODORO_DONE) {
+        f->show_session(f, status->state, status->set_num, status->missed,
+                shown);
+    } else {
+        f->show_time_left(f, shown, tenths, status->paused);
+    }
+    f->flush(f);
+
+    if (status->paused || status->state == POMODORO_DONE) {
+        return 0;
+    }
+    if (fine) {
+        return Timer_next_frame(t, TENTH_NS, f->fps);
+    }
+    if (f->tick > 0) {
+        step = f->tick;
+    } else if (f->tick < 0) {
+        /* A step as long as the phase lands on its end */
+        step = t->seconds > 0 ? t->seconds : 1;
+    }
+    return Timer_next_change(t, step);
+error:
+    return -1;
+}
+
+/*
+ * Whether buf holds a complete primary device attributes answer,
+ * ESC [ ? digits-and-semicolons c
+ */
+static bool has_da1_answer(const char *buf) {
+    for (const char *p = strstr(buf, "\033[?"); p != NULL;
+            p = strstr(p + 1, "\033[?")) {
+        const char *q = p + 3;
+        while ((*q >= '0' && *q <= '9') || *q == ';') {
+            q++;
+        }
+        if (*q == 'c') {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Frontend_probe_sync_output(int in_fd, int out_fd) {
+    struct termios saved;
+    if (!isatty(in_fd) || !isatty(out_fd) || tcgetattr(in_fd, &saved) != 0) {
+        return false;
+    }
+    struct termios raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    int rc = tcsetattr(in_fd, TCSANOW, &raw);
+    check(rc == 0, "Failed to put the terminal in raw mode");
+
+    char buf[256] = "";
+    size_t len = 0;
+    const char query[] = "\033[?2026$p\033[c";
+    if (write(out_fd, query, sizeof(query) - 1) == sizeof(query) - 1) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (len < sizeof(buf) - 1 && !has_da1_answer(buf)) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int waited = (now.tv_sec - start.tv_sec) * 1000
+                    + (now.tv_nsec - start.tv_nsec) / 1000000;
+            struct pollfd pfd = { .fd = in_fd, .events = POLLIN };
+            if (waited >= PROBE_TIMEOUT_MS
+                    || poll(&pfd, 1, PROBE_TIMEOUT_MS - waited) <= 0) {
+                break;
+            }
+            ssize_t n = read(in_fd, buf + len, sizeof(buf) - 1 - len);
+            if (n <= 0) {
+                break;
+            }
+            len += n;
+            buf[len] = '\0';
+        }
+    }
+    tcsetattr(in_fd, TCSANOW, &saved);
+
+    /* DECRPM: ESC [ ? 2026 ; Ps $ y, where Ps 1-3 mean the mode exists */
+    char *answer = strstr(buf, "\033[?2026;");
+    if (answer == NULL) {
+        return false;
+    }
+    char ps = answer[strlen("\033[?2026;")];
+    return ps >= '1' && ps <= '3';
+error:
+    return false;
+}
+
+int Frontend_write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pomodoro.h"
+
+/* Longest line of text a frontend puts on screen */
+#define UI_LINE_MAX 128
+
+/* Height of the status pane: 2 border rows, 2 padding rows, 2 messages */
+#define UI_STATUS_HEIGHT 6
+
+/* Fewest terminal rows a frontend can lay itself out in */
+#define UI_MIN_ROWS 10
+
+/* Most frames per second the sub-second display may ask for */
+#define UI_MAX_FPS 60
+
+/* DEC private mode 2026: hold the screen while a frame is written */
+#define SYNC_BEGIN "\033[?2026h"
+#define SYNC_END "\033[?2026l"
+
+typedef enum {
+    ALERT_UNSET = 0,
+    ALERT_BEEP = 1,
+    ALERT_FLASH = 2
+} ALERT_TYPE;
+
+/* What is currently on screen in one line of a pane */
+typedef struct {
+    /* Column the text starts at */
+    int x;
+    int len;
+    char text[UI_LINE_MAX];
+} UiLine;
+
+/*
+ * Writes one run of changed cells for Frontend_update_line: len characters
+ * of run, starting at column x of the line.
+ */
+typedef void (*line_writer)(void *ctx, int x, const char *run, int len);
+
+/*
+ * Something that can draw the status and timer panes. Each frontend embeds
+ * this as its first member and fills in the operations; the event loop and
+ * Frontend_present only ever go through them.
+ */
+typedef struct Frontend {
+    /*
+     * Ring the bell or flash the screen. Returns 0 on success, -1 on
+     * failure.
+     */
+    int (*alert)(struct Frontend *f, ALERT_TYPE type);
+    /* Put a one-off message in the status pane, e.g. a welcome splash */
+    void (*show_message)(struct Frontend *f, const char *msg);
+    /* Show the start of a session; see Ui_show_session */
+    void (*show_session)(struct Frontend *f, STATE state, int set_num,
+            int missed, int time_left);
+    /* Show the time left in a session; see Ui_show_time_left */
+    void (*show_time_left)(struct Frontend *f, int time_left, int tenths,
+            bool paused);
+    /* Send everything drawn since the last flush to the terminal */
+    void (*flush)(struct Frontend *f);
+    /*
+     * Lay out again for a new terminal size. Returns 0, or -1 on failure.
+     * NULL if the frontend does not draw on a terminal.
+     */
+    int (*resize)(struct Frontend *f, int rows, int cols);
+    /*
+     * The next key pressed, or -1 if none is waiting. NULL if the frontend
+     * takes no keys, in which case the day ends by itself when it is done.
+     */
+    int (*read_key)(struct Frontend *f);
+    /* What to wait on for keys to read_key; stdin (0) unless set */
+    int input_fd;
+    /* Whether the day ends as soon as it is done, though keys are read */
+    bool leave_when_done;
+    /*
+     * Show the time left in coarse steps (see Timer_coarse_step) and only
+     * wake up when the shown value changes
+     */
+    bool low_power;
+    /*
+     * If not 0, show tenths of a second during the last minute of a phase,
+     * drawing at most this many frames a second
+     */
+    int fps;
+    /* Whether to wrap each frame in DEC mode 2026 synchronized output */
+    bool sync_output;
+    /*
+     * If more than 0, update the time left only when it is a multiple of
+     * this many seconds, rather than whenever the display would change; if
+     * less than 0, only at the start and end of each phase
+     */
+    int tick;
+} Frontend;
+
+/*
+ * Return a friendly status message to show to the user
+ *
+ * Parameters:
+ *     state: The current state --- working or resting
+ *
+ * Return:
+ *     If state is valid, a human-friendly string describing the current state.
+ *     Else, NULL
+ */
+char *pomodoro_status(STATE state);
+
+/*
+ * Format the time left as one line of text, e.g. "Time left: 00:24:59".
+ * Low-power mode shows a whole number of minutes as minutes only.
+ *
+ * Parameters:
+ *     buf: where to put the text
+ *     size: size of buf
+ *     time_left: seconds left in the session
+ *     tenths: tenths of a second to show after time_left, or -1 for none
+ *     paused: whether the session is paused
+ *     low_power: whether the Frontend is in low-power mode
+ */
+void Frontend_format_time(char *buf, size_t size, int time_left, int tenths,
+        bool paused, bool low_power);
+
+/*
+ * Center a line of text in a pane width columns wide, and hand the runs of
+ * cells that differ from what the line last held to put.
+ *
+ * Parameters:
+ *     line: what is on that row now; updated to hold text
+ *     width: width of the pane, including its border columns
+ *     text: the new contents of the row
+ *     put: called once per run of changed cells
+ *     ctx: passed through to put
+ */
+void Frontend_update_line(UiLine *line, int width, const char *text,
+        line_writer put, void *ctx);
+
+/*
+ * Act on the outcome of a Pomodoro_step: alert at the end of a phase, paint
+ * the screen, and work out when the timer next needs to wake up. In
+ * low-power mode that is the next time the coarse display changes, which
+ * also lands on the end of the phase. With a frame rate set, the last
+ * minute of a phase shows tenths of a second, and frames are paced by
+ * Timer_next_frame. Otherwise a tick, if set, decides the wakeups.
+ *
+ * Parameters:
+ *     f: the Frontend to draw on
+ *     t: the Timer used to track the current phase
+ *     status: what Pomodoro_step found
+ *     type: the type of alert to use
+ *
+ * Returns:
+ *     on success, the time to wake up for the next update, or 0 if nothing
+ *     is left to count down
+ *     on failure, -1
+ */
+int64_t Frontend_present(Frontend *f, Timer *t, PomodoroStatus *status,
+        ALERT_TYPE type);
+
+/*
+ * Ask the terminal whether it supports synchronized output (DEC private mode
+ * 2026) with a DECRQM query. A device attributes query goes out right
+ * behind it, so terminals that do not know DECRQM are caught by their
+ * answer to that rather than by waiting out the timeout. Must run before a
+ * frontend takes over the terminal.
+ *
+ * Parameters:
+ *     in_fd: the terminal to read the answers from
+ *     out_fd: the terminal to send the queries to
+ *
+ * Returns: whether mode 2026 is supported
+ */
+bool Frontend_probe_sync_output(int in_fd, int out_fd);
+
+/*
+ * Write all of a buffer to a file descriptor, retrying short writes.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int Frontend_write_all(int fd, const char *buf, size_t len);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbg.h"
+#include "headless.h"
+
+/* Longest single event line */
+#define EVENT_MAX 256
+
+static void headless_write_out(Headless *h) {
+    if (h->out_len > 0) {
+        Frontend_write_all(h->out_fd, h->out, h->out_len);
+        h->out_len = 0;
+    }
+}
+
+/*
+ * Add one event line to the output buffer.
+ *
+ * Parameters:
+ *     h: the Headless to report on
+ *     event: what happened: start, tick, pause, resume or done
+ *     time_left: seconds left in the phase
+ *     missed: phases that ran out while the machine was suspended
+ */
+static void put_event(Headless *h, const char *event, int time_left,
+        int missed) {
+    char stamp[32];
+    struct timespec now;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &now);
+    gmtime_r(&now.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    char line[EVENT_MAX];
+    int len = 0;
+    bool done = h->state == POMODORO_DONE;
+    if (h->format == HEADLESS_JSON) {
+        len = snprintf(line, sizeof(line),
+                "{\"time\":\"%s\",\"event\":\"%s\"", stamp, event);
+        if (!done) {
+            len += snprintf(line + len, sizeof(line) - len,
+                    ",\"phase\":\"%s\",\"set\":%d,\"left_s\":%d",
+                    Pomodoro_state_name(h->state), h->set_num, time_left);
+        }
+        if (missed > 0) {
+            len += snprintf(line + len, sizeof(line) - len,
+                    ",\"missed\":%d", missed);
+        }
+        len += snprintf(line + len, sizeof(line) - len, "}\n");
+    } else {
+        len = snprintf(line, sizeof(line), "%s %s", stamp, event);
+        if (!done) {
+            len += snprintf(line + len, sizeof(line) - len,
+                    " %s set=%d left=%02d:%02d:%02d",
+                    Pomodoro_state_name(h->state), h->set_num,
+                    time_left / (SECONDS_PER_MINUTE * MINUTES_PER_HOUR),
+                    (time_left / SECONDS_PER_MINUTE) % MINUTES_PER_HOUR,
+                    time_left % SECONDS_PER_MINUTE);
+        }
+        if (missed > 0) {
+            len += snprintf(line + len, sizeof(line) - len, " missed=%d",
+                    missed);
+        }
+        len += snprintf(line + len, sizeof(line) - len, "\n");
+    }
+
+    if (h->out_len + len > HEADLESS_OUT_MAX) {
+        headless_write_out(h);
+    }
+    memcpy(h->out + h->out_len, line, len);
+    h->out_len += len;
+}
+
+/* Phase ends are reported by the start of the next phase */
+static int headless_alert(Frontend *f, ALERT_TYPE type) {
+    (void)f;
+    (void)type;
+    return 0;
+}
+
+/* There is no status pane to put messages in */
+static void headless_show_message(Frontend *f, const char *msg) {
+    (void)f;
+    (void)msg;
+}
+
+static void headless_show_session(Frontend *f, STATE state, int set_num,
+        int missed, int time_left) {
+    Headless *h = (Headless *)f;
+    h->state = state;
+    h->set_num = set_num;
+    h->paused = false;
+    put_event(h, state == POMODORO_DONE ? "done" : "start", time_left,
+            missed);
+}
+
+static void headless_show_time_left(Frontend *f, int time_left, int tenths,
+        bool paused) {
+    (void)tenths;
+    Headless *h = (Headless *)f;
+    if (paused != h->paused) {
+        h->paused = paused;
+        put_event(h, paused ? "pause" : "resume", time_left, 0);
+    } else if (h->base.tick > 0 && !paused) {
+        put_event(h, "tick", time_left, 0);
+    }
+}
+
+static void headless_flush(Frontend *f) {
+    headless_write_out((Headless *)f);
+}
+
+int Headless_init(Headless *h, int out_fd, HEADLESS_FORMAT format) {
+    check(h != NULL, "Got NULL Headless pointer");
+    check(format == HEADLESS_TEXT || format == HEADLESS_JSON,
+            "Invalid headless format %d", format);
+    memset(h, 0, sizeof(Headless));
+    h->out_fd = out_fd;
+    h->format = format;
+    h->state = POMODORO_WORK;
+    h->base = (Frontend) {
+        .alert = headless_alert,
+        .show_message = headless_show_message,
+        .show_session = headless_show_session,
+        .show_time_left = headless_show_time_left,
+        .flush = headless_flush,
+        .resize = NULL,
+        .read_key = NULL,
+        .low_power = false,
+        .fps = 0,
+        .sync_output = false,
+        .tick = -1
+    };
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,61 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "frontend.h"
+
+/* Most bytes of output held back for one write(2) */
+#define HEADLESS_OUT_MAX 4096
+
+typedef enum {
+    /* One line of plain text per event */
+    HEADLESS_TEXT,
+    /* One JSON object per line (JSON Lines) */
+    HEADLESS_JSON
+} HEADLESS_FORMAT;
+
+/*
+ * The headless frontend. Instead of drawing, it reports what happens to
+ * the day as a stream of complete lines, one per event:
+ *     start: a phase began (or several ran out while suspended)
+ *     tick: time left in the phase, only if ticks were asked for
+ *     pause, resume: the phase was paused or resumed
+ *     done: the day is over
+ * Every line carries the wall-clock time in UTC. The lines of one update
+ * go out together in a single write. It takes no keys and needs no
+ * terminal, so it runs under cron, in CI, or into another program.
+ */
+typedef struct {
+    /* Operations and display settings; must come first */
+    Frontend base;
+    int out_fd;
+    HEADLESS_FORMAT format;
+    /* The phase being reported on */
+    STATE state;
+    int set_num;
+    /* Whether the phase was paused when last reported */
+    bool paused;
+    /* Output not yet written to out_fd */
+    char out[HEADLESS_OUT_MAX];
+    size_t out_len;
+} Headless;
+
+/*
+ * Set up a headless frontend. Nothing is written until the first event.
+ * It wakes up only at the end of each phase; set base.tick to report the
+ * time left every so many seconds as well.
+ *
+ * Parameters:
+ *     h: the Headless to set up
+ *     out_fd: where to write the events
+ *     format: how to write them
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Headless_init(Headless *h, int out_fd, HEADLESS_FORMAT format);
+
+#endif
@@ -0,0 +1,402 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+#include "dbg.h"
+#include "history.h"
+#include "pomodoro.h"
+
+/* Marks a file as a history log: "PHST" */
+#define HISTORY_MAGIC 0x54534850u
+
+/* Records written to a compacted log at a time */
+#define COMPACT_BATCH 256
+
+/* Times History_append follows a log that was replaced before giving up */
+#define REOPEN_TRIES 3
+
+_Static_assert(sizeof(HistorySummary) == sizeof(HistoryRecord)
+        && offsetof(HistorySummary, outcome)
+                == offsetof(HistoryRecord, outcome)
+        && offsetof(HistorySummary, checksum)
+                == offsetof(HistoryRecord, checksum),
+        "A HistorySummary must fit in place of a HistoryRecord");
+
+/* Checksum of a record: 32-bit FNV-1a over everything before the checksum */
+static uint32_t record_checksum(const HistoryRecord *r) {
+    const unsigned char *bytes = (const unsigned char *)r;
+    uint32_t hash = 0x811c9dc5u;
+    for (size_t i = 0; i < offsetof(HistoryRecord, checksum); i++) {
+        hash ^= bytes[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+/* Whether a header is one this version of the program can read */
+static int header_ok(const HistoryHeader *hdr) {
+    return hdr->magic == HISTORY_MAGIC && hdr->version == HISTORY_VERSION
+            && hdr->record_size == sizeof(HistoryRecord);
+}
+
+int History_open(History *h, const char *path) {
+    bool locked = false;
+    check(h != NULL, "Got NULL History pointer");
+    check(path != NULL, "Got NULL history path");
+    h->path = path;
+    h->fd = -1;
+    struct stat st;
+    int rc;
+    /* Another instance may be starting, repairing or compacting the log */
+    for (int tries = 0;; tries++) {
+        h->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        check(h->fd != -1, "Failed to open history log '%s'", path);
+        rc = flock(h->fd, LOCK_EX);
+        check(rc == 0, "Failed to lock history log '%s'", path);
+        locked = true;
+        rc = fstat(h->fd, &st);
+        check(rc == 0, "Failed to stat history log '%s'", path);
+        if (st.st_nlink > 0) {
+            break;
+        }
+        check(tries < REOPEN_TRIES, "History log keeps being replaced");
+        flock(h->fd, LOCK_UN);
+        locked = false;
+        close(h->fd);
+        h->fd = -1;
+    }
+
+    if (st.st_size < (off_t)sizeof(HistoryHeader)) {
+        /* New, or its header was torn by a crash; nothing else is in it */
+        if (st.st_size > 0) {
+            rc = ftruncate(h->fd, 0);
+            check(rc == 0, "Failed to cut a torn header off '%s'", path);
+        }
+        HistoryHeader hdr = { .magic = HISTORY_MAGIC,
+                .version = HISTORY_VERSION,
+                .record_size = sizeof(HistoryRecord),
+                .created = time(NULL) };
+        check(write(h->fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr),
+                "Failed to start history log '%s'", path);
+    } else {
+        HistoryHeader hdr;
+        check(pread(h->fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr)
+                && header_ok(&hdr), "'%s' is not a history log of version %d",
+                path, HISTORY_VERSION);
+        off_t torn = (st.st_size - sizeof(hdr)) % sizeof(HistoryRecord);
+        if (torn != 0) {
+            rc = ftruncate(h->fd, st.st_size - torn);
+            check(rc == 0, "Failed to cut a torn record off '%s'", path);
+        }
+    }
+    flock(h->fd, LOCK_UN);
+
+    return 0;
+error:
+    if (h != NULL && h->fd != -1) {
+        if (locked) {
+            flock(h->fd, LOCK_UN);
+        }
+        close(h->fd);
+        h->fd = -1;
+    }
+    return -1;
+}
+
+int History_append(History *h, HistoryRecord *records, int count) {
+    bool locked = false;
+    check(h != NULL && h->fd != -1, "History log is not open");
+    check(records != NULL, "Got NULL HistoryRecord pointer");
+    check(count > 0 && count <= HISTORY_BATCH, "Bad record count %d", count);
+    for (int i = 0; i < count; i++) {
+        records[i].checksum = record_checksum(&records[i]);
+    }
+
+    /* History_compact unlinks the old log before it lets go of the lock */
+    for (int tries = 0;; tries++) {
+        int rc = flock(h->fd, LOCK_EX);
+        check(rc == 0, "Failed to lock history log");
+        locked = true;
+        struct stat st;
+        rc = fstat(h->fd, &st);
+        check(rc == 0, "Failed to stat history log");
+        if (st.st_nlink > 0) {
+            break;
+        }
+        check(tries < REOPEN_TRIES, "History log keeps being replaced");
+        History_close(h);
+        locked = false;
+        rc = History_open(h, h->path);
+        check(rc == 0, "Failed to open the compacted history log");
+    }
+    ssize_t size = count * sizeof(HistoryRecord);
+    check(write(h->fd, records, size) == size, "Failed to append history");
+    flock(h->fd, LOCK_UN);
+
+    return 0;
+error:
+    if (locked && h->fd != -1) {
+        flock(h->fd, LOCK_UN);
+    }
+    return -1;
+}
+
+void History_close(History *h) {
+    if (h != NULL && h->fd != -1) {
+        close(h->fd);
+        h->fd = -1;
+    }
+}
+
+int History_record_ok(const HistoryRecord *r) {
+    return r->checksum == record_checksum(r);
+}
+
+/* Map an open history log; the caller still closes fd */
+static int map_fd(HistoryMap *m, int fd, const char *path) {
+    m->map = NULL;
+    m->size = 0;
+    m->records = NULL;
+    m->count = 0;
+    struct stat st;
+    int rc = fstat(fd, &st);
+    check(rc == 0, "Failed to stat history log '%s'", path);
+    check(st.st_size >= (off_t)sizeof(HistoryHeader),
+            "'%s' is not a history log", path);
+
+    m->size = st.st_size;
+    m->map = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    check(m->map != MAP_FAILED, "Failed to map history log '%s'", path);
+    check(header_ok((const HistoryHeader *)m->map),
+            "'%s' is not a history log of version %d", path, HISTORY_VERSION);
+    /* The records are read in order, so let the kernel read ahead */
+    madvise(m->map, m->size, MADV_SEQUENTIAL);
+    m->records = (const HistoryRecord *)((const char *)m->map
+            + sizeof(HistoryHeader));
+    m->count = (m->size - sizeof(HistoryHeader)) / sizeof(HistoryRecord);
+
+    return 0;
+error:
+    if (m->map != NULL && m->map != MAP_FAILED) {
+        munmap(m->map, m->size);
+    }
+    m->map = NULL;
+    m->count = 0;
+    return -1;
+}
+
+int HistoryMap_open(HistoryMap *m, const char *path) {
+    int fd = -1;
+    check(m != NULL, "Got NULL HistoryMap pointer");
+    check(path != NULL, "Got NULL history path");
+    m->map = NULL;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    check(fd != -1, "Failed to open history log '%s'", path);
+    int rc = map_fd(m, fd, path);
+    close(fd);
+
+    return rc;
+error:
+    return -1;
+}
+
+void HistoryMap_close(HistoryMap *m) {
+    if (m != NULL && m->map != NULL) {
+        munmap(m->map, m->size);
+        m->map = NULL;
+        m->records = NULL;
+        m->count = 0;
+    }
+}
+
+/* Local day a time falls on, rounded down as in Stats_day_of */
+static int32_t local_day(int64_t time, int64_t utc_offset) {
+    int64_t local = time + utc_offset;
+    int64_t day = local / 86400;
+    return local % 86400 < 0 ? day - 1 : day;
+}
+
+/* Records on their way into a compacted log */
+typedef struct {
+    AtomicFile file;
+    int count;
+    HistoryRecord records[COMPACT_BATCH];
+} compact_out;
+
+static int compact_flush(compact_out *out) {
+    ssize_t size = out->count * sizeof(HistoryRecord);
+    if (size > 0) {
+        check(write(out->file.fd, out->records, size) == size,
+                "Failed to write compacted history");
+    }
+    out->count = 0;
+
+    return 0;
+error:
+    return -1;
+}
+
+static int compact_put(compact_out *out, const void *record) {
+    memcpy(&out->records[out->count++], record, sizeof(HistoryRecord));
+    return out->count == COMPACT_BATCH ? compact_flush(out) : 0;
+}
+
+/* The summary of the day being compacted */
+typedef struct {
+    bool open;
+    int32_t day;
+    /* Latest end of any of its phases */
+    int64_t end;
+    HistorySummary sum;
+} day_summary;
+
+static void summary_open(day_summary *d, int32_t day, int64_t start) {
+    memset(d, 0, sizeof(*d));
+    d->open = true;
+    d->day = day;
+    d->sum.start = start;
+    d->sum.outcome = HISTORY_SUMMARY;
+    d->end = start;
+}
+
+/* Add a phase, or a summary made by an earlier compaction, to a day */
+static void summary_add(day_summary *d, const HistoryRecord *r) {
+    int64_t end;
+    if (r->outcome == HISTORY_SUMMARY) {
+        const HistorySummary *s = (const HistorySummary *)r;
+        end = s->start + s->span;
+        d->sum.focused += s->focused;
+        d->sum.started += s->started;
+        d->sum.completed += s->completed;
+        d->sum.interrupted += s->interrupted;
+        d->sum.missed += s->missed;
+        d->sum.phases += s->phases;
+    } else {
+        end = r->start + r->duration + r->paused;
+        int work = r->state == POMODORO_WORK;
+        int ran = r->outcome != HISTORY_MISSED;
+        d->sum.focused += work ? r->duration : 0;
+        d->sum.started += work && ran;
+        d->sum.completed += work && r->outcome == HISTORY_COMPLETED;
+        d->sum.interrupted += work && (r->outcome == HISTORY_SKIPPED
+                || r->outcome == HISTORY_INTERRUPTED);
+        d->sum.missed += !ran;
+        d->sum.phases++;
+    }
+    if (r->start < d->sum.start) {
+        d->sum.start = r->start;
+    }
+    if (end > d->end) {
+        d->end = end;
+    }
+}
+
+static int summary_close(day_summary *d, compact_out *out) {
+    if (!d->open) {
+        return 0;
+    }
+    d->open = false;
+    d->sum.span = d->end - d->sum.start;
+    d->sum.checksum = record_checksum((const HistoryRecord *)&d->sum);
+    return compact_put(out, &d->sum);
+}
+
+long History_compact(const char *path, int32_t before, int64_t utc_offset) {
+    int fd = -1;
+    HistoryMap m = { .map = NULL };
+    compact_out *out = NULL;
+    check(path != NULL, "Got NULL history path");
+
+    /* Held until the new log is in place, so no append goes astray */
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    check(fd != -1, "Failed to open history log '%s'", path);
+    int rc = flock(fd, LOCK_EX);
+    check(rc == 0, "Failed to lock history log '%s'", path);
+    struct stat st;
+    rc = fstat(fd, &st);
+    check(rc == 0, "Failed to stat history log '%s'", path);
+    if (st.st_nlink == 0) {
+        /* Compacted by someone else while we waited for the lock */
+        close(fd);
+        return 0;
+    }
+    rc = map_fd(&m, fd, path);
+    check(rc == 0, "Failed to map history log '%s'", path);
+
+    long compacted = 0;
+    for (size_t i = 0; i < m.count; i++) {
+        const HistoryRecord *r = &m.records[i];
+        compacted += History_record_ok(r) && r->outcome != HISTORY_SUMMARY
+                && local_day(r->start, utc_offset) < before;
+    }
+    if (compacted == 0) {
+        HistoryMap_close(&m);
+        close(fd);
+        return 0;
+    }
+
+    out = malloc(sizeof(compact_out));
+    check_mem(out);
+    out->count = 0;
+    out->file.fd = -1;
+    rc = AtomicFile_open(&out->file, path);
+    check(rc == 0, "Failed to open '%s'", out->file.tmp_path);
+    const HistoryHeader *old = (const HistoryHeader *)m.map;
+    HistoryHeader hdr = *old;
+    hdr.created = time(NULL) > old->created ? time(NULL) : old->created + 1;
+    check(write(out->file.fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr),
+            "Failed to write compacted history");
+
+    /*
+     * Each run of old records from the same day becomes one summary; the
+     * records are in the order their phases ended, so a day only comes up
+     * again if the clock was turned back.
+     */
+    day_summary d = { .open = false };
+    for (size_t i = 0; i < m.count; i++) {
+        const HistoryRecord *r = &m.records[i];
+        if (!History_record_ok(r)) {
+            continue;
+        }
+        int32_t day = local_day(r->start, utc_offset);
+        if (day >= before && r->outcome != HISTORY_SUMMARY) {
+            rc = summary_close(&d, out);
+            rc = rc == 0 ? compact_put(out, r) : rc;
+        } else {
+            if (!d.open || d.day != day) {
+                rc = summary_close(&d, out);
+                summary_open(&d, day, r->start);
+            }
+            summary_add(&d, r);
+        }
+        check(rc == 0, "Failed to write compacted history");
+    }
+    rc = summary_close(&d, out);
+    rc = rc == 0 ? compact_flush(out) : rc;
+    check(rc == 0, "Failed to write compacted history");
+    rc = AtomicFile_commit(&out->file);
+    check(rc == 0, "Failed to move compacted history into place");
+
+    free(out);
+    HistoryMap_close(&m);
+    close(fd);
+    return compacted;
+error:
+    if (out != NULL) {
+        AtomicFile_abort(&out->file);
+    }
+    free(out);
+    HistoryMap_close(&m);
+    if (fd != -1) {
+        close(fd);
+    }
+    return -1;
+}
@@ -0,0 +1,205 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The session history log: a header, then one fixed-width record per phase
+ * that ended, appended as it ends. Records are in the machine's byte order
+ * and carry their own checksum, so one torn by a crash is simply skipped.
+ * Once old enough, the phases of a day can be compacted into one summary
+ * record of the same size.
+ */
+
+/* Bump whenever the layout of the header or a record changes */
+#define HISTORY_VERSION 1
+
+/* Most records History_append is given at once */
+#define HISTORY_BATCH 64
+
+/* How a phase in the history ended */
+typedef enum {
+    /* Ran to the end of its time */
+    HISTORY_COMPLETED = 0,
+    /* Ended early with the skip key */
+    HISTORY_SKIPPED = 1,
+    /* Ran out without ever being current, e.g. while suspended */
+    HISTORY_MISSED = 2,
+    /* Still under way when the program quit */
+    HISTORY_INTERRUPTED = 3,
+    /* Not a phase but a HistorySummary of a day's phases */
+    HISTORY_SUMMARY = 4
+} HISTORY_OUTCOME;
+
+typedef struct {
+    /* "PHST" */
+    uint32_t magic;
+    uint16_t version;
+    /* sizeof(HistoryRecord) when written */
+    uint16_t record_size;
+    /* Wall-clock time the log was started, in s since the epoch */
+    int64_t created;
+} HistoryHeader;
+
+/* One phase, 32 bytes */
+typedef struct {
+    /* Wall-clock time the phase started, in s since the epoch */
+    int64_t start;
+    /* Seconds the phase ran for, not counting pauses */
+    uint32_t duration;
+    /* Seconds the schedule gave the phase */
+    uint32_t planned;
+    /* Seconds the phase spent paused */
+    uint32_t paused;
+    /* Index of the phase within its day */
+    uint32_t phase_index;
+    uint16_t set_num;
+    /* A STATE from pomodoro.h */
+    uint8_t state;
+    /* A HISTORY_OUTCOME */
+    uint8_t outcome;
+    /* Checksum of everything above; see History_record_ok */
+    uint32_t checksum;
+} HistoryRecord;
+
+/*
+ * The phases of one day, compacted, 32 bytes. It takes the place of a
+ * HistoryRecord, and is told apart from one by its outcome.
+ */
+typedef struct {
+    /* Wall-clock time the day's first phase started, in s since the epoch */
+    int64_t start;
+    /* Seconds of work, as in StatsDay */
+    uint32_t focused;
+    /* Seconds from the start of the first phase to the end of the last */
+    uint32_t span;
+    /* Work sessions begun, run to the end, and skipped or cut short */
+    uint16_t started;
+    uint16_t completed;
+    uint16_t interrupted;
+    /* Phases of any kind missed */
+    uint16_t missed;
+    /* Phases of any kind summed up */
+    uint16_t phases;
+    uint8_t reserved;
+    /* HISTORY_SUMMARY */
+    uint8_t outcome;
+    /* Checksum, as for a HistoryRecord */
+    uint32_t checksum;
+} HistorySummary;
+
+/* A history log open for appending */
+typedef struct {
+    int fd;
+    /* The log file, to open again if History_compact replaces it */
+    const char *path;
+} History;
+
+/*
+ * A history log mapped into memory for reading. The records are used in
+ * place; nothing is copied or allocated.
+ */
+typedef struct {
+    /* The whole mapped file */
+    void *map;
+    size_t size;
+    /* The records, some of which may fail History_record_ok */
+    const HistoryRecord *records;
+    size_t count;
+} HistoryMap;
+
+/*
+ * Open a history log for appending, starting it if it does not exist. A
+ * record left half-written by a crash is cut off the end, and a log too short
+ * to hold its header is started again. The log is locked while this is done,
+ * so instances starting together agree on one header.
+ *
+ * Parameters:
+ *     h: the History to open
+ *     path: the log file, which must outlive h
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, or if the file is not a history log of this version, -1
+ */
+int History_open(History *h, const char *path);
+
+/*
+ * Fill in the checksums of some records and append them to the log with a
+ * single write(2). The write is made under a lock on the log, and if the
+ * log was compacted in the meantime, the new one is opened first.
+ *
+ * Parameters:
+ *     h: the open History
+ *     records: the records to append
+ *     count: how many; 1 to HISTORY_BATCH
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int History_append(History *h, HistoryRecord *records, int count);
+
+/*
+ * Close a history log opened with History_open.
+ *
+ * Parameters:
+ *     h: the History to close
+ * Returns: none
+ */
+void History_close(History *h);
+
+/*
+ * Check a record against its checksum.
+ *
+ * Parameters:
+ *     r: the record to check
+ *
+ * Returns:
+ *     1 if the record is whole, 0 if not
+ */
+int History_record_ok(const HistoryRecord *r);
+
+/*
+ * Map a history log into memory to read it.
+ *
+ * Parameters:
+ *     m: the HistoryMap to fill
+ *     path: the log file
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, or if the file is not a history log of this version, -1
+ */
+int HistoryMap_open(HistoryMap *m, const char *path);
+
+/*
+ * Unmap a history log mapped with HistoryMap_open.
+ *
+ * Parameters:
+ *     m: the HistoryMap to unmap
+ * Returns: none
+ */
+void HistoryMap_close(HistoryMap *m);
+
+/*
+ * Compact the phases of a history log started before a given day into one
+ * HistorySummary per day, keeping later phases as they are. The log is
+ * read in one pass and rewritten to a temporary file, which is synced and
+ * renamed over it while a lock keeps History_append from writing to the
+ * old one. A crash at any point leaves either the old log or the new one.
+ * The new log gets a later creation time, so rollups of it are rebuilt.
+ *
+ * Parameters:
+ *     path: the log file
+ *     before: the first day to keep in full, in days since 1970-01-01
+ *     utc_offset: the local offset from UTC, in s, that days are counted in
+ *
+ * Returns:
+ *     on success, the number of records compacted, 0 leaving the log as is
+ *     on failure, -1, leaving the log as is
+ */
+long History_compact(const char *path, int32_t before, int64_t utc_offset);
+
+#endif
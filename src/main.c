@@ -1,13 +1,35 @@
+#include <fcntl.h>
 #include <getopt.h>
-#include <ini.h>
+#ifndef POMODORO_NO_CURSES
 #include <ncurses.h>
+#endif
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include "ansi.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "daemon.h"
 #include "dbg.h"
+#include "export.h"
+#include "frontend.h"
+#include "headless.h"
+#include "history.h"
 #include "pomodoro.h"
+#include "stats.h"
+#ifndef POMODORO_NO_CURSES
+#include "ui.h"
+#endif
 
 /* #### Useful constants #### */
 
@@ -16,30 +38,116 @@ const int MAXPATH = 255;
 
 const char *PROG_NAME = "pomodoro_curses";
 
+/*
+ * Timer slack asked for in low-power mode, in nanoseconds. The kernel may
+ * push this process's sleeps back by up to this much to batch them with
+ * other wakeups.
+ */
+const unsigned long LOW_POWER_SLACK_NS = 50000000UL;
+
+/*
+ * In low-power mode wakeups are pushed back to the next whole multiple of
+ * this many nanoseconds on the timer clock, so instances running side by
+ * side wake up together.
+ */
+const int64_t LOW_POWER_COALESCE_NS = NSEC_PER_SEC;
+
+/* How long a message stays up over the status window, in nanoseconds */
+const int64_t MESSAGE_NS = 2 * NSEC_PER_SEC;
+
+/* Most phases --startup-trace keeps track of */
+#define TRACE_MAX 16
+
+/* Days of history the compact command keeps in full if not told otherwise */
+#define DEFAULT_COMPACT_AFTER 90
+
+/* How long the ctl command waits for the daemon to answer, in ms */
+#define CTL_TIMEOUT_MS 1000
+
 /* #### Useful typedefs #### */
 
-typedef enum {
-    ALERT_UNSET = 0,
-    ALERT_BEEP = 1,
-    ALERT_FLASH = 2
-} ALERT_TYPE;
+/* Frontend used when none is asked for */
+#ifdef POMODORO_NO_CURSES
+#define DEFAULT_FRONTEND FRONTEND_ANSI
+#else
+#define DEFAULT_FRONTEND FRONTEND_CURSES
+#endif
 
-/* Code for config parsing */
+/* When each phase of startup finished, for --startup-trace */
 typedef struct {
-    int short_break_length;
-    int long_break_length;
-    int set_count;
-    int pomodoros_per_set;
-    int work_length;
+    bool enabled;
+    int count;
+    const char *name[TRACE_MAX];
+    /* CLOCK_MONOTONIC time, in nanoseconds */
+    int64_t at[TRACE_MAX];
+} startup_trace;
+
+/* Setup that waits until the first frame is on screen */
+typedef struct {
+    /* Message shown over the status window for MESSAGE_NS, or NULL */
+    const char *splash;
+    /* Ask the kernel for low-power timer slack */
+    bool timer_slack;
+    /* The history log, and days of it to keep when compacting it, or 0 */
+    const char *history_path;
+    int compact_after;
+    startup_trace *trace;
+} deferred_setup;
+
+/*
+ * Settings that can change while the day runs: the config file, watched so
+ * edits to it apply without a restart, and the profile picked from it.
+ */
+typedef struct {
+    /* inotify instance watching the file's directory, or -1 for none */
+    int fd;
+    /* Config files read at startup, in order; custom_path may be NULL */
+    const char *default_path;
+    const char *custom_path;
+    /* Name of the watched file within its directory */
+    const char *name;
+    /* Both config files, merged */
+    ConfigFile *file;
+    /* Section of file the profile in use comes from; 0 for none */
+    int profile;
+    /* Settings given on the command line, which win over the file */
+    const configuration *explicit_config;
+    /* The day's schedule; swapped for a new one on each change */
+    Schedule **schedule;
+    /* Alert type to use; updated on each change */
     ALERT_TYPE alert_type;
-} configuration;
+} live_config;
 
-typedef enum {
-    POMODORO_WORK,
-    POMODORO_SHORT_REST,
-    POMODORO_LONG_REST,
-    POMODORO_ERROR = -1
-} STATE;
+/* Where a running day keeps its records */
+typedef struct {
+    /* File to save checkpoints in, or NULL for none */
+    const char *checkpoint;
+    /* Log to record phases in, or NULL for none */
+    History *history;
+    /* The history log's path, and its rollups', for the stats key */
+    const char *history_path;
+    const char *rollup_path;
+} day_records;
+
+/* The phase under way, as it will go into the history log */
+typedef struct {
+    /* The log to write to, or NULL for none */
+    History *log;
+    /* Whether a phase is under way and still to be recorded */
+    bool open;
+    STATE state;
+    int set_num;
+    /* Index of the phase, or -1 before the first step */
+    int phase_index;
+    /* Wall-clock time it started, in ns since the epoch */
+    int64_t start;
+    /* Seconds the schedule gave it */
+    int64_t planned;
+    /* Its deadline on the timer's clock, as of the last step */
+    int64_t deadline;
+    /* Phases missed so far, as of the last step */
+    int missed;
+} history_tracker;
 
 /* 
  * Print a usage message to stderr and exit.
@@ -49,6 +157,11 @@ void usage() {
             "%s: A simple ncurses-based Pomodoro timer\n"
             "\n"
             "Usage: %s [-h] [OPTIONS]\n"
+            "       %s stats\n"
+            "       %s compact [-o DAYS]\n"
+            "       %s export [-f csv|ics] [--from DATE] [--to DATE] "
+                    "[LOG...]\n"
+            "       %s ctl status|pause|skip|profile|info|stop\n"
             "\n"
             "Mandatory arguments to long options are mandatory for short "
             "options too.\n"
@@ -62,366 +175,1703 @@ void usage() {
             "    -b, --short-break-length N"
                     "\tLength of breaks between work sessions (default 5)\n"
             "    -c, --config-file CONFIG\tPath to config file to use\n"
+            "    -A, --attach\t\tShow the day a daemon is running instead of\n"
+            "\t\t\t\tone of our own; q detaches and leaves it running\n"
+            "    -D, --daemon\t\tRun the day in the background, for clients to\n"
+            "\t\t\t\tattach to with --attach or control with 'ctl'\n"
+            "    -H, --headless\t\tDon't draw anything; write one line to stdout\n"
+            "\t\t\t\tas each phase starts and when the day is done\n"
+            "    -k, --clock CLOCK\t\tClock to time against. Choose 'monotonic',\n"
+            "\t\t\t\t'boottime' or 'realtime'; the last two keep counting\n"
+            "\t\t\t\twhile the machine is suspended\n"
+            "    -l, --low-power\t\tShow minutes until the end of a session is\n"
+            "\t\t\t\tnear and wake up as little as possible; reports\n"
+            "\t\t\t\twakeups per hour on exit\n"
             "    -d\t\t\t\tDump to stdout values from config file and exit. May\n"
             "\t\t\t\tbe combined with -c to dump a custom config\n"
+            "    -f, --format FORMAT\t\tWith --headless, write 'text' (default) or\n"
+            "\t\t\t\t'json' lines\n"
+            "    -F, --fps N\t\t\tShow tenths of a second in the last minute of\n"
+            "\t\t\t\teach session, redrawing at most N times a second\n"
             "    -n, --num-sets N\t\tNumber of sets to work through (default 1)\n"
             "    -p, --pomodoros-per-set N"
                     "\tNumber of pomodoros (work sessions) per set (default 3)\n"
+            "    -r, --resume\t\tPick up the day where the last run left off\n"
             "    -s, --session-length N\tPomodoro session length (default 25)\n"
-            "    -B, --long-break-length N\tLong break length (default 30)\n",
-            PROG_NAME, PROG_NAME
+            "    -t, --tick N\t\tWith --headless, also write the time left every\n"
+            "\t\t\t\tN seconds\n"
+            "    -u, --frontend NAME\t\tHow to draw on the terminal: 'curses', or\n"
+            "\t\t\t\t'ansi' for plain escape sequences without curses\n"
+            "    -B, --long-break-length N\tLong break length (default 30)\n"
+            "    -P, --profile NAME\t\tUse the settings of [profile.NAME] in the\n"
+            "\t\t\t\tconfig file\n"
+            "    -T, --startup-trace\t\tTime each step of startup and print the\n"
+            "\t\t\t\ttimes to stderr on exit\n"
+            "    -S, --schedule SPEC\t\tRun an arbitrary sequence of phases\n"
+            "\t\t\t\tinstead, e.g. '3*(w25 s5) l30' (w: work,\n"
+            "\t\t\t\ts: short break, l: long break)\n"
+            "\n"
+            "Commands:\n"
+            "    stats\t\t\tShow time focused, sessions done and streaks\n"
+            "\t\t\t\tfrom the history of past days, and exit\n"
+            "    compact\t\t\tSum up each day of the history from more\n"
+            "\t\t\t\tthan DAYS (-o, --older-than) days ago in one\n"
+            "\t\t\t\trecord, and exit\n"
+            "    export\t\t\tWrite the history, or the logs named, to\n"
+            "\t\t\t\tstdout as CSV or iCalendar ('-f ics') and exit;\n"
+            "\t\t\t\t--from and --to keep only phases started\n"
+            "\t\t\t\tbetween two dates (YYYY-MM-DD), inclusive\n"
+            "    ctl\t\t\t\tSend a command to the daemon and print where\n"
+            "\t\t\t\tthe day stands after it\n",
+            PROG_NAME, PROG_NAME, PROG_NAME, PROG_NAME, PROG_NAME, PROG_NAME
 
     );
 }
 
-/* 
- * Alert the user to the end of a timer session
+/*
+ * Map a TIMER_CLOCK onto the system clock it stands for.
  *
  * Parameters:
- *     type: the type of alert to use
- * 
+ *     timer_clock: the clock choice; TIMER_CLOCK_UNSET means monotonic
+ *
+ * Returns: the matching clockid_t
+ */
+clockid_t timer_clock_id(TIMER_CLOCK timer_clock) {
+    switch (timer_clock) {
+        case TIMER_CLOCK_BOOTTIME:
+            return CLOCK_BOOTTIME;
+        case TIMER_CLOCK_REALTIME:
+            return CLOCK_REALTIME;
+        default:
+            return CLOCK_MONOTONIC;
+    }
+}
+
+/*
+ * Dump the contents of a config file to stdout.
+ *
+ * Parameters:
+ *     configptr: the pointer to the configuration struct to read
+ *     file: the config file it came from, for its list of profiles
+ *     profile: the section of file the profile in use comes from, or 0
+ *     filepath: the path to the file the config came from (for printing only)
+ *
  * Returns:
  *     On success, 0
- *     On failure, -1. Also emits a message to stderr
+ *     On failure, -1
  */
-int alert_user(ALERT_TYPE type) {
-    check(type == ALERT_BEEP || type == ALERT_FLASH,
-            "Invalid alert type %d. Choose ALERT_BEEP or ALERT_FLASH", type);
-    int rc = 0;
-    switch (type) {
-        case ALERT_BEEP:
-            rc = beep();
-            break;
-        case ALERT_FLASH:
-            rc = flash();
-            break;
-        default:
-            sentinel("I shouldn't run");
-            break;
+int dump_config(configuration *configptr, const ConfigFile *file, int profile,
+        char *filepath) {
+    check(configptr != NULL, "Got NULL configuration pointer!");
+    check(filepath != NULL, "Got NULL config path");
+    check(strncmp(filepath, "", MAXPATH) != 0, "Got empty config path");
+    printf("Current configuration from %s:\n", filepath);
+    printf("\tAlert type: %s\n",
+            configptr->alert_type == ALERT_BEEP ? "audible" : "visual");
+    printf("\tShort break length: %d minutes\n", configptr->short_break_length);
+    printf("\tLong break length: %d minutes\n", configptr->long_break_length);
+    printf("\tWork session length: %d minutes\n", configptr->work_length);
+    printf("\tPomodoros per set: %d\n", configptr->pomodoros_per_set);
+    printf("\tNumber of sets: %d\n", configptr->set_count);
+    if (configptr->schedule != NULL) {
+        printf("\tSchedule: %s\n", configptr->schedule);
+    }
+    printf("\tClock: %s\n",
+            configptr->timer_clock == TIMER_CLOCK_BOOTTIME ? "boottime"
+            : configptr->timer_clock == TIMER_CLOCK_REALTIME ? "realtime"
+            : "monotonic");
+    printf("\tLow power: %s\n", configptr->low_power ? "yes" : "no");
+    if (configptr->fps > 0) {
+        printf("\tSub-second display: up to %d frames per second\n",
+                configptr->fps);
+    }
+    if (configptr->compact_after > 0) {
+        printf("\tCompact history after: %d days\n", configptr->compact_after);
+    }
+    if (configptr->frontend != FRONTEND_UNSET) {
+        printf("\tFrontend: %s\n",
+                configptr->frontend == FRONTEND_ANSI ? "ansi" : "curses");
+    }
+    if (file->count > 1) {
+        printf("\tProfiles:");
+        for (int i = 1; i < file->count; i++) {
+            printf(" %s%s", file->sections[i].name, i == profile ? " (in use)"
+                    : "");
+        }
+        printf("\n");
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Read the local time and the offset from UTC that goes with it.
+ *
+ * Parameters:
+ *     local: filled in with the local time
+ *
+ * Returns: the offset from UTC, in seconds
+ */
+int64_t local_utc_offset(struct tm *local) {
+    time_t now = time(NULL);
+    localtime_r(&now, local);
+    return local->tm_gmtoff;
+}
+
+/*
+ * Load the rollups of the history log, brought up to date with it.
+ *
+ * Parameters:
+ *     history_path: the history log
+ *     rollup_path: the file its rollups are kept in
+ *     today: set to the current day, as from Stats_day_of
+ *     local: filled in with the local time
+ *
+ * Returns:
+ *     On success, the rollups, which are the caller's to destroy
+ *     On failure, NULL
+ */
+StatsIndex *load_stats(const char *history_path, const char *rollup_path,
+        int32_t *today, struct tm *local) {
+    StatsIndex *idx = Stats_alloc();
+    check(idx != NULL, "Failed to allocate stats");
+    int64_t offset = local_utc_offset(local);
+    int rc = Stats_refresh(idx, history_path, rollup_path, offset);
+    check(rc == 0, "Failed to read the history log");
+    *today = Stats_day_of(time(NULL), offset);
+
+    return idx;
+error:
+    Stats_destroy(idx);
+    return NULL;
+}
+
+/*
+ * Print one line of totals for dump_stats.
+ */
+void print_totals(const char *label, const StatsTotals *totals) {
+    printf("\t%s: %llu minutes focused, %u of %u sessions done", label,
+            (unsigned long long)(totals->focused / SECONDS_PER_MINUTE),
+            totals->completed, totals->started);
+    if (totals->started > 0) {
+        printf(" (%u%%)", totals->completed * 100 / totals->started);
+    }
+    printf(", %u cut short\n", totals->interrupted);
+}
+
+/*
+ * Dump to stdout the time focused, sessions done and streaks from the
+ * history log: today, this week (from Monday), this month and all time.
+ *
+ * Parameters:
+ *     history_path: the history log
+ *     rollup_path: the file its rollups are kept in
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int dump_stats(const char *history_path, const char *rollup_path) {
+    struct tm local;
+    int32_t today;
+    StatsIndex *idx = load_stats(history_path, rollup_path, &today, &local);
+    check(idx != NULL, "Failed to load stats");
+
+    /* 1970-01-01, day 0, was a Thursday */
+    int32_t monday = today - ((today % 7 + 7 + 3) % 7);
+    int32_t first_of_month = today - (local.tm_mday - 1);
+    StatsTotals totals;
+    printf("Focus from %s:\n", history_path);
+    Stats_sum(idx, today, today, &totals);
+    print_totals("Today", &totals);
+    Stats_sum(idx, monday, today, &totals);
+    print_totals("This week", &totals);
+    Stats_sum(idx, first_of_month, today, &totals);
+    print_totals("This month", &totals);
+    Stats_sum(idx, INT32_MIN, INT32_MAX, &totals);
+    print_totals("All time", &totals);
+    int longest;
+    int current;
+    Stats_streaks(idx, today, &longest, &current);
+    printf("\tStreak: %d days (longest %d)\n", current, longest);
+    Stats_destroy(idx);
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Compact the phases in a history log from more than some days ago into
+ * one summary per day.
+ *
+ * Parameters:
+ *     history_path: the history log; a missing log is left alone
+ *     days: days before today to keep in full
+ *
+ * Returns:
+ *     On success, the number of records compacted
+ *     On failure, -1
+ */
+long compact_history(const char *history_path, int days) {
+    if (access(history_path, F_OK) != 0) {
+        return 0;
+    }
+    struct tm local;
+    int64_t offset = local_utc_offset(&local);
+    int32_t today = Stats_day_of(time(NULL), offset);
+    return History_compact(history_path, today - days, offset);
+}
+
+/*
+ * Write history logs to stdout as CSV or iCalendar, from the arguments that
+ * follow the export command.
+ *
+ * Parameters:
+ *     argc: the number of arguments, counting "export" itself
+ *     argv: the arguments, starting with "export"
+ *     history_path: the log to export when no others are named
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int export_history(int argc, char *argv[], const char *history_path) {
+    static struct option export_options[] = {
+        {"format", required_argument, 0, 'f'},
+        {"from", required_argument, 0, 'F'},
+        {"to", required_argument, 0, 't'},
+        {0, 0, 0, 0}
+    };
+    int format = EXPORT_CSV;
+    int32_t from = INT32_MIN;
+    int32_t to = INT32_MAX;
+    int opt;
+    int rc;
+    Exporter *e = NULL;
+    HistoryMap m = { .map = NULL };
+
+    while ((opt = getopt_long(argc, argv, "f:F:t:", export_options, NULL))
+            != -1) {
+        switch (opt) {
+            case 'f':
+                format = Export_parse_format(optarg);
+                check(format != -1, "Unknown export format '%s'", optarg);
+                break;
+            case 'F':
+                check(Export_parse_date(optarg, &from) == 0, "Bad --from");
+                break;
+            case 't':
+                check(Export_parse_date(optarg, &to) == 0, "Bad --to");
+                break;
+            default:
+                goto error;
+        }
+    }
+
+    /* The buffer is big enough not to want it on the stack */
+    e = malloc(sizeof(Exporter));
+    check_mem(e);
+    struct tm local;
+    rc = Export_begin(e, STDOUT_FILENO, format, local_utc_offset(&local),
+            from, to);
+    check(rc == 0, "Failed to start the export");
+    int first = optind;
+    int last = optind < argc ? argc : optind + 1;
+    for (int i = first; i < last; i++) {
+        const char *path = i < argc ? argv[i] : history_path;
+        rc = HistoryMap_open(&m, path);
+        check(rc == 0, "Failed to read history log '%s'", path);
+        check(Export_history(e, &m) != -1, "Failed to export '%s'", path);
+        HistoryMap_close(&m);
+    }
+    rc = Export_end(e);
+    check(rc == 0, "Failed to finish the export");
+    free(e);
+
+    return 0;
+error:
+    HistoryMap_close(&m);
+    free(e);
+    return -1;
+}
+
+/*
+ * Arm a timerfd to fire once at an absolute time.
+ *
+ * Parameters:
+ *     fd: the timerfd
+ *     when_ns: the time to fire at, on the timerfd's clock; 0 disarms it
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int arm_timer_fd(int fd, int64_t when_ns) {
+    struct itimerspec its = {
+        .it_interval = { 0, 0 },
+        .it_value = { .tv_sec = when_ns / NSEC_PER_SEC,
+                .tv_nsec = when_ns % NSEC_PER_SEC }
+    };
+    int rc = timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+    check(rc == 0, "Failed to arm timerfd");
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Block the signals the event loop handles and open a signalfd for them.
+ *
+ * Returns:
+ *     on success, the signalfd
+ *     on failure, -1
+ */
+int open_signal_fd() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGWINCH);
+    int rc = sigprocmask(SIG_BLOCK, &mask, NULL);
+    check(rc == 0, "Failed to block signals");
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    check(fd != -1, "Failed to open signalfd");
+
+    return fd;
+error:
+    return -1;
+}
+
+/*
+ * Push a wakeup time back to the next LOW_POWER_COALESCE_NS boundary when
+ * the Frontend is in low-power mode. Only display steps move: the end of
+ * the phase is never put off, so alerts and the next phase come on time.
+ *
+ * Parameters:
+ *     fe: the Frontend being driven
+ *     wake: the wakeup time, or 0 for none
+ *     deadline: the end of the phase under way
+ *
+ * Returns: the time to actually wake up at, or 0 for none
+ */
+int64_t coalesce(Frontend *fe, int64_t wake, int64_t deadline) {
+    if (!fe->low_power || wake <= 0) {
+        return wake;
+    }
+    int64_t coalesced = (wake + LOW_POWER_COALESCE_NS - 1)
+            / LOW_POWER_COALESCE_NS * LOW_POWER_COALESCE_NS;
+    return coalesced < deadline ? coalesced : deadline;
+}
+
+/*
+ * Note that a phase of startup just finished. Marks are taken whether or
+ * not tracing is on, since options are read only partway through startup;
+ * a mark is a single clock read.
+ *
+ * Parameters:
+ *     trace: the trace to add to
+ *     name: what just finished
+ */
+void trace_mark(startup_trace *trace, const char *name) {
+    if (trace->count >= TRACE_MAX) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    trace->name[trace->count] = name;
+    trace->at[trace->count] = (int64_t)now.tv_sec * NSEC_PER_SEC
+            + now.tv_nsec;
+    trace->count++;
+}
+
+/*
+ * Print a startup trace: when each phase finished after the first mark,
+ * and how long it took.
+ *
+ * Parameters:
+ *     trace: the trace to print
+ *     out: where to print it
+ */
+void trace_print(startup_trace *trace, FILE *out) {
+    if (!trace->enabled || trace->count == 0) {
+        return;
+    }
+    fprintf(out, "Startup trace (ms since %s):\n", trace->name[0]);
+    for (int i = 1; i < trace->count; i++) {
+        fprintf(out, "%10.3f  %+9.3f  %s\n",
+                (trace->at[i] - trace->at[0]) / 1e6,
+                (trace->at[i] - trace->at[i - 1]) / 1e6, trace->name[i]);
+    }
+}
+
+/*
+ * Do the setup that was left until the first frame was up: putting up
+ * the welcome message, timer slack and compacting the history log.
+ *
+ * Parameters:
+ *     fe: the Frontend being driven
+ *     t: the running Timer
+ *     setup: what is left to do
+ *
+ * Returns:
+ *     on success, the time the welcome message should come down, or 0 if
+ *     there is none
+ *     on failure, -1
+ */
+int64_t finish_startup(Frontend *fe, Timer *t, deferred_setup *setup) {
+    int64_t splash_end = 0;
+    if (setup->splash != NULL) {
+        fe->show_message(fe, setup->splash);
+        fe->flush(fe);
+        splash_end = Timer_now(t) + MESSAGE_NS;
+        trace_mark(setup->trace, "welcome message");
+    }
+    if (setup->timer_slack) {
+        int rc = prctl(PR_SET_TIMERSLACK, LOW_POWER_SLACK_NS, 0, 0, 0);
+        check(rc == 0, "Failed to set timer slack");
+        trace_mark(setup->trace, "timer slack");
+    }
+    if (setup->compact_after > 0) {
+        if (compact_history(setup->history_path, setup->compact_after)
+                == -1) {
+            log_warn("Failed to compact the history log");
+        }
+        trace_mark(setup->trace, "history compaction");
+    }
+
+    return splash_end;
+error:
+    return -1;
+}
+
+/* The sooner of two wakeup times, either of which may be 0 for none */
+int64_t sooner(int64_t a, int64_t b) {
+    if (a <= 0 || b <= 0) {
+        return a > b ? a : b;
+    }
+    return a < b ? a : b;
+}
+
+/*
+ * Compile the day's schedule from the config file and the command line. An
+ * explicit --schedule wins outright. Otherwise a schedule from the config
+ * file is used unless the classic layout was set on the command line; each
+ * part of the classic layout comes from the command line if given there.
+ *
+ * Parameters:
+ *     schedule: the Schedule to fill
+ *     config: settings from the config file
+ *     explicit_config: settings from the command line
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int build_schedule(Schedule *schedule, const configuration *config,
+        const configuration *explicit_config) {
+    bool explicit_layout = explicit_config->short_break_length != 0
+            || explicit_config->long_break_length != 0
+            || explicit_config->set_count != 0
+            || explicit_config->pomodoros_per_set != 0
+            || explicit_config->work_length != 0;
+    char *schedule_spec = explicit_config->schedule;
+    if (schedule_spec == NULL && !explicit_layout) {
+        schedule_spec = config->schedule;
+    }
+
+    if (schedule_spec != NULL) {
+        int rc = Schedule_compile(schedule, schedule_spec);
+        check(rc == 0, "Bad schedule '%s'", schedule_spec);
+        return 0;
+    }
+#define PICK(field) (explicit_config->field != 0 \
+        ? explicit_config->field : config->field)
+    int rc = Schedule_from_sets(schedule,
+            PICK(work_length) * SECONDS_PER_MINUTE,
+            PICK(short_break_length) * SECONDS_PER_MINUTE,
+            PICK(long_break_length) * SECONDS_PER_MINUTE,
+            PICK(pomodoros_per_set), PICK(set_count));
+#undef PICK
+    check(rc == 0, "Bad pomodoro schedule");
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Start watching the config file for changes. Its directory is watched
+ * rather than the file itself, since editors often save by writing a new
+ * file and renaming it over the old one.
+ *
+ * Parameters:
+ *     live: the live_config to watch for; sets its fd and name
+ *     path: the config file to watch
+ *
+ * Returns: 0 on success, -1 on failure, leaving live->fd at -1
+ */
+int watch_config(live_config *live, const char *path) {
+    char dir[MAXPATH + 1];
+    live->fd = -1;
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+        live->name = path;
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+        live->name = slash + 1;
+    }
+    live->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    check(live->fd != -1, "Failed to set up inotify");
+    int rc = inotify_add_watch(live->fd, dir[0] != '\0' ? dir : "/",
+            IN_CLOSE_WRITE | IN_MOVED_TO);
+    check(rc != -1, "Failed to watch %s", dir);
+
+    return 0;
+error:
+    if (live->fd != -1) {
+        close(live->fd);
+        live->fd = -1;
+    }
+    return -1;
+}
+
+/*
+ * Load the default config file, and the one given with -c on top of it.
+ *
+ * Parameters:
+ *     default_path: the default config file
+ *     custom_path: the -c config file, or NULL
+ *
+ * Returns:
+ *     on success, the two files merged into one ConfigFile
+ *     on failure, NULL
+ */
+ConfigFile *load_config(const char *default_path, const char *custom_path) {
+    ConfigFile *custom = NULL;
+    ConfigFile *file = Config_alloc();
+    check(file != NULL, "Failed to allocate config");
+    int rc = Config_load(file, default_path);
+    check(rc == 0, "Failed to load config file '%s'", default_path);
+    if (custom_path != NULL) {
+        custom = Config_alloc();
+        check(custom != NULL, "Failed to allocate config");
+        rc = Config_load(custom, custom_path);
+        check(rc == 0, "Failed to load config file '%s'", custom_path);
+        rc = Config_merge(file, custom);
+        check(rc == 0, "Failed to merge config file '%s'", custom_path);
+        Config_destroy(custom);
+    }
+
+    return file;
+error:
+    Config_destroy(custom);
+    Config_destroy(file);
+    return NULL;
+}
+
+/*
+ * Compact the history log from the arguments that follow the compact
+ * command, and report what was done to stdout.
+ *
+ * Parameters:
+ *     argc: the number of arguments, counting "compact" itself
+ *     argv: the arguments, starting with "compact"
+ *     history_path: the history log
+ *     config_path: the default config file, for its compact_after setting
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int dump_compaction(int argc, char *argv[], const char *history_path,
+        const char *config_path) {
+    static struct option compact_options[] = {
+        {"older-than", required_argument, 0, 'o'},
+        {0, 0, 0, 0}
+    };
+    int days = DEFAULT_COMPACT_AFTER;
+    if (access(config_path, F_OK) == 0) {
+        ConfigFile *file = load_config(config_path, NULL);
+        check(file != NULL, "Failed to load the config");
+        if (file->sections[0].values.compact_after > 0) {
+            days = file->sections[0].values.compact_after;
+        }
+        Config_destroy(file);
+    }
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:", compact_options, NULL))
+            != -1) {
+        check(opt == 'o', "Usage: %s compact [-o DAYS]", PROG_NAME);
+        days = atoi(optarg);
+        check(days > 0, "Bad --older-than %s. Give a number of days.",
+                optarg);
+    }
+    check(optind == argc, "Usage: %s compact [-o DAYS]", PROG_NAME);
+
+    struct stat before;
+    if (stat(history_path, &before) != 0) {
+        printf("No history to compact in %s\n", history_path);
+        return 0;
+    }
+    long compacted = compact_history(history_path, days);
+    check(compacted != -1, "Failed to compact '%s'", history_path);
+    struct stat after;
+    check(stat(history_path, &after) == 0, "Lost '%s'", history_path);
+    printf("Compacted %ld records from more than %d days ago in %s: "
+            "%lld to %lld bytes\n", compacted, days, history_path,
+            (long long)before.st_size, (long long)after.st_size);
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Put the settings of the profile in use into effect: the new schedule
+ * takes over from the next phase, while the phase under way keeps its
+ * deadline, and the alert type changes. Settings from the command line
+ * still win.
+ *
+ * Parameters:
+ *     live: the settings to apply
+ *     day: the day to switch over to the new schedule
+ *
+ * Returns: 0 on success, -1 on failure, changing nothing
+ */
+int apply_settings(live_config *live, Pomodoro *day) {
+    Schedule *schedule = NULL;
+    configuration config = { .schedule = NULL };
+    int rc = Config_resolve(live->file, live->profile, &config);
+    check(rc == 0, "Failed to work out the settings");
+    schedule = Schedule_alloc();
+    check(schedule != NULL, "Failed to allocate schedule");
+    rc = build_schedule(schedule, &config, live->explicit_config);
+    check(rc == 0, "Bad schedule in config file");
+
+    rc = Pomodoro_reschedule(day, schedule);
+    check(rc == 0, "Failed to switch to the new schedule");
+    Schedule_destroy(*live->schedule);
+    *live->schedule = schedule;
+    if (live->explicit_config->alert_type != ALERT_UNSET) {
+        live->alert_type = live->explicit_config->alert_type;
+    } else if (config.alert_type != ALERT_UNSET) {
+        live->alert_type = config.alert_type;
+    }
+    free(config.schedule);
+
+    return 0;
+error:
+    free(config.schedule);
+    if (schedule != NULL) {
+        Schedule_destroy(schedule);
+    }
+    return -1;
+}
+
+/*
+ * Read the config files again if the watched one changed, and apply them.
+ * The profile in use stays in use if the files still have it. A config
+ * file with errors in it changes nothing.
+ *
+ * Parameters:
+ *     live: the settings whose inotify instance has events waiting
+ *     day: the day to switch over to the new schedule
+ *
+ * Returns:
+ *     1 if the settings were reloaded
+ *     0 if the watched file did not change
+ *     -1 if it changed but could not be used; the old settings stay
+ */
+int reload_config(live_config *live, Pomodoro *day) {
+    char buf[4096]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len;
+    while ((len = read(live->fd, buf, sizeof(buf))) > 0) {
+        for (char *ev = buf; ev < buf + len;
+                ev += sizeof(struct inotify_event)
+                + ((struct inotify_event *)ev)->len) {
+            struct inotify_event *event = (struct inotify_event *)ev;
+            if (event->len > 0 && strcmp(event->name, live->name) == 0) {
+                changed = true;
+            }
+        }
+    }
+    if (!changed) {
+        return 0;
+    }
+
+    ConfigFile *old_file = live->file;
+    int old_profile = live->profile;
+    live->file = load_config(live->default_path, live->custom_path);
+    check(live->file != NULL, "Failed to reload the config");
+    live->profile = Config_find(live->file,
+            old_file->sections[old_profile].name);
+    if (live->profile == -1) {
+        live->profile = 0;
+    }
+    int rc = apply_settings(live, day);
+    check(rc == 0, "Failed to apply the reloaded config");
+    Config_destroy(old_file);
+
+    return 1;
+error:
+    Config_destroy(live->file);
+    live->file = old_file;
+    live->profile = old_profile;
+    return -1;
+}
+
+/*
+ * Move on to the next profile in the config file, after the last going
+ * back to no profile at all, and apply it.
+ *
+ * Parameters:
+ *     live: the settings to switch
+ *     day: the day to switch over to the new schedule
+ *
+ * Returns: 0 on success, -1 on failure, staying on the old profile
+ */
+int next_profile(live_config *live, Pomodoro *day) {
+    int old_profile = live->profile;
+    live->profile = (live->profile + 1) % live->file->count;
+    int rc = apply_settings(live, day);
+    check(rc == 0, "Failed to switch profiles");
+
+    return 0;
+error:
+    live->profile = old_profile;
+    return -1;
+}
+
+/* Read the wall clock, in nanoseconds since the epoch */
+int64_t wall_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+/*
+ * Save where the day has got to, so --resume can pick it up after a crash,
+ * or remove the checkpoint once the day is done. The deadline is saved
+ * against the wall clock, since the timer's clock may not survive a reboot.
+ *
+ * Parameters:
+ *     path: the checkpoint file
+ *     status: where the day is, from the last Pomodoro_step
+ *     live: the schedule and profile in use
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int save_checkpoint(const char *path, const PomodoroStatus *status,
+        const live_config *live) {
+    if (status->state == POMODORO_DONE) {
+        return Checkpoint_clear(path);
+    }
+    Checkpoint cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.schedule_hash = Schedule_hash(*live->schedule);
+    cp.phase_index = status->phase_index;
+    cp.paused = status->paused;
+    cp.remaining_ns = status->remaining_ns;
+    cp.deadline_ns = wall_clock_ns() + status->remaining_ns;
+    memcpy(cp.profile, live->file->sections[live->profile].name,
+            CONFIG_NAME_MAX);
+
+    return Checkpoint_save(path, &cp);
+}
+
+/* Length of a phase of a Schedule, in seconds */
+int64_t phase_length(const Schedule *s, int i) {
+    return s->phases[i].end - (i > 0 ? s->phases[i - 1].end : 0);
+}
+
+/* Time left in the phase a status is for, as of now on the timer's clock */
+int64_t time_left(const PomodoroStatus *status, int64_t now) {
+    if (status->paused || status->state == POMODORO_DONE) {
+        return status->remaining_ns;
+    }
+    return status->deadline_ns > now ? status->deadline_ns - now : 0;
+}
+
+/*
+ * Turn the phase a tracker has open into a history record.
+ *
+ * Parameters:
+ *     h: the tracker
+ *     r: the record to fill in
+ *     end: wall-clock time the phase ended, in ns since the epoch
+ *     left_ns: time the phase had left when it ended
+ *     outcome: how it ended
+ */
+void close_phase(history_tracker *h, HistoryRecord *r, int64_t end,
+        int64_t left_ns, HISTORY_OUTCOME outcome) {
+    memset(r, 0, sizeof(*r));
+    int64_t duration = h->planned * NSEC_PER_SEC - left_ns;
+    int64_t paused = end - h->start - duration;
+    r->start = h->start / NSEC_PER_SEC;
+    r->duration = duration > 0 ? (duration + NSEC_PER_SEC / 2) / NSEC_PER_SEC
+            : 0;
+    r->planned = h->planned;
+    r->paused = paused > 0 ? (paused + NSEC_PER_SEC / 2) / NSEC_PER_SEC : 0;
+    r->phase_index = h->phase_index;
+    r->set_num = h->set_num;
+    r->state = h->state;
+    r->outcome = outcome;
+    h->open = false;
+}
+
+/*
+ * Append records to the history log. If that fails, the day goes on
+ * without a log.
+ */
+void history_write(history_tracker *h, HistoryRecord *records, int count) {
+    if (count > 0 && History_append(h->log, records, count) != 0) {
+        log_warn("Sessions will no longer be recorded");
+        h->log = NULL;
     }
-    check(rc == OK, "Alert failed");
-    return 0;
-error:
-    return -1;
 }
 
 /*
- * Dump the contents of a config file to stdout.
+ * Bring the history log up to date after a Pomodoro_step. When a phase
+ * starts or the day ends, the phase that ran out is recorded as completed,
+ * along with any that were missed, with one write, and the new phase is
+ * opened. Start and end times are worked back from the deadlines, so a late
+ * wakeup does not move them.
  *
  * Parameters:
- *     configptr: the pointer to the configuration struct to read
- *     filepath: the path to the file the config came from (for printing only)
- *
- * Returns:
- *     On success, 0
- *     On failure, -1
+ *     h: the tracker
+ *     s: the schedule in use
+ *     status: what the step found
+ *     now: the time of the step, on the timer's clock
  */
-int dump_config(configuration *configptr, char *filepath) {
-    check(configptr != NULL, "Got NULL configuration pointer!");
-    check(filepath != NULL, "Got NULL config path");
-    check(strncmp(filepath, "", MAXPATH) != 0, "Got empty config path");
-    printf("Current configuration from %s:\n", filepath);
-    printf("\tAlert type: %s\n",
-            configptr->alert_type == ALERT_BEEP ? "audible" : "visual");
-    printf("\tShort break length: %d minutes\n", configptr->short_break_length);
-    printf("\tLong break length: %d minutes\n", configptr->long_break_length);
-    printf("\tWork session length: %d minutes\n", configptr->work_length);
-    printf("\tPomodoros per set: %d\n", configptr->pomodoros_per_set);
-    printf("\tNumber of sets: %d\n", configptr->set_count);
+void history_step(history_tracker *h, const Schedule *s,
+        const PomodoroStatus *status, int64_t now) {
+    if (h->log == NULL) {
+        return;
+    }
+    if (!(status->events & (POMODORO_EV_PHASE_START | POMODORO_EV_DONE))) {
+        h->deadline = status->deadline_ns;
+        return;
+    }
+    HistoryRecord batch[HISTORY_BATCH];
+    int n = 0;
+    int64_t wall_ns = wall_clock_ns();
+    if (h->open) {
+        close_phase(h, &batch[n++], wall_ns - (now - h->deadline), 0,
+                HISTORY_COMPLETED);
+    }
 
-    return 0;
-error:
-    return -1;
+    /* When the new phase started, or the day ended */
+    int64_t anchor = status->deadline_ns;
+    if (status->state != POMODORO_DONE) {
+        anchor -= phase_length(s, status->phase_index) * NSEC_PER_SEC;
+    }
+    anchor = wall_ns - (now - anchor);
+
+    /* The missed phases are the ones right before the new phase */
+    int first = status->phase_index - (status->missed - h->missed);
+    int64_t start = anchor / NSEC_PER_SEC;
+    for (int i = first; i < status->phase_index; i++) {
+        start -= phase_length(s, i);
+    }
+    if (h->phase_index == -1 && (status->events & POMODORO_EV_PHASE_END)
+            && first > 0) {
+        /* A resumed day whose phase ran out while nothing was running */
+        h->phase_index = first - 1;
+        h->state = s->phases[first - 1].state;
+        h->set_num = s->phases[first - 1].set_num;
+        h->planned = phase_length(s, first - 1);
+        h->start = (start - h->planned) * NSEC_PER_SEC;
+        close_phase(h, &batch[n++], start * NSEC_PER_SEC, 0,
+                HISTORY_COMPLETED);
+    }
+    for (int i = first; i < status->phase_index && h->log != NULL; i++) {
+        if (n == HISTORY_BATCH) {
+            history_write(h, batch, n);
+            n = 0;
+        }
+        HistoryRecord *r = &batch[n++];
+        memset(r, 0, sizeof(*r));
+        r->start = start;
+        r->planned = phase_length(s, i);
+        r->phase_index = i;
+        r->set_num = s->phases[i].set_num;
+        r->state = s->phases[i].state;
+        r->outcome = HISTORY_MISSED;
+        start += r->planned;
+    }
+    if (h->log != NULL) {
+        history_write(h, batch, n);
+    }
+
+    h->missed = status->missed;
+    if (status->state != POMODORO_DONE) {
+        h->open = true;
+        h->state = status->state;
+        h->set_num = status->set_num;
+        h->phase_index = status->phase_index;
+        h->start = anchor;
+        h->planned = phase_length(s, status->phase_index);
+        h->deadline = status->deadline_ns;
+    }
 }
 
-/* 
- * Return a friendly status message to show to the user
+/*
+ * Record the phase under way as ended early.
  *
  * Parameters:
- *     state: The current state --- working or resting
- * 
- * Return:
- *     If state is valid, a human-friendly string describing the current state.
- *     Else, NULL
- */
-char *pomodoro_status(STATE state) {
-    switch (state) {
-        case POMODORO_WORK:
-            return "Working, working, working...";
-        case POMODORO_SHORT_REST:
-            return "Taking a little break :)";
-        case POMODORO_LONG_REST:
-            return "Relaxing for a while :D";
-        case POMODORO_ERROR:
-            return "Something went wrong :(";
-        default:
-            sentinel("Invalid STATE value");
+ *     h: the tracker
+ *     left_ns: time the phase had left
+ *     outcome: HISTORY_SKIPPED or HISTORY_INTERRUPTED
+ */
+void history_end(history_tracker *h, int64_t left_ns,
+        HISTORY_OUTCOME outcome) {
+    if (h->log == NULL || !h->open) {
+        return;
     }
-error:
-    return NULL;
+    HistoryRecord r;
+    close_phase(h, &r, wall_clock_ns(), left_ns, outcome);
+    history_write(h, &r, 1);
 }
 
-/* 
- * Do a pomodoro session
+/*
+ * Sum up today from the history log in one line, for the stats key.
  *
  * Parameters:
- *     t: pointer to the Timer to use
- *     session_length: length of this pomodoro, in minutes
- *     state: the type of timer --- working or resting
- *     status_win: pointer to the status window; needed for window calculations
- *     timer_win: pointer to the timer window; needed for window calculations
- *     set_num: current set number; needed for status window
- * 
- * Return: 0 on success, -1 on failure
- */
-int do_timer_session(Timer *t, int session_length, STATE state,
-        WINDOW *status_win, WINDOW *timer_win, int set_num) {
-    check(t != NULL, "Got NULL Timer pointer.");
-    int time_left = session_length * (SECONDS_PER_MINUTE);
-    int hours = session_length / MINUTES_PER_HOUR;
-    session_length -= hours * MINUTES_PER_HOUR;
-    int minutes = session_length;
-
-    int rc = Timer_set(t, hours, minutes, 0);
-    check(rc == 0, "Failed to set main timer.");
-
-    char msg[80];
-    char *cur_state_msg = pomodoro_status(state);
-
-    int timer_win_h;
-    int timer_win_w;
-    getmaxyx(timer_win, timer_win_h, timer_win_w);
-
-    int status_win_h;
-    int status_win_w;
-    getmaxyx(status_win, status_win_h, status_win_w);
-
-    wclear(timer_win);
-    box(timer_win, 0, 0);
-    wrefresh(timer_win);
-
-    wclear(status_win);
-    box(status_win, 0, 0);
-    wrefresh(status_win);
-
-    sprintf(msg, "%02d:%02d:00", hours, minutes);
-    mvwprintw(timer_win, timer_win_h / 2 - 1,
-            (timer_win_w-strlen(msg)) / 2 - 1, msg);
-    box(timer_win, 0, 0);
-    wrefresh(timer_win);
-    mvwprintw(status_win, status_win_h / 2,
-            (status_win_w-strlen(cur_state_msg)) / 2, "%s", cur_state_msg);
-    box(status_win, 0, 0);
-    wrefresh(status_win);
-    sprintf(msg, "Current set: %d", set_num);
-    mvwprintw(status_win, status_win_h / 2 - 1,
-            (status_win_w-strlen(msg)) / 2, "%s", msg);
-    box(status_win, 0, 0);
-    wrefresh(status_win);
-
-    while ((time_left = Timer_tick(t)) != -1) {
-        hours = time_left / (SECONDS_PER_MINUTE * MINUTES_PER_HOUR);
-        time_left -= hours * SECONDS_PER_MINUTE * MINUTES_PER_HOUR;
-        minutes = time_left / SECONDS_PER_MINUTE;
-        time_left -= minutes * SECONDS_PER_MINUTE;
-        int seconds = time_left;
-        sprintf(msg, "Time left: %02d:%02d:%02d", hours, minutes, seconds);
-        mvwprintw(timer_win, timer_win_h / 2 - 1,
-                (timer_win_w-strlen(msg)) / 2, "%s", msg);
-        box(timer_win, 0, 0);
-        wrefresh(timer_win);
+ *     records: the history log to read
+ *     line: filled in with the line
+ *     len: the size of line
+ */
+void today_line(const day_records *records, char *line, size_t len) {
+    struct tm local;
+    int32_t today;
+    StatsTotals totals;
+    int longest;
+    int current;
+    StatsIndex *idx = load_stats(records->history_path, records->rollup_path,
+            &today, &local);
+    if (idx == NULL) {
+        snprintf(line, len, "No history to show");
+        return;
     }
-    return 0;
-error:
-    return -1;
+    Stats_sum(idx, today, today, &totals);
+    Stats_streaks(idx, today, &longest, &current);
+    snprintf(line, len, "Today: %llu min, %u of %u done; streak %d days",
+            (unsigned long long)(totals.focused / SECONDS_PER_MINUTE),
+            totals.completed, totals.started, current);
+    Stats_destroy(idx);
 }
 
-/* 
- * Do a full pomodoro set
+/*
+ * Run every pomodoro set of the day.
+ *
+ * A single-threaded event loop waits on the timerfd, the terminal and the
+ * signalfd, so keys are handled as soon as they are pressed:
+ *     p or space: pause/resume
+ *     s: skip to the next phase
+ *     n: switch to the next profile from the next phase on
+ *     i: show today's time focused and the current streak
+ *     q: quit
+ * SIGINT and SIGTERM quit the same way as 'q', and SIGWINCH lays the
+ * windows out again for the new terminal size. A frontend that takes no
+ * keys leaves the terminal alone, and the loop ends when the day is done.
+ * The daemon frontend takes its keys as commands from attached clients,
+ * waiting on its epoll fd in place of the terminal.
+ * Phase sequencing is left to the Pomodoro state machine; this loop only
+ * feeds it the time and input. With a low-power Frontend, timer wakeups are
+ * pushed back to the next LOW_POWER_COALESCE_NS boundary.
+ *
+ * The first phase starts counting, and is drawn, straight away. Setup
+ * nobody needs for that is only done afterwards, and the welcome message
+ * goes up over the status window while the timer runs underneath it.
+ *
+ * When the config file is saved, it is read again and the new settings
+ * apply from the next phase on; a message over the status window says
+ * whether they could be used.
+ *
+ * A checkpoint is saved as each phase starts and whenever the day is
+ * paused, resumed or rescheduled, never on a plain tick. If one cannot be
+ * saved, the day goes on without them. Each phase that ends, however it
+ * ends, is appended to the history log.
  *
  * Parameters:
  *     t: The Timer to use
- *     work_len: how many minutes work sessions are
- *     short_b_len: how many minutes short (inter-pomodoro) breaks are
- *     long_b_len: how many minutes long (inter-set) breaks are
- *     sessions_per_set: how many pomodoro+short-break reps per set
- *     status_win: pointer to the status window; needed for window calculations
- *     timer_win: pointer to the timer window; needed for window calculations
- *     set_num: current set number; needed for status window
+ *     day: the day to run, freshly set up by Pomodoro_init
+ *     fe: the Frontend to draw on
  *     alert_type: the type of alert to use
+ *     timer_fd: a timerfd on the same clock as t
+ *     signal_fd: a signalfd from open_signal_fd()
+ *     live: the config file to reload settings from, and the profile
+ *     setup: what to do once the first frame is up
+ *     records: where to save checkpoints and record phases
+ *     wakeups: set to the number of times the loop woke up
  * 
  * Return: 0 on sucess, -1 on error
  */
-int do_pomodoro_set(Timer *t, int work_len, int short_b_len, int long_b_len,
-        int sessions_per_set, WINDOW *status_win, WINDOW *timer_win,
-        int set_num, ALERT_TYPE type) {
-    int rc = 0;
+int run_pomodoro_day(Timer *t, Pomodoro *day, Frontend *fe, ALERT_TYPE type,
+        int timer_fd, int signal_fd, live_config *live, deferred_setup *setup,
+        day_records *records, long *wakeups) {
     check(t != NULL, "Got NULL Timer pointer");
+    check(day != NULL, "Got NULL Pomodoro pointer");
+
+    enum { EV_TIMER, EV_INPUT, EV_SIGNAL, EV_CONFIG, EV_COUNT };
+    struct pollfd fds[EV_COUNT] = {
+        [EV_TIMER] = { .fd = timer_fd, .events = POLLIN },
+        /* poll() skips negative fds; a frontend without keys reads none */
+        [EV_INPUT] = { .fd = fe->read_key != NULL ? fe->input_fd : -1,
+                .events = POLLIN },
+        [EV_SIGNAL] = { .fd = signal_fd, .events = POLLIN },
+        [EV_CONFIG] = { .fd = live->fd, .events = POLLIN }
+    };
+    PomodoroStatus status;
+    history_tracker recorder = { .log = records->history, .open = false,
+            .phase_index = -1, .missed = 0 };
+
+    int64_t start = Timer_now(t);
+    int rc = Pomodoro_step(day, start, &status);
+    check(rc == 0, "Failed to start the day");
+    /* A resumed day starts partway through a phase; show it all the same */
+    if (status.events == POMODORO_EV_NONE) {
+        status.events = POMODORO_EV_PHASE_START;
+    }
+    history_step(&recorder, *live->schedule, &status, start);
+    int64_t wake = Frontend_present(fe, t, &status, type);
+    check(wake != -1, "Failed to show the day");
+    trace_mark(setup->trace, "first frame");
+    int64_t message_end = finish_startup(fe, t, setup);
+    check(message_end != -1, "Failed to finish starting up");
+    wake = coalesce(fe, wake, t->deadline_ns);
+    rc = arm_timer_fd(timer_fd, sooner(wake, message_end));
+    check(rc == 0, "Failed to schedule first tick");
+    if (records->checkpoint != NULL
+            && save_checkpoint(records->checkpoint, &status, live) != 0) {
+        log_warn("Progress will not be saved for --resume");
+        records->checkpoint = NULL;
+    }
+
+    *wakeups = 0;
+    bool running = true;
+    while (running) {
+        rc = poll(fds, EV_COUNT, -1);
+        (*wakeups)++;
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        check(rc != -1, "poll failed");
+        bool changed = false;
+        bool resized = false;
+        /* Whether to save a checkpoint after this wakeup */
+        bool save = false;
+        /* Message to put over the status window */
+        char note[UI_LINE_MAX] = "";
+
+        if (fds[EV_SIGNAL].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+                    running = false;
+                } else if (info.ssi_signo == SIGWINCH) {
+                    resized = true;
+                }
+            }
+        }
 
-    for (int i = 0; i < sessions_per_set; i++) {
-        do_timer_session(t, work_len, POMODORO_WORK, status_win, timer_win,
-                set_num);
-        clear();
-        refresh();
-        rc = alert_user(type);
-        check(rc == 0, "Terminal alert failure!");
-        do_timer_session(t, short_b_len, POMODORO_SHORT_REST,
-                status_win, timer_win, set_num);
-        rc = alert_user(type);
-        check(rc == 0, "Terminal alert failure!");
-    }
-    clear();
-    refresh();
-    do_timer_session(t, long_b_len, POMODORO_LONG_REST, status_win, timer_win,
-            set_num);
-    return rc;
+        if (fds[EV_CONFIG].revents & POLLIN) {
+            rc = reload_config(live, day);
+            if (rc != 0) {
+                snprintf(note, sizeof(note), "%s", rc == 1
+                        ? "Settings reloaded for the next phase"
+                        : "Bad config file; keeping the old settings");
+                /* Parse errors go to stderr, which may be the screen */
+                resized = resized || rc == -1;
+                save = save || rc == 1;
+            }
+        }
+
+        if (resized && fe->resize != NULL) {
+            struct winsize ws;
+            rc = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
+            check(rc == 0, "Failed to read the terminal size");
+            rc = fe->resize(fe, ws.ws_row, ws.ws_col);
+            check(rc == 0, "Failed to lay out the resized terminal");
+            changed = true;
+        }
+
+        if (fds[EV_INPUT].revents & POLLIN) {
+            int ch;
+            while ((ch = fe->read_key(fe)) != -1) {
+                if (status.state == POMODORO_DONE || ch == 'q') {
+                    running = false;
+                } else if (ch == 'p' || ch == ' ') {
+                    rc = status.paused ? Pomodoro_resume(day, Timer_now(t))
+                            : Pomodoro_pause(day, Timer_now(t));
+                    check(rc == 0, "Failed to pause or resume");
+                    changed = true;
+                    save = true;
+                } else if (ch == 's') {
+                    int64_t now = Timer_now(t);
+                    history_end(&recorder, time_left(&status, now),
+                            HISTORY_SKIPPED);
+                    rc = Pomodoro_skip(day, now);
+                    check(rc == 0, "Failed to skip phase");
+                    changed = true;
+                } else if (ch == 'n' && live->file->count == 1) {
+                    snprintf(note, sizeof(note),
+                            "No profiles in the config file");
+                } else if (ch == 'n') {
+                    rc = next_profile(live, day);
+                    const char *name =
+                            live->file->sections[live->profile].name;
+                    snprintf(note, sizeof(note), rc == 0
+                            ? "Profile %s from the next phase"
+                            : "Could not switch to profile %s",
+                            name[0] != '\0' ? name : "(none)");
+                    save = save || rc == 0;
+                } else if (ch == 'i') {
+                    today_line(records, note, sizeof(note));
+                }
+            }
+        }
+
+        type = live->alert_type;
+        if (note[0] != '\0' && fe->read_key != NULL) {
+            fe->show_message(fe, note);
+            message_end = Timer_now(t) + MESSAGE_NS;
+            changed = true;
+        } else if (note[0] != '\0') {
+            /* Nothing is laid out to show a message on */
+            log_info("%s", note);
+        }
+
+        if (fds[EV_TIMER].revents & POLLIN) {
+            uint64_t expirations;
+            rc = read(timer_fd, &expirations, sizeof(expirations));
+            check(rc == sizeof(expirations) || errno == EAGAIN,
+                    "Failed to read timerfd");
+            changed = true;
+        }
+
+        if ((changed || save) && running) {
+            int64_t now = Timer_now(t);
+            rc = Pomodoro_step(day, now, &status);
+            check(rc == 0, "Failed to advance the day");
+            if (status.events & (POMODORO_EV_PHASE_START | POMODORO_EV_DONE)) {
+                save = true;
+            }
+            history_step(&recorder, *live->schedule, &status, now);
+            if (save && records->checkpoint != NULL
+                    && save_checkpoint(records->checkpoint, &status,
+                    live) != 0) {
+                log_warn("Progress will not be saved for --resume");
+                records->checkpoint = NULL;
+            }
+            if (message_end > 0 && now >= message_end) {
+                /* Put the session back where the message was */
+                status.events |= POMODORO_EV_PHASE_START;
+                message_end = 0;
+            }
+            wake = Frontend_present(fe, t, &status, type);
+            check(wake != -1, "Failed to show the day");
+            wake = coalesce(fe, wake, t->deadline_ns);
+            rc = arm_timer_fd(timer_fd, sooner(wake, message_end));
+            check(rc == 0, "Failed to schedule next tick");
+        }
+        /* Nobody can press a key to leave the finished day */
+        if (status.state == POMODORO_DONE
+                && (fe->read_key == NULL || fe->leave_when_done)) {
+            running = false;
+        }
+    }
+    history_end(&recorder, time_left(&status, Timer_now(t)),
+            HISTORY_INTERRUPTED);
+
+    return 0;
 error:
     return -1;
 }
 
+/* A connection to the daemon, and what it sent that is not read yet */
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[4 * DAEMON_LINE_MAX];
+} daemon_link;
+
 /*
- * Destroy an ncurses window that isn't stdscr
- * 
+ * Take the first whole line the daemon sent out of what has come in.
+ *
+ * Returns: true if there was one, now in line without its newline
+ */
+bool daemon_next_line(daemon_link *l, char *line, size_t size) {
+    char *nl = memchr(l->buf, '\n', l->len);
+    if (nl == NULL) {
+        return false;
+    }
+    size_t n = nl - l->buf;
+    snprintf(line, size, "%.*s", (int)n, l->buf);
+    l->len -= n + 1;
+    memmove(l->buf, nl + 1, l->len);
+    return true;
+}
+
+/*
+ * Read what the daemon has sent.
+ *
+ * Returns: the number of bytes read, 0 once the daemon has gone, or -1
+ */
+ssize_t daemon_fill(daemon_link *l) {
+    if (l->len == sizeof(l->buf)) {
+        /* Nothing the daemon sends is this long */
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = read(l->fd, l->buf + l->len, sizeof(l->buf) - l->len);
+    } while (n == -1 && errno == EINTR);
+    if (n > 0) {
+        l->len += n;
+    }
+    return n;
+}
+
+/*
+ * Wait a while for the next line from the daemon.
+ *
+ * Returns: 1 with the line in line, 0 if none came in time, or -1 once the
+ * daemon has gone
+ */
+int daemon_wait_line(daemon_link *l, char *line, size_t size,
+        int timeout_ms) {
+    while (!daemon_next_line(l, line, size)) {
+        struct pollfd pfd = { .fd = l->fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+        if (daemon_fill(l) <= 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Print what a line from the daemon says, for the ctl command.
+ */
+void print_daemon_event(const DaemonEvent *ev) {
+    char text[UI_LINE_MAX];
+    if (ev->kind == DAEMON_EV_MESSAGE) {
+        printf("%s\n", ev->text);
+    } else if (ev->kind == DAEMON_EV_ALERT) {
+        return;
+    } else if (ev->state == POMODORO_DONE) {
+        printf("All done.\n");
+    } else {
+        Frontend_format_time(text, sizeof(text),
+                (ev->left_ns + NSEC_PER_SEC - 1) / NSEC_PER_SEC, -1,
+                ev->paused, false);
+        printf("%s Set %d. %s\n", pomodoro_status(ev->state), ev->set_num,
+                text);
+    }
+}
+
+/*
+ * Send a command to the daemon from the arguments that follow the ctl
+ * command, and print where the day stands after it to stdout.
+ *
  * Parameters:
- *     win: window to destroy
- * Returns: none
+ *     argc: the number of arguments, counting "ctl" itself
+ *     argv: the arguments, starting with "ctl"
+ *     socket_path: the daemon's socket
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
  */
-void destroy_win(WINDOW *win) {
-    check(win != NULL, "Got NULL Window pointer");
-    wborder(win, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
-    delwin(win);
+int control_daemon(int argc, char *argv[], const char *socket_path) {
+    static const char *commands[] = {
+        "status", "pause", "skip", "profile", "info", "stop"
+    };
+    daemon_link link = { .fd = -1, .len = 0 };
+    char line[DAEMON_LINE_MAX];
+    DaemonEvent ev;
+    check(argc == 2, "Usage: %s ctl status|pause|skip|profile|info|stop",
+            PROG_NAME);
+    const char *cmd = argv[1];
+    size_t i = 0;
+    while (i < sizeof(commands) / sizeof(commands[0])
+            && strcmp(cmd, commands[i]) != 0) {
+        i++;
+    }
+    check(i < sizeof(commands) / sizeof(commands[0]),
+            "Unknown command '%s'", cmd);
+
+    link.fd = Daemon_connect(socket_path);
+    check(link.fd != -1, "Start one with --daemon");
+    /* Where the day stands comes first, as soon as we attach */
+    int rc = daemon_wait_line(&link, line, sizeof(line), CTL_TIMEOUT_MS);
+    check(rc == 1, "No answer from the daemon");
+    if (strcmp(cmd, "status") != 0) {
+        check(Daemon_send_command(link.fd, cmd) == 0, "The daemon went away");
+        /* A skip rings the alert before the next phase starts */
+        do {
+            rc = daemon_wait_line(&link, line, sizeof(line), CTL_TIMEOUT_MS);
+        } while (rc == 1 && strncmp(line, "alert ", 6) == 0);
+        check(rc != -1 || strcmp(cmd, "stop") == 0,
+                "The daemon went away");
+    }
+    if (rc == 1 && Daemon_parse_event(line, &ev) == 0) {
+        print_daemon_event(&ev);
+    } else if (rc == -1) {
+        printf("Stopped.\n");
+    }
+    close(link.fd);
+
+    return 0;
 error:
-    return;
+    if (link.fd != -1) {
+        close(link.fd);
+    }
+    return -1;
 }
 
-/* 
- * Create a new window
+/*
+ * Show a day that a daemon runs, attached to it as a client. The daemon
+ * sends where the day stands when we attach and whenever that changes;
+ * between those, the time left is counted down here, on our own timer,
+ * and drawn through the Frontend as run_pomodoro_day would. Keys are sent
+ * on to the daemon as commands:
+ *     p or space: pause/resume
+ *     s: skip to the next phase
+ *     n: switch to the next profile
+ *     i: show today's time focused and the current streak
+ *     q: detach, leaving the daemon running
+ * The loop also ends when the daemon stops or the day is done.
  *
  * Parameters:
- *     h: window height
- *     w: window width
- *     y: y coordinate of top-left corner
- *     x: x coordinate of top-left corner
- * Returns:
- *     on success, a pointer to the new window
- *     on failure, NULL
+ *     t: the Timer to count down on
+ *     fe: the Frontend to draw on
+ *     sock: a socket from Daemon_connect
+ *     timer_fd: a timerfd on the same clock as t
+ *     signal_fd: a signalfd from open_signal_fd()
+ *     setup: what to do once the first frame is up
+ *
+ * Return: 0 on sucess, -1 on error
  */
-WINDOW *create_window(int h, int w, int y, int x) {
-    WINDOW *new_window = newwin(h, w, y, x);
-    check(new_window != NULL, "Failed to create window");
-    box(new_window, 0, 0);
-    wrefresh(new_window);
+int run_attached(Timer *t, Frontend *fe, int sock, int timer_fd,
+        int signal_fd, deferred_setup *setup) {
+    enum { EV_TIMER, EV_INPUT, EV_SIGNAL, EV_DAEMON, EV_COUNT };
+    struct pollfd fds[EV_COUNT] = {
+        [EV_TIMER] = { .fd = timer_fd, .events = POLLIN },
+        [EV_INPUT] = { .fd = fe->read_key != NULL ? fe->input_fd : -1,
+                .events = POLLIN },
+        [EV_SIGNAL] = { .fd = signal_fd, .events = POLLIN },
+        [EV_DAEMON] = { .fd = sock, .events = POLLIN }
+    };
+    daemon_link link = { .fd = sock, .len = 0 };
+    PomodoroStatus status = { .state = POMODORO_WORK, .events = 0 };
+    /* Whether the daemon has said where the day stands, and it is shown */
+    bool seen = false;
+    bool shown = false;
+    int64_t message_end = 0;
+    int rc;
+
+    bool running = true;
+    while (running) {
+        rc = poll(fds, EV_COUNT, -1);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        check(rc != -1, "poll failed");
+        bool changed = false;
+
+        if (fds[EV_SIGNAL].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+                    running = false;
+                } else if (info.ssi_signo == SIGWINCH && fe->resize != NULL) {
+                    struct winsize ws;
+                    rc = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
+                    check(rc == 0, "Failed to read the terminal size");
+                    rc = fe->resize(fe, ws.ws_row, ws.ws_col);
+                    check(rc == 0, "Failed to lay out the resized terminal");
+                    status.events |= POMODORO_EV_PHASE_START;
+                    changed = true;
+                }
+            }
+        }
+
+        if (fds[EV_INPUT].revents & POLLIN) {
+            int ch;
+            while ((ch = fe->read_key(fe)) != -1) {
+                const char *cmd = Daemon_command(ch);
+                if (ch == 'q' || status.state == POMODORO_DONE) {
+                    running = false;
+                } else if (cmd != NULL
+                        && Daemon_send_command(sock, cmd) != 0) {
+                    /* The daemon is gone; leave the terminal as it was */
+                    running = false;
+                }
+            }
+        }
+
+        if (fds[EV_DAEMON].revents & (POLLIN | POLLHUP)) {
+            if (daemon_fill(&link) <= 0) {
+                running = false;
+            }
+            char line[DAEMON_LINE_MAX];
+            DaemonEvent ev;
+            while (daemon_next_line(&link, line, sizeof(line))) {
+                if (Daemon_parse_event(line, &ev) != 0) {
+                    continue;
+                }
+                int64_t now = Timer_now(t);
+                if (ev.kind == DAEMON_EV_ALERT) {
+                    rc = fe->alert(fe, ev.alert);
+                    check(rc == 0, "Terminal alert failure!");
+                } else if (ev.kind == DAEMON_EV_MESSAGE
+                        && fe->read_key != NULL) {
+                    fe->show_message(fe, ev.text);
+                    message_end = now + MESSAGE_NS;
+                } else if (ev.kind != DAEMON_EV_MESSAGE) {
+                    if (ev.kind == DAEMON_EV_START || !seen
+                            || ev.state != status.state) {
+                        status.events |= POMODORO_EV_PHASE_START;
+                    }
+                    status.state = ev.state;
+                    status.set_num = ev.set_num;
+                    status.missed = ev.missed;
+                    status.paused = ev.paused;
+                    status.remaining_ns = ev.left_ns;
+                    status.deadline_ns = now + ev.left_ns;
+                    seen = true;
+                }
+                changed = true;
+            }
+        }
+
+        if (fds[EV_TIMER].revents & POLLIN) {
+            uint64_t expirations;
+            rc = read(timer_fd, &expirations, sizeof(expirations));
+            check(rc == sizeof(expirations) || errno == EAGAIN,
+                    "Failed to read timerfd");
+            changed = true;
+        }
+
+        if (changed && seen && running) {
+            int64_t now = Timer_now(t);
+            if (message_end > 0 && now >= message_end) {
+                /* Put the session back where the message was */
+                status.events |= POMODORO_EV_PHASE_START;
+                message_end = 0;
+            }
+            int64_t wake = Frontend_present(fe, t, &status, ALERT_UNSET);
+            check(wake != -1, "Failed to show the day");
+            status.events = POMODORO_EV_NONE;
+            if (!shown) {
+                trace_mark(setup->trace, "first frame");
+                int64_t splash_end = finish_startup(fe, t, setup);
+                check(splash_end != -1, "Failed to finish starting up");
+                message_end = sooner(message_end, splash_end);
+                shown = true;
+            }
+            wake = coalesce(fe, wake, t->deadline_ns);
+            rc = arm_timer_fd(timer_fd, sooner(wake, message_end));
+            check(rc == 0, "Failed to schedule next tick");
+        }
+        if (status.state == POMODORO_DONE && fe->read_key == NULL) {
+            running = false;
+        }
+    }
 
-    return new_window;
+    return 0;
 error:
-    return NULL;
+    return -1;
 }
 
-static int handler(void *user, const char *section, const char *name,
-        const char *value) {
-    configuration *pconfig = (configuration *)user;
-
-#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-    if (MATCH("timer", "short_break_length")) {
-        pconfig->short_break_length = atoi(value);
-    } else if (MATCH("timer", "long_break_length")) {
-        pconfig->long_break_length = atoi(value);
-    } else if (MATCH("timer", "set_count")) {
-        pconfig->set_count = atoi(value);
-    } else if (MATCH("timer", "pomodoros_per_set")) {
-        pconfig->pomodoros_per_set = atoi(value);
-    } else if (MATCH("timer", "work_length")) {
-        pconfig->work_length = atoi(value);
-    } else if (MATCH("timer", "alert_type")) {
-        if (strncmp(value, "beep", 16) == 0) {
-            pconfig->alert_type = ALERT_BEEP;
-        } else if (strncmp(value, "flash", 16) == 0) {
-            pconfig->alert_type = ALERT_FLASH;
-        } else {
-            sentinel("Bad alert type %s. Choose 'beep' or 'flash'.", value);
+/* Commands that can come first on the command line, in place of options */
+static const char *COMMANDS[] = { "stats", "compact", "export", "ctl" };
+
+/* Whether an argument names one of COMMANDS */
+bool is_command(const char *arg) {
+    for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
+        if (strcmp(arg, COMMANDS[i]) == 0) {
+            return true;
         }
-    } else {
-        sentinel("Bad value in config: %s[%s]", section, name);
     }
-    return 1;
+    return false;
+}
+
+/*
+ * Run one of COMMANDS instead of a day.
+ *
+ * Parameters:
+ *     argc: the number of arguments, counting the command itself
+ *     argv: the arguments, starting with the command
+ *     config_path: the default config file
+ *     history_path: the history log
+ *     rollup_path: the history log's rollups
+ *     socket_path: the daemon's socket
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int run_command(int argc, char *argv[], const char *config_path,
+        const char *history_path, const char *rollup_path,
+        const char *socket_path) {
+    if (strcmp(argv[0], "stats") == 0) {
+        check(argc == 1, "stats takes no arguments");
+        return dump_stats(history_path, rollup_path);
+    } else if (strcmp(argv[0], "compact") == 0) {
+        return dump_compaction(argc, argv, history_path, config_path);
+    } else if (strcmp(argv[0], "export") == 0) {
+        return export_history(argc, argv, history_path);
+    } else if (strcmp(argv[0], "ctl") == 0) {
+        return control_daemon(argc, argv, socket_path);
+    }
+    sentinel("Unknown command '%s'", argv[0]);
 error:
-    return 0;
+    return -1;
 }
 
 int main(int argc, char *argv[]) {
 
     configuration config = {.long_break_length = 0, .pomodoros_per_set = 0,
             .set_count = 0, .short_break_length = 0, .work_length = 0,
-            .alert_type = ALERT_UNSET };
+            .alert_type = ALERT_UNSET, .timer_clock = TIMER_CLOCK_UNSET,
+            .schedule = NULL, .low_power = false, .fps = 0,
+            .frontend = FRONTEND_UNSET };
     configuration explicit_config = {.long_break_length = 0,
             .pomodoros_per_set = 0, .set_count = 0, .short_break_length = 0,
-            .work_length = 0, .alert_type = ALERT_UNSET };
+            .work_length = 0, .alert_type = ALERT_UNSET,
+            .timer_clock = TIMER_CLOCK_UNSET, .schedule = NULL,
+            .low_power = false, .fps = 0, .frontend = FRONTEND_UNSET };
 
+    Clock main_clock;
+    Schedule *schedule = NULL;
     Timer *pomodoro_timer = NULL;
-    WINDOW *status_window = NULL;
-    WINDOW *timer_window = NULL;
+    int timer_fd = -1;
+    int signal_fd = -1;
+    live_config live = { .fd = -1, .file = NULL, .profile = 0 };
+#ifndef POMODORO_NO_CURSES
+    Ui ui = { .status_win = NULL, .timer_win = NULL };
+#endif
+    Ansi ansi = { .saved = false, .hline = NULL };
+    Headless headless;
+    Frontend *fe = NULL;
+    startup_trace trace = { .enabled = false, .count = 0 };
+    trace_mark(&trace, "start");
     /* #### program options #### */
     int opt; // variable for getting options with getopt(3)
     int option_index;
 
-    char *home = getenv("HOME");
-    check(home != NULL, "HOME environment variable doesn't exist");
-    char *default_config_path = strncat(home, "/.config/", MAXPATH);
-    default_config_path = strncat(default_config_path, PROG_NAME, MAXPATH);
-    default_config_path = strncat(default_config_path, "/config.ini", MAXPATH);
-    check (strnlen(default_config_path, MAXPATH) < MAXPATH,
-            "Config path too long");
-    
     /* For -c option */
     char *config_file = NULL;
+    char *default_config_path = NULL;
+    char *checkpoint_path = NULL;
+    char *history_path = NULL;
+    char *rollup_path = NULL;
+    char *socket_path = NULL;
+    History history = { .fd = -1 };
+    Daemon server = { .clients = NULL };
+    /* Socket from Daemon_listen until the Daemon takes it over */
+    int daemon_listen_fd = -1;
+    /* Socket to the daemon with --attach */
+    int attach_fd = -1;
+
+    char *home = getenv("HOME");
+    check(home != NULL, "HOME environment variable doesn't exist");
+    default_config_path = malloc(MAXPATH + 1);
+    check_mem(default_config_path);
+    int len = snprintf(default_config_path, MAXPATH + 1,
+            "%s/.config/%s/config.ini", home, PROG_NAME);
+    check(len <= MAXPATH, "Config path too long");
+    checkpoint_path = malloc(MAXPATH + 1);
+    check_mem(checkpoint_path);
+    len = snprintf(checkpoint_path, MAXPATH + 1, "%s/.config/%s/checkpoint",
+            home, PROG_NAME);
+    check(len <= MAXPATH, "Checkpoint path too long");
+    history_path = malloc(MAXPATH + 1);
+    check_mem(history_path);
+    len = snprintf(history_path, MAXPATH + 1, "%s/.config/%s/history", home,
+            PROG_NAME);
+    check(len <= MAXPATH, "History path too long");
+    rollup_path = malloc(MAXPATH + 1);
+    check_mem(rollup_path);
+    len = snprintf(rollup_path, MAXPATH + 1, "%s.rollup", history_path);
+    check(len <= MAXPATH, "Rollup path too long");
+    socket_path = malloc(MAXPATH + 1);
+    check_mem(socket_path);
+    len = snprintf(socket_path, MAXPATH + 1, "%s/.config/%s/socket", home,
+            PROG_NAME);
+    check(len <= MAXPATH, "Socket path too long");
+
+    if (argc > 1 && is_command(argv[1])) {
+        int status = run_command(argc - 1, argv + 1, default_config_path,
+                history_path, rollup_path, socket_path) == 0
+                ? EXIT_SUCCESS : EXIT_FAILURE;
+        free(default_config_path);
+        free(checkpoint_path);
+        free(history_path);
+        free(rollup_path);
+        free(socket_path);
+        exit(status);
+    }
+    trace_mark(&trace, "config path");
 
     // Default alert type
     ALERT_TYPE alert_type = ALERT_BEEP;
 
-    // Default pomodoro (work session) length, in minutes
-    short int session_length = 25;
-
-    // Default short break length, in minutes
-    short int short_break_length = 5;
-
-    // Number of sets to work through
-    short int num_sets = 1;
-
-    // Number of sessions before a long break
-    short int pomodoros_per_set = 3;
-
-    // Default long break length, in minutes
-    short int long_break_length = 30;
-
-    int rc = ini_parse(default_config_path, handler, &config);
-    check(rc != -1, "Error opening default config file '%s'",
-            default_config_path);
-    check(rc != -2, "ini_parse memory error");
-    short_break_length = config.short_break_length;
-    long_break_length = config.long_break_length;
-    num_sets = config.set_count;
-    pomodoros_per_set = config.pomodoros_per_set;
-    session_length = config.work_length;
-    alert_type = config.alert_type;
-    check(rc == 0, "Failed to parse default config file");
+    // Default clock to time against
+    TIMER_CLOCK timer_clock = TIMER_CLOCK_MONOTONIC;
 
+    int rc = 0;
     static struct option long_options[] = {
         {"alert-type", required_argument, 0, 'a'},
+        {"attach", no_argument, 0, 'A'},
         {"short-break-length", required_argument, 0, 'b'},
         {"long-break-length", required_argument, 0, 'B'},
         {"config-file", required_argument, 0, 'c'},
+        {"clock", required_argument, 0, 'k'},
+        {"low-power", no_argument, 0, 'l'},
         {"dump-config", no_argument, 0, 'd'},
+        {"daemon", no_argument, 0, 'D'},
+        {"fps", required_argument, 0, 'F'},
         {"help", no_argument, 0, 'h'},
         {"num-sets", required_argument, 0, 'n'},
         {"pomodoros-per-set", required_argument, 0, 'p'},
-        {"session-length", required_argument, 0, 's'}
+        {"resume", no_argument, 0, 'r'},
+        {"session-length", required_argument, 0, 's'},
+        {"frontend", required_argument, 0, 'u'},
+        {"headless", no_argument, 0, 'H'},
+        {"format", required_argument, 0, 'f'},
+        {"tick", required_argument, 0, 't'},
+        {"startup-trace", no_argument, 0, 'T'},
+        {"profile", required_argument, 0, 'P'},
+        {"schedule", required_argument, 0, 'S'},
+        {0, 0, 0, 0}
     };
 
     bool use_custom_config_file = false;
     bool do_config_dump = false;
-
-    while ((opt = getopt_long(argc, argv, "a:b:c:dhn:p:s:B:", long_options,
-            &option_index)) != -1) {
+    bool headless_mode = false;
+    bool daemon_mode = false;
+    bool attach = false;
+    HEADLESS_FORMAT headless_format = HEADLESS_TEXT;
+    /* Seconds between headless ticks; -1 for none */
+    int tick = -1;
+    /* Profile from --profile, or NULL */
+    const char *profile_name = NULL;
+    bool resume = false;
+    Checkpoint resume_from;
+
+    while ((opt = getopt_long(argc, argv,
+            "a:b:c:df:F:hHk:ln:p:rs:t:u:AB:DP:S:T",
+            long_options, &option_index)) != -1) {
         switch (opt) {
             case 'a':
                 if (strncmp(optarg, "beep", 16) == 0) {
@@ -438,52 +1888,149 @@ int main(int argc, char *argv[]) {
                 break;
             case 'b':
                 explicit_config.short_break_length = atoi(optarg);
-                check(short_break_length > 0,
+                check(explicit_config.short_break_length > 0,
                         "Short break length must be greater than 0");
                 break;
             case 'c':
                 use_custom_config_file = true;
+                free(config_file);
                 config_file = strndup(optarg, MAXPATH);
-                rc = ini_parse(config_file, handler, &config);
-                check(rc != -1, "Error opening config file '%s'", config_file);
-                check(rc != -2, "ini_parse memory error");
-                short_break_length = config.short_break_length;
-                long_break_length = config.long_break_length;
-                num_sets = config.set_count;
-                pomodoros_per_set = config.pomodoros_per_set;
-                session_length = config.work_length;
+                check_mem(config_file);
                 break;
             case 'd':
                 do_config_dump = true;
                 break;
+            case 'f':
+                if (strncmp(optarg, "text", 16) == 0) {
+                    headless_format = HEADLESS_TEXT;
+                } else if (strncmp(optarg, "json", 16) == 0) {
+                    headless_format = HEADLESS_JSON;
+                } else {
+                    log_err("Bad format '%s'. Choose 'text' or 'json'\n",
+                            optarg);
+                    usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'F':
+                explicit_config.fps = atoi(optarg);
+                check(explicit_config.fps > 0
+                        && explicit_config.fps <= UI_MAX_FPS,
+                        "Frame rate must be between 1 and %d", UI_MAX_FPS);
+                break;
             case 'h':
                 usage();
                 exit(EXIT_SUCCESS);
+            case 'H':
+                headless_mode = true;
+                break;
+            case 'k':
+                explicit_config.timer_clock = parse_timer_clock(optarg);
+                if (explicit_config.timer_clock == TIMER_CLOCK_UNSET) {
+                    log_err("Bad clock '%s'. Choose 'monotonic', 'boottime' "
+                            "or 'realtime'\n", optarg);
+                    usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                explicit_config.low_power = true;
+                break;
             case 'n':
                 explicit_config.set_count = atoi(optarg);
-                check(num_sets > 0, "Number of sets must be greater than 0");
+                check(explicit_config.set_count > 0,
+                        "Number of sets must be greater than 0");
                 break;
             case 'p':
                 explicit_config.pomodoros_per_set = atoi(optarg);
-                check(pomodoros_per_set > 0,
+                check(explicit_config.pomodoros_per_set > 0,
                         "Pomodoros per set must be greater than 0");
                 break;
+            case 'r':
+                resume = true;
+                break;
             case 's':
                 explicit_config.work_length = atoi(optarg);
-                check(session_length > 0,
+                check(explicit_config.work_length > 0,
                         "Session length must be greater than 0");
                 break;
+            case 't':
+                tick = atoi(optarg);
+                check(tick > 0, "Tick must be greater than 0 seconds");
+                break;
+            case 'u':
+                explicit_config.frontend = parse_frontend(optarg);
+                if (explicit_config.frontend == FRONTEND_UNSET) {
+                    log_err("Bad frontend '%s'. Choose 'curses' or 'ansi'\n",
+                            optarg);
+                    usage();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'A':
+                attach = true;
+                break;
             case 'B':
                 explicit_config.long_break_length = atoi(optarg);
-                check(long_break_length > 0,
+                check(explicit_config.long_break_length > 0,
                         "Long break length must be greater than 0");
                 break;
+            case 'D':
+                daemon_mode = true;
+                break;
+            case 'P':
+                profile_name = optarg;
+                break;
+            case 'S':
+                free(explicit_config.schedule);
+                explicit_config.schedule = strndup(optarg, CONFIG_SCHEDULE_MAX);
+                check_mem(explicit_config.schedule);
+                break;
+            case 'T':
+                trace.enabled = true;
+                break;
             default:
                 usage();
                 exit(EXIT_FAILURE);
         }
     }
 
+    check(!(daemon_mode && attach), "Pick one of --daemon and --attach");
+    check(!(attach && resume), "Resume the day in the daemon instead");
+    if (attach) {
+        attach_fd = Daemon_connect(socket_path);
+        check(attach_fd != -1, "Start one with --daemon");
+    }
+
+    if (resume) {
+        rc = Checkpoint_load(checkpoint_path, &resume_from);
+        check(rc == 0, "No checkpoint to resume in '%s'", checkpoint_path);
+        /* The day goes on with the profile it was running */
+        if (profile_name == NULL) {
+            profile_name = resume_from.profile;
+        }
+    }
+
+    live.file = load_config(default_config_path, config_file);
+    check(live.file != NULL, "Failed to load the config");
+    if (profile_name == NULL) {
+        profile_name = live.file->sections[0].values.profile;
+    }
+    if (profile_name[0] != '\0') {
+        live.profile = Config_find(live.file, profile_name);
+        check(live.profile > 0, "No profile '%s' in the config",
+                profile_name);
+    }
+    rc = Config_resolve(live.file, live.profile, &config);
+    check(rc == 0, "Failed to work out the settings");
+    if (config.alert_type != ALERT_UNSET) {
+        alert_type = config.alert_type;
+    }
+    if (config.timer_clock != TIMER_CLOCK_UNSET) {
+        timer_clock = config.timer_clock;
+    }
+    trace_mark(&trace, "config file");
+
     /*
      * If any command-line args were passed, we need to see if config values
      * need to be overwritten with the correspopnding values from the command
@@ -492,142 +2039,299 @@ int main(int argc, char *argv[]) {
     if (explicit_config.alert_type != ALERT_UNSET) {
         alert_type = explicit_config.alert_type;
     }
-    if (explicit_config.short_break_length != 0
-            && explicit_config.short_break_length != config.short_break_length)
-    {
-        short_break_length = explicit_config.short_break_length;
-    }
-    if (explicit_config.long_break_length != 0
-            && explicit_config.long_break_length != config.long_break_length) {
-        long_break_length = explicit_config.long_break_length;
-        
+    if (explicit_config.timer_clock != TIMER_CLOCK_UNSET) {
+        timer_clock = explicit_config.timer_clock;
     }
-    if (explicit_config.set_count != 0
-            && explicit_config.set_count != config.set_count) {
-        num_sets = explicit_config.set_count;
+    bool low_power = config.low_power || explicit_config.low_power;
+    /* The sub-second display would undo low-power mode, which wins */
+    int fps = explicit_config.fps > 0 ? explicit_config.fps : config.fps;
+    if (low_power) {
+        fps = 0;
     }
-
-    if (explicit_config.pomodoros_per_set != 0
-            && explicit_config.pomodoros_per_set != config.pomodoros_per_set)
-    {
-        pomodoros_per_set = explicit_config.pomodoros_per_set;
+    FRONTEND_KIND frontend = explicit_config.frontend != FRONTEND_UNSET
+            ? explicit_config.frontend : config.frontend != FRONTEND_UNSET
+            ? config.frontend : DEFAULT_FRONTEND;
+    if (headless_mode) {
+        frontend = FRONTEND_HEADLESS;
+        fps = 0;
     }
-
-    if (explicit_config.work_length != 0
-            && explicit_config.work_length != config.work_length) {
-        session_length = explicit_config.work_length;
+    if (daemon_mode) {
+        /* Nothing is drawn; clients count down on their own */
+        frontend = FRONTEND_DAEMON;
+        fps = 0;
+        low_power = false;
     }
+#ifdef POMODORO_NO_CURSES
+    check(frontend != FRONTEND_CURSES,
+            "This build has no curses frontend. Use '--frontend ansi'");
+#endif
+    trace_mark(&trace, "options");
+
+    schedule = Schedule_alloc();
+    check(schedule != NULL, "Failed to allocate schedule");
+    rc = build_schedule(schedule, &config, &explicit_config);
+    check(rc == 0, "Failed to build the day's schedule");
+    trace_mark(&trace, "schedule");
 
     if (do_config_dump) {
         if (use_custom_config_file) {
-            rc = dump_config(&config, config_file);
+            rc = dump_config(&config, live.file, live.profile, config_file);
             check(rc == 0, "dump_config failure");
         } else {
-            rc = dump_config(&config, default_config_path);
+            rc = dump_config(&config, live.file, live.profile,
+                    default_config_path);
             check(rc == 0, "dump_config failure");
         }
         exit(EXIT_SUCCESS);
     }
 
-    int row = 0;
-    int col = 0;
-
-    /* Has initscr been called? (for error-checking and cleanup purposes) */
-    int in_curses_mode = 0;
-
-    initscr(); // start curses mode
-    in_curses_mode = 1;
-    getmaxyx(stdscr, row, col); // get window dimensions
-    check(row >= 10, "Terminal must be >=10 rows tall");
-    cbreak(); // no line-buffered input, but allow signals
-    keypad(stdscr, TRUE);
-    noecho(); // don't echo on getch()
-    curs_set(0); // invisible cursor
+    if (daemon_mode) {
+        daemon_listen_fd = Daemon_listen(socket_path);
+        check(daemon_listen_fd != -1, "Failed to start the daemon");
+        pid_t pid = fork();
+        check(pid != -1, "Failed to fork the daemon");
+        if (pid > 0) {
+            printf("Daemon %d listening on %s\n", (int)pid, socket_path);
+            close(daemon_listen_fd);
+            Schedule_destroy(schedule);
+            Config_destroy(live.file);
+            free(config_file);
+            free(default_config_path);
+            free(checkpoint_path);
+            free(history_path);
+            free(rollup_path);
+            free(socket_path);
+            free(config.schedule);
+            free(explicit_config.schedule);
+            exit(EXIT_SUCCESS);
+        }
+        /* Leave the terminal and its session behind */
+        check(setsid() != -1, "Failed to start a new session");
+        int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+        check(null_fd != -1, "Failed to open /dev/null");
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
 
-    /* #### Window setup #### */
-    /* Status window starts at top-left corner */
-    int status_window_starty = 0;
-    int status_window_startx = 0;
+    signal_fd = open_signal_fd();
+    check(signal_fd != -1, "Failed to set up signal handling");
+    rc = Clock_init_system(&main_clock, timer_clock_id(timer_clock));
+    check(rc == 0, "Failed to select timer clock");
+    timer_fd = timerfd_create(main_clock.id, TFD_NONBLOCK | TFD_CLOEXEC);
+    check(timer_fd != -1, "Failed to create timerfd");
+    trace_mark(&trace, "clock and signals");
 
-    /* Status window stretches all the way from left to right */
-    int status_window_width = col;
     /*
-     * Status window is minimal size for centered messages:
-     *     2 rows for borders
-     *     2 rows for padding
-     *     2 rows for messages:
-     *         1 row for number of current set
-     *         1 row for status message from pomodoro_status()
+     * Start the clock before anything touches the terminal: the timer is
+     * running from here on, however long the frontend takes to come up.
      */
-    int status_window_height = 6;
-
-    status_window = create_window(status_window_height,
-            status_window_width, status_window_starty, status_window_startx);
-    check(status_window != NULL, "Failed to create status window");
-
-    /* Timer window also extends all the way left to right */
-    int timer_window_startx = 0;
-    /* Just stick the timer right under the status window */
-    int timer_window_starty = status_window_starty + status_window_height;
-
-    int timer_window_width = col;
-    /* Timer window takes up whatever rows are left from the status window */
-    int timer_window_height = row - status_window_height;
-
-    timer_window = create_window(timer_window_height,
-            timer_window_width, timer_window_starty, timer_window_startx);
-    check(timer_window != NULL, "Failed to create timer window");
-
-
-    char *welcome_msg = "Welcome to pomodoro_curses";
-    mvwprintw(status_window,
-            ((status_window_startx + status_window_height) / 2) - 1,
-            (status_window_width-strlen(welcome_msg)) / 2, "%s", welcome_msg);
-    wrefresh(status_window);
-    sleep(2);
-    wclear(status_window);
-    wrefresh(status_window);
-
     pomodoro_timer = Timer_alloc();
     check(pomodoro_timer != NULL, "Failed to allocate main pomodoro timer.");
+    rc = Timer_set_clock(pomodoro_timer, &main_clock);
+    check(rc == 0, "Failed to set timer clock");
+    Pomodoro day;
+    rc = Pomodoro_init(&day, schedule);
+    check(rc == 0, "Bad pomodoro schedule");
+    if (resume) {
+        check(resume_from.schedule_hash == Schedule_hash(schedule),
+                "The schedule has changed since the checkpoint was saved");
+        int64_t now = Timer_now(pomodoro_timer);
+        int64_t left = resume_from.paused ? resume_from.remaining_ns
+                : resume_from.deadline_ns - wall_clock_ns();
+        rc = Pomodoro_restore(&day, resume_from.phase_index, now + left, now,
+                resume_from.paused);
+        check(rc == 0, "Failed to resume from the checkpoint");
+    }
+    trace_mark(&trace, "timer running");
+
+    live.default_path = default_config_path;
+    live.custom_path = config_file;
+    live.explicit_config = &explicit_config;
+    live.schedule = &schedule;
+    live.alert_type = alert_type;
+    /* An attached client runs no day of its own; the daemon does that */
+    if (!attach) {
+        rc = watch_config(&live, config_file != NULL ? config_file
+                : default_config_path);
+        if (rc != 0) {
+            log_warn("Config file changes will need a restart to take "
+                    "effect");
+        }
+        trace_mark(&trace, "config watch");
+        rc = History_open(&history, history_path);
+        if (rc != 0) {
+            log_warn("Sessions will not be recorded");
+        }
+        trace_mark(&trace, "history log");
+    }
 
-    for (int i = 1; i <= num_sets; i++) {
-        rc = do_pomodoro_set(pomodoro_timer, session_length, short_break_length,
-                long_break_length, pomodoros_per_set, status_window,
-                timer_window, i, alert_type);
-        check(rc == 0, "Pomodoro set error");
-        rc = alert_user(alert_type);
-        check(rc == OK, "Could not beep after set");
+    /*
+     * The terminal answers on stdin, so ask before a frontend takes it over
+     * and starts reading keys from it
+     */
+    bool sync_output = false;
+    if (fps > 0) {
+        sync_output = Frontend_probe_sync_output(STDIN_FILENO,
+                STDOUT_FILENO);
+        trace_mark(&trace, "sync output probe");
     }
 
-    getch();
+    /* #### Window setup #### */
+    if (frontend == FRONTEND_HEADLESS) {
+        rc = Headless_init(&headless, STDOUT_FILENO, headless_format);
+        check(rc == 0, "Failed to set up headless output");
+        fe = &headless.base;
+        fe->tick = tick;
+    } else if (frontend == FRONTEND_DAEMON) {
+        rc = Daemon_init(&server, daemon_listen_fd, socket_path,
+                pomodoro_timer);
+        daemon_listen_fd = -1;
+        check(rc == 0, "Failed to set up the daemon");
+        fe = &server.base;
+    } else if (frontend == FRONTEND_ANSI) {
+        rc = Ansi_init(&ansi, STDIN_FILENO, STDOUT_FILENO);
+        check(rc == 0, "Failed to set up the terminal");
+        fe = &ansi.base;
+    }
+#ifndef POMODORO_NO_CURSES
+    else {
+        initscr(); // start curses mode
+        cbreak(); // no line-buffered input, but allow signals
+        keypad(stdscr, TRUE);
+        noecho(); // don't echo on getch()
+        curs_set(0); // invisible cursor
+        fe = &ui.base;
+        rc = Ui_init(&ui);
+        check(rc == 0, "Failed to lay out windows");
+    }
+#endif
+    fe->low_power = low_power;
+    fe->fps = fps;
+    fe->sync_output = sync_output;
+    trace_mark(&trace, "frontend");
+
+    /* Left until the first frame is up; nothing needs these to draw it */
+    deferred_setup setup = {
+        .splash = frontend == FRONTEND_HEADLESS
+                || frontend == FRONTEND_DAEMON
+                ? NULL : "Welcome to pomodoro_curses",
+        .timer_slack = low_power,
+        .history_path = history_path,
+        .compact_after = attach ? 0 : config.compact_after,
+        .trace = &trace
+    };
+    long wakeups = 0;
+    int64_t day_start = Clock_now(&main_clock);
+    day_records records = {
+        .checkpoint = checkpoint_path,
+        .history = history.fd != -1 ? &history : NULL,
+        .history_path = history_path,
+        .rollup_path = rollup_path
+    };
+    if (attach) {
+        rc = run_attached(pomodoro_timer, fe, attach_fd, timer_fd, signal_fd,
+                &setup);
+        check(rc == 0, "Lost the daemon");
+    } else {
+        rc = run_pomodoro_day(pomodoro_timer, &day, fe, alert_type, timer_fd,
+                signal_fd, &live, &setup, &records, &wakeups);
+        check(rc == 0, "Pomodoro set error");
+    }
+    int64_t day_length = Clock_now(&main_clock) - day_start;
 
     Timer_destroy(pomodoro_timer);
     pomodoro_timer = NULL;
-    destroy_win(status_window);
-    destroy_win(timer_window);
-    endwin();
-    in_curses_mode = 0;
+    Schedule_destroy(schedule);
+    schedule = NULL;
+    close(timer_fd);
+    close(signal_fd);
+    if (live.fd != -1) {
+        close(live.fd);
+    }
+    Config_destroy(live.file);
+    History_close(&history);
+    if (attach_fd != -1) {
+        close(attach_fd);
+    }
+    if (frontend == FRONTEND_DAEMON) {
+        Daemon_destroy(&server);
+    } else if (frontend == FRONTEND_ANSI) {
+        Ansi_destroy(&ansi);
+    }
+#ifndef POMODORO_NO_CURSES
+    else if (frontend == FRONTEND_CURSES) {
+        Ui_destroy(&ui);
+        endwin();
+    }
+#endif
+    fe = NULL;
+    if (low_power && day_length > 0) {
+        /* Keep stdout to the events when headless */
+        fprintf(frontend == FRONTEND_HEADLESS ? stderr : stdout,
+                "%ld wakeups in %lld s (%.1f per hour)\n", wakeups,
+                (long long)(day_length / NSEC_PER_SEC),
+                (double)wakeups * SECONDS_PER_MINUTE * MINUTES_PER_HOUR
+                * NSEC_PER_SEC / day_length);
+    }
+    trace_print(&trace, stderr);
     free(config_file);
     config_file = NULL;
+    free(default_config_path);
+    free(checkpoint_path);
+    free(history_path);
+    free(rollup_path);
+    free(socket_path);
+    free(config.schedule);
+    free(explicit_config.schedule);
 
     return 0;
 error:
     if (config_file != NULL) {
         free(config_file); // needed because this string came from strndup()
     }
+    free(default_config_path);
+    free(checkpoint_path);
+    free(history_path);
+    free(rollup_path);
+    free(config.schedule);
+    free(explicit_config.schedule);
+    if (daemon_listen_fd != -1) {
+        close(daemon_listen_fd);
+    }
+    if (attach_fd != -1) {
+        close(attach_fd);
+    }
+    /* Before the socket path goes */
+    Daemon_destroy(&server);
+    free(socket_path);
+    if (schedule != NULL) {
+        Schedule_destroy(schedule);
+    }
     if (pomodoro_timer != NULL) {
         Timer_destroy(pomodoro_timer);
         pomodoro_timer = NULL;
     }
-    if (status_window != NULL) {
-        destroy_win(status_window);
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (live.fd != -1) {
+        close(live.fd);
     }
-    if (timer_window != NULL) {
-        destroy_win(timer_window);
+    Config_destroy(live.file);
+    History_close(&history);
+    if (fe == &ansi.base) {
+        Ansi_destroy(&ansi);
     }
-    if (in_curses_mode) {
+#ifndef POMODORO_NO_CURSES
+    else if (fe == &ui.base) {
+        Ui_destroy(&ui);
         endwin();
     }
+#endif
     return -1;
 }
@@ -1,21 +1,170 @@
+// For clock_gettime(2) and clock_nanosleep(2)
+#include <errno.h>
+#include <time.h>
 // For malloc suite
 #include <stdlib.h>
-// For sleep(3)
-#include <unistd.h>
+// For strcmp(3)
+#include <string.h>
 
 #include "dbg.h"
 #include "pomodoro.h"
 
+/* Length of one tick, in nanoseconds */
+static const int64_t PULSE_NS = TIMER_PULSE * NSEC_PER_SEC;
+
+/*
+ * Display steps for Timer_coarse_step, in seconds: the step to use while
+ * more than `above` seconds are left. Checked in order.
+ */
+static const struct {
+    int above;
+    int step;
+} COARSE_STEPS[] = {
+    { 10 * SECONDS_PER_MINUTE, 5 * SECONDS_PER_MINUTE },
+    { SECONDS_PER_MINUTE, SECONDS_PER_MINUTE },
+    { 0, 10 }
+};
+
+/*
+ * Read a system clock.
+ */
+static int64_t system_now(Clock *c) {
+    struct timespec ts;
+    clock_gettime(c->id, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Sleep on a system clock, resuming after signal interruptions.
+ */
+static int system_sleep_until(Clock *c, int64_t when_ns) {
+    struct timespec ts = { .tv_sec = when_ns / NSEC_PER_SEC,
+            .tv_nsec = when_ns % NSEC_PER_SEC };
+    int rc = 0;
+    while ((rc = clock_nanosleep(c->id, TIMER_ABSTIME, &ts, NULL))
+            == EINTR);
+    check(rc == 0, "clock_nanosleep failed: %s", strerror(rc));
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Read a virtual clock.
+ */
+static int64_t virtual_now(Clock *c) {
+    return c->virtual_ns;
+}
+
+/*
+ * Sleeping on a virtual clock just moves it to the wake-up time.
+ */
+static int virtual_sleep_until(Clock *c, int64_t when_ns) {
+    if (when_ns > c->virtual_ns) {
+        c->virtual_ns = when_ns;
+    }
+    return 0;
+}
+
+/* Clock for Timers that have not been given one */
+static Clock default_clock = { .now = system_now,
+        .sleep_until = system_sleep_until, .id = CLOCK_MONOTONIC,
+        .virtual_ns = 0 };
+
+int Clock_init_system(Clock *c, clockid_t id) {
+    check(c != NULL, "Got NULL Clock pointer.");
+    check(id == CLOCK_MONOTONIC || id == CLOCK_BOOTTIME
+            || id == CLOCK_REALTIME, "Unsupported clock id %d", (int)id);
+    c->now = system_now;
+    c->sleep_until = system_sleep_until;
+    c->id = id;
+    c->virtual_ns = 0;
+
+    return 0;
+error:
+    return -1;
+}
+
+int Clock_init_virtual(Clock *c, int64_t start_ns) {
+    check(c != NULL, "Got NULL Clock pointer.");
+    check(start_ns >= 0, "Virtual clock cannot start before 0");
+    c->now = virtual_now;
+    c->sleep_until = virtual_sleep_until;
+    c->id = CLOCK_VIRTUAL;
+    c->virtual_ns = start_ns;
+
+    return 0;
+error:
+    return -1;
+}
+
+int Clock_advance(Clock *c, int64_t delta_ns) {
+    check(c != NULL, "Got NULL Clock pointer.");
+    check(c->id == CLOCK_VIRTUAL, "Only virtual clocks can be advanced");
+    check(delta_ns >= 0, "Cannot move a clock backwards");
+    c->virtual_ns += delta_ns;
+
+    return 0;
+error:
+    return -1;
+}
+
+int64_t Clock_now(Clock *c) {
+    check(c != NULL, "Got NULL Clock pointer.");
+    return c->now(c);
+error:
+    return -1;
+}
+
+int Clock_sleep_until(Clock *c, int64_t when_ns) {
+    check(c != NULL, "Got NULL Clock pointer.");
+    return c->sleep_until(c, when_ns);
+error:
+    return -1;
+}
+
+/*
+ * Whole pulses left before a deadline, rounded up and never negative.
+ */
+static int pulses_left(int64_t deadline_ns, int64_t now_ns) {
+    int64_t left = deadline_ns - now_ns;
+    if (left <= 0) {
+        return 0;
+    }
+    return (int)((left + PULSE_NS - 1) / PULSE_NS) * TIMER_PULSE;
+}
+
 Timer *Timer_alloc() {
     Timer *t = malloc(sizeof(Timer));
 
     check(t != NULL, "Timer allocation failed.");
+    t->seconds = 0;
+    t->deadline_ns = 0;
+    t->clock = &default_clock;
 
     return t;
 error:
     return NULL;
 }
 
+int Timer_set_clock(Timer *t, Clock *clock) {
+    check(t != NULL, "Got NULL Timer pointer.");
+    check(clock != NULL, "Got NULL Clock pointer.");
+    t->clock = clock;
+
+    return 0;
+error:
+    return -1;
+}
+
+int64_t Timer_now(Timer *t) {
+    check(t != NULL, "Got NULL Timer pointer.");
+    return Clock_now(t->clock);
+error:
+    return -1;
+}
+
 int Timer_set(Timer *t, int hours, int minutes, int seconds) {
     check(t != NULL, "Got NULL Timer pointer.");
     check(hours >= 0, "Cannot have negative 'hours' value '%d'.", hours);
@@ -28,6 +177,8 @@ int Timer_set(Timer *t, int hours, int minutes, int seconds) {
             + (SECONDS_PER_MINUTE * minutes)
             + seconds;
     t->seconds = total_seconds;
+    t->deadline_ns = Clock_now(t->clock)
+            + (int64_t)total_seconds * NSEC_PER_SEC;
     
     check(t->seconds == total_seconds,
             "Seconds not set correctly. Expected %d, got %d", seconds,
@@ -38,6 +189,16 @@ error:
     return -1;
 }
 
+int Timer_set_deadline(Timer *t, int64_t deadline_ns) {
+    check(t != NULL, "Got NULL Timer pointer.");
+    t->deadline_ns = deadline_ns;
+    t->seconds = pulses_left(deadline_ns, Clock_now(t->clock));
+
+    return 0;
+error:
+    return -1;
+}
+
 void Timer_destroy(Timer *t) {
     check(t != NULL, "Got NULL Timer pointer.");
     free(t);
@@ -52,10 +213,813 @@ int Timer_tick(Timer *t) {
             t->seconds / (SECONDS_PER_MINUTE * MINUTES_PER_HOUR),
             t->seconds / SECONDS_PER_MINUTE,
             t->seconds);
-    sleep(TIMER_PULSE);
-    t->seconds--;
-    
+    if (t->seconds == 0) {
+        return -1;
+    }
+
+    /* Wake on the next pulse boundary measured back from the deadline */
+    int rc = Clock_sleep_until(t->clock, Timer_next_tick(t));
+    check(rc == 0, "Failed to wait for next tick");
+    /*
+     * Recomputing from the clock also covers a suspend: on a clock that keeps
+     * counting while suspended, the timer lands straight on the right value
+     * (or on 0) instead of resuming where it stopped.
+     */
+    t->seconds = pulses_left(t->deadline_ns, Clock_now(t->clock));
+
+    return t->seconds;
+error:
+    return -1;
+}
+
+int Timer_update(Timer *t) {
+    check(t != NULL, "Got NULL Timer pointer");
+    t->seconds = pulses_left(t->deadline_ns, Clock_now(t->clock));
+
     return t->seconds;
 error:
     return -1;
 }
+
+int64_t Timer_next_tick(Timer *t) {
+    return Timer_next_change(t, TIMER_PULSE);
+}
+
+int64_t Timer_next_change(Timer *t, int step) {
+    check(t != NULL, "Got NULL Timer pointer");
+    check(step > 0, "Display step must be greater than 0, got %d", step);
+    int64_t step_ns = step * NSEC_PER_SEC;
+    int64_t left = t->deadline_ns - Clock_now(t->clock);
+    if (left <= 0) {
+        return t->deadline_ns;
+    }
+
+    return t->deadline_ns - ((left - 1) / step_ns) * step_ns;
+error:
+    return -1;
+}
+
+int64_t Timer_next_frame(Timer *t, int64_t step_ns, int fps) {
+    check(t != NULL, "Got NULL Timer pointer");
+    check(step_ns > 0, "Display step must be greater than 0");
+    check(fps > 0, "Frame rate must be greater than 0, got %d", fps);
+    int64_t now = Clock_now(t->clock);
+    int64_t left = t->deadline_ns - now;
+    if (left <= 0) {
+        return t->deadline_ns;
+    }
+
+    int64_t change = t->deadline_ns - ((left - 1) / step_ns) * step_ns;
+    if (change == t->deadline_ns) {
+        return change;
+    }
+    /*
+     * The first frame slot that shows the change. It is always after now,
+     * and so at least a whole slot after the frame being drawn.
+     */
+    int64_t frame_ns = NSEC_PER_SEC / fps;
+    int64_t frame = (change + frame_ns - 1) / frame_ns * frame_ns;
+
+    return frame < t->deadline_ns ? frame : t->deadline_ns;
+error:
+    return -1;
+}
+
+int Timer_coarse_step(Timer *t) {
+    check(t != NULL, "Got NULL Timer pointer");
+    for (size_t i = 0; i < sizeof(COARSE_STEPS) / sizeof(COARSE_STEPS[0]);
+            i++) {
+        if (t->seconds > COARSE_STEPS[i].above) {
+            return COARSE_STEPS[i].step;
+        }
+    }
+
+    return TIMER_PULSE;
+error:
+    return -1;
+}
+
+/*
+ * Make room in a TimerSet's pool for at least n timers, chaining the new
+ * slots onto the free list.
+ */
+static int timerset_reserve(TimerSet *s, int64_t n) {
+    check(n <= TIMERSET_MAX, "TimerSet larger than %d timers", TIMERSET_MAX);
+    if (n <= s->capacity) {
+        return 0;
+    }
+    int capacity = s->capacity > 0 ? s->capacity : 16;
+    while (capacity < n) {
+        capacity *= 2;
+    }
+    TimerSlot *slots = realloc(s->slots, capacity * sizeof(TimerSlot));
+    check_mem(slots);
+    s->slots = slots;
+    int *heap = realloc(s->heap, capacity * sizeof(int));
+    check_mem(heap);
+    s->heap = heap;
+    for (int i = capacity - 1; i >= s->capacity; i--) {
+        s->slots[i].heap_index = -1;
+        s->slots[i].next_free = s->free_head;
+        s->slots[i].data = NULL;
+        s->free_head = i;
+    }
+    s->capacity = capacity;
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Whether id names a timer that is in use */
+static int timerset_valid(TimerSet *s, int id) {
+    return id >= 0 && id < s->capacity
+            && s->slots[id].next_free == TIMERSET_IN_USE;
+}
+
+/* Put a timer at a place in the heap and tell it where it is */
+static void heap_place(TimerSet *s, int i, int id) {
+    s->heap[i] = id;
+    s->slots[id].heap_index = i;
+}
+
+/* Move the timer at heap place i up past any later parents */
+static void heap_up(TimerSet *s, int i) {
+    int id = s->heap[i];
+    int64_t deadline = s->slots[id].deadline_ns;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (s->slots[s->heap[parent]].deadline_ns <= deadline) {
+            break;
+        }
+        heap_place(s, i, s->heap[parent]);
+        i = parent;
+    }
+    heap_place(s, i, id);
+}
+
+/* Move the timer at heap place i down past any earlier children */
+static void heap_down(TimerSet *s, int i) {
+    int id = s->heap[i];
+    int64_t deadline = s->slots[id].deadline_ns;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->heap_len) {
+            break;
+        }
+        if (child + 1 < s->heap_len && s->slots[s->heap[child + 1]].deadline_ns
+                < s->slots[s->heap[child]].deadline_ns) {
+            child++;
+        }
+        if (deadline <= s->slots[s->heap[child]].deadline_ns) {
+            break;
+        }
+        heap_place(s, i, s->heap[child]);
+        i = child;
+    }
+    heap_place(s, i, id);
+}
+
+int TimerSet_init(TimerSet *s, Clock *clock, int capacity) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    check(clock != NULL, "Got NULL Clock pointer.");
+    s->clock = clock;
+    s->slots = NULL;
+    s->capacity = 0;
+    s->free_head = -1;
+    s->count = 0;
+    s->heap = NULL;
+    s->heap_len = 0;
+    int rc = timerset_reserve(s, capacity);
+    check(rc == 0, "Could not make room for %d timers", capacity);
+
+    return 0;
+error:
+    return -1;
+}
+
+void TimerSet_destroy(TimerSet *s) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    free(s->slots);
+    free(s->heap);
+    s->slots = NULL;
+    s->heap = NULL;
+    s->capacity = 0;
+    s->free_head = -1;
+    s->count = 0;
+    s->heap_len = 0;
+error:
+    return;
+}
+
+int TimerSet_add(TimerSet *s, void *data) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    if (s->free_head == -1) {
+        int rc = timerset_reserve(s, (int64_t)s->capacity + 1);
+        check(rc == 0, "Could not grow TimerSet");
+    }
+    int id = s->free_head;
+    s->free_head = s->slots[id].next_free;
+    s->slots[id].next_free = TIMERSET_IN_USE;
+    s->slots[id].heap_index = -1;
+    s->slots[id].deadline_ns = 0;
+    s->slots[id].data = data;
+    s->count++;
+
+    return id;
+error:
+    return -1;
+}
+
+int TimerSet_remove(TimerSet *s, int id) {
+    int rc = TimerSet_cancel(s, id);
+    check(rc == 0, "Bad timer %d", id);
+    s->slots[id].data = NULL;
+    s->slots[id].next_free = s->free_head;
+    s->free_head = id;
+    s->count--;
+
+    return 0;
+error:
+    return -1;
+}
+
+int TimerSet_arm(TimerSet *s, int id, int64_t deadline_ns) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    check(timerset_valid(s, id), "Bad timer %d", id);
+    TimerSlot *slot = &s->slots[id];
+    int64_t old = slot->deadline_ns;
+    slot->deadline_ns = deadline_ns;
+    if (slot->heap_index == -1) {
+        heap_place(s, s->heap_len++, id);
+        heap_up(s, slot->heap_index);
+    } else if (deadline_ns < old) {
+        heap_up(s, slot->heap_index);
+    } else {
+        heap_down(s, slot->heap_index);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int TimerSet_cancel(TimerSet *s, int id) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    check(timerset_valid(s, id), "Bad timer %d", id);
+    int i = s->slots[id].heap_index;
+    if (i == -1) {
+        return 0;
+    }
+    s->slots[id].heap_index = -1;
+    s->heap_len--;
+    if (i < s->heap_len) {
+        /* Fill the hole with the last timer and let it find its place */
+        int last = s->heap[s->heap_len];
+        heap_place(s, i, last);
+        if (i > 0 && s->slots[last].deadline_ns
+                < s->slots[s->heap[(i - 1) / 2]].deadline_ns) {
+            heap_up(s, i);
+        } else {
+            heap_down(s, i);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+void *TimerSet_data(TimerSet *s, int id) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    check(timerset_valid(s, id), "Bad timer %d", id);
+    return s->slots[id].data;
+error:
+    return NULL;
+}
+
+int64_t TimerSet_next_deadline(TimerSet *s) {
+    if (s == NULL || s->heap_len == 0) {
+        return TIMERSET_NEVER;
+    }
+    return s->slots[s->heap[0]].deadline_ns;
+}
+
+int TimerSet_expire(TimerSet *s, int64_t now, int *expired, int max) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    check(expired != NULL || max == 0, "Got NULL expired pointer.");
+    int count = 0;
+    while (count < max && s->heap_len > 0
+            && s->slots[s->heap[0]].deadline_ns <= now) {
+        int id = s->heap[0];
+        TimerSet_cancel(s, id);
+        expired[count++] = id;
+    }
+
+    return count;
+error:
+    return -1;
+}
+
+int TimerSet_wait(TimerSet *s, int *expired, int max) {
+    check(s != NULL, "Got NULL TimerSet pointer.");
+    int64_t next = TimerSet_next_deadline(s);
+    if (next == TIMERSET_NEVER) {
+        return 0;
+    }
+    int rc = Clock_sleep_until(s->clock, next);
+    check(rc == 0, "Failed to wait for the next deadline");
+
+    return TimerSet_expire(s, Clock_now(s->clock), expired, max);
+error:
+    return -1;
+}
+
+/* Short names of the phases, indexed by STATE */
+static const char *STATE_NAMES[] = {
+    [POMODORO_WORK] = "work",
+    [POMODORO_SHORT_REST] = "short_break",
+    [POMODORO_LONG_REST] = "long_break",
+    [POMODORO_DONE] = "done"
+};
+
+#define STATE_COUNT (int)(sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0]))
+
+const char *Pomodoro_state_name(STATE state) {
+    if (state < 0 || state >= STATE_COUNT) {
+        return "error";
+    }
+    return STATE_NAMES[state];
+}
+
+STATE Pomodoro_state_parse(const char *name) {
+    for (int i = 0; name != NULL && i < STATE_COUNT; i++) {
+        if (strcmp(name, STATE_NAMES[i]) == 0) {
+            return (STATE)i;
+        }
+    }
+    return POMODORO_ERROR;
+}
+
+Schedule *Schedule_alloc() {
+    Schedule *s = malloc(sizeof(Schedule));
+    check(s != NULL, "Schedule allocation failed.");
+    s->count = 0;
+    s->capacity = 0;
+    s->phases = NULL;
+
+    return s;
+error:
+    return NULL;
+}
+
+void Schedule_destroy(Schedule *s) {
+    check(s != NULL, "Got NULL Schedule pointer.");
+    free(s->phases);
+    free(s);
+error:
+    return;
+}
+
+/*
+ * Make room for at least n phases in a Schedule.
+ */
+static int schedule_reserve(Schedule *s, int64_t n) {
+    check(n <= SCHEDULE_MAX_PHASES, "Schedule longer than %d phases",
+            SCHEDULE_MAX_PHASES);
+    if (n <= s->capacity) {
+        return 0;
+    }
+    int capacity = s->capacity > 0 ? s->capacity : 16;
+    while (capacity < n) {
+        capacity *= 2;
+    }
+    SchedulePhase *phases = realloc(s->phases,
+            capacity * sizeof(SchedulePhase));
+    check_mem(phases);
+    s->phases = phases;
+    s->capacity = capacity;
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Append a phase to a Schedule. Until schedule_finish runs, end holds the
+ * phase's own length rather than its cumulative offset.
+ */
+static int schedule_push(Schedule *s, STATE state, int64_t length) {
+    int rc = schedule_reserve(s, (int64_t)s->count + 1);
+    check(rc == 0, "Could not grow schedule");
+    s->phases[s->count].state = state;
+    s->phases[s->count].set_num = 0;
+    s->phases[s->count].end = length;
+    s->count++;
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Turn phase lengths into cumulative end offsets and number the sets.
+ */
+static int schedule_finish(Schedule *s) {
+    check(s->count > 0, "Schedule has no phases");
+    int64_t end = 0;
+    int set_num = 1;
+    for (int i = 0; i < s->count; i++) {
+        end += s->phases[i].end;
+        check(end <= SCHEDULE_MAX_SECONDS, "Schedule longer than %lld s",
+                (long long)SCHEDULE_MAX_SECONDS);
+        s->phases[i].end = end;
+        s->phases[i].set_num = set_num;
+        if (s->phases[i].state == POMODORO_LONG_REST) {
+            set_num++;
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Schedule_from_sets(Schedule *s, int work_len, int short_b_len,
+        int long_b_len, int sessions_per_set, int num_sets) {
+    check(s != NULL, "Got NULL Schedule pointer.");
+    check(work_len > 0 && short_b_len >= 0 && long_b_len >= 0,
+            "Bad phase lengths %d/%d/%d", work_len, short_b_len, long_b_len);
+    check(sessions_per_set > 0, "Need at least one session per set");
+    check(num_sets > 0, "Need at least one set");
+    int rc = schedule_reserve(s, (int64_t)num_sets
+            * (2 * (int64_t)sessions_per_set + 1));
+    check(rc == 0, "Could not size schedule");
+
+    s->count = 0;
+    for (int set = 0; set < num_sets; set++) {
+        for (int i = 0; i < sessions_per_set; i++) {
+            schedule_push(s, POMODORO_WORK, work_len);
+            if (short_b_len > 0) {
+                schedule_push(s, POMODORO_SHORT_REST, short_b_len);
+            }
+        }
+        if (long_b_len > 0) {
+            schedule_push(s, POMODORO_LONG_REST, long_b_len);
+        }
+    }
+
+    return schedule_finish(s);
+error:
+    return -1;
+}
+
+/* Deepest nesting of groups allowed in a schedule description */
+static const int MAX_SPEC_DEPTH = 16;
+
+static const char *skip_separators(const char *cur) {
+    while (*cur == ' ' || *cur == '\t' || *cur == ',') {
+        cur++;
+    }
+    return cur;
+}
+
+/*
+ * Read a positive decimal number from a schedule description.
+ *
+ * Returns: the number, or -1 if there isn't one or it is out of range
+ */
+static long read_count(const char **cur) {
+    char *end = NULL;
+    errno = 0;
+    long n = strtol(*cur, &end, 10);
+    check(end != *cur && errno == 0 && n > 0 && n <= SCHEDULE_MAX_PHASES,
+            "Expected a positive number at '%s'", *cur);
+    *cur = end;
+
+    return n;
+error:
+    return -1;
+}
+
+/*
+ * Compile a list of items up to a closing parenthesis or the end of the
+ * description, appending them to s.
+ */
+static int compile_items(Schedule *s, const char **cur, int depth) {
+    check(depth <= MAX_SPEC_DEPTH, "Schedule nested too deeply");
+    for (*cur = skip_separators(*cur); **cur != '\0' && **cur != ')';
+            *cur = skip_separators(*cur)) {
+        long repeat = 1;
+        if (**cur >= '0' && **cur <= '9') {
+            repeat = read_count(cur);
+            check(repeat != -1, "Bad repeat count");
+            *cur = skip_separators(*cur);
+            check(**cur == '*', "Expected '*' after repeat count at '%s'",
+                    *cur);
+            *cur = skip_separators(*cur + 1);
+        }
+
+        int first = s->count;
+        if (**cur == '(') {
+            (*cur)++;
+            int rc = compile_items(s, cur, depth + 1);
+            check(rc == 0, "Bad group in schedule");
+            check(**cur == ')', "Unclosed '(' in schedule");
+            (*cur)++;
+        } else {
+            STATE state = POMODORO_ERROR;
+            switch (**cur) {
+                case 'w':
+                    state = POMODORO_WORK;
+                    break;
+                case 's':
+                    state = POMODORO_SHORT_REST;
+                    break;
+                case 'l':
+                    state = POMODORO_LONG_REST;
+                    break;
+                default:
+                    sentinel("Unknown phase type at '%s'. Use w, s or l",
+                            *cur);
+            }
+            (*cur)++;
+            long minutes = read_count(cur);
+            check(minutes != -1, "Bad phase length");
+            int rc = schedule_push(s, state, minutes * SECONDS_PER_MINUTE);
+            check(rc == 0, "Could not add phase");
+        }
+
+        /* Expand the repeat by copying the item's phases */
+        int item_len = s->count - first;
+        int rc = schedule_reserve(s, (int64_t)first + item_len * repeat);
+        check(rc == 0, "Schedule too long");
+        for (long r = 1; r < repeat; r++) {
+            memcpy(&s->phases[s->count], &s->phases[first],
+                    item_len * sizeof(SchedulePhase));
+            s->count += item_len;
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Schedule_compile(Schedule *s, const char *spec) {
+    check(s != NULL, "Got NULL Schedule pointer.");
+    check(spec != NULL, "Got NULL schedule description.");
+    s->count = 0;
+    const char *cur = spec;
+    int rc = compile_items(s, &cur, 0);
+    check(rc == 0, "Could not compile schedule '%s'", spec);
+    check(*cur == '\0', "Unmatched ')' in schedule '%s'", spec);
+
+    return schedule_finish(s);
+error:
+    if (s != NULL) {
+        s->count = 0;
+    }
+    return -1;
+}
+
+/*
+ * Fill in a position from a phase index, which may be one past the end.
+ */
+static void schedule_position(const Schedule *s, int i,
+        PomodoroPosition *pos) {
+    pos->phase_index = i;
+    if (i >= s->count) {
+        pos->state = POMODORO_DONE;
+        pos->set_num = s->phases[s->count - 1].set_num;
+        pos->phase_end = s->phases[s->count - 1].end;
+    } else {
+        pos->state = s->phases[i].state;
+        pos->set_num = s->phases[i].set_num;
+        pos->phase_end = s->phases[i].end;
+    }
+}
+
+int Schedule_locate(const Schedule *s, int64_t elapsed, PomodoroPosition *pos) {
+    check(s != NULL, "Got NULL Schedule pointer.");
+    check(pos != NULL, "Got NULL PomodoroPosition pointer.");
+    check(s->count > 0, "Schedule has no phases");
+    check(elapsed >= 0, "Elapsed time cannot be negative");
+
+    /* First phase that ends after elapsed */
+    int lo = 0;
+    int hi = s->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (s->phases[mid].end > elapsed) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    schedule_position(s, lo, pos);
+
+    return 0;
+error:
+    return -1;
+}
+
+int64_t Schedule_length(const Schedule *s) {
+    check(s != NULL, "Got NULL Schedule pointer.");
+    check(s->count > 0, "Schedule has no phases");
+    return s->phases[s->count - 1].end;
+error:
+    return -1;
+}
+
+uint64_t Schedule_hash(const Schedule *s) {
+    check(s != NULL, "Got NULL Schedule pointer.");
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < s->count; i++) {
+        /* Lengths follow from the ends, and set numbers from the states */
+        uint64_t words[2] = { (uint64_t)s->phases[i].state,
+                (uint64_t)s->phases[i].end };
+        for (int w = 0; w < 2; w++) {
+            for (int b = 0; b < 8; b++) {
+                hash ^= (words[w] >> (8 * b)) & 0xff;
+                hash *= 0x100000001b3ULL;
+            }
+        }
+    }
+
+    return hash;
+error:
+    return 0;
+}
+
+int Pomodoro_init(Pomodoro *p, const Schedule *schedule) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    check(schedule != NULL && schedule->count > 0,
+            "Need a schedule with at least one phase");
+
+    p->schedule = schedule;
+    p->day_start = 0;
+    p->paused_at = -1;
+    p->deadline = 0;
+    p->pos.state = POMODORO_WORK;
+    p->pos.set_num = 1;
+    p->pos.phase_index = -1;
+    p->pos.phase_end = 0;
+    p->missed = 0;
+    p->started = 0;
+
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Move a day onto whichever phase is current at now.
+ *
+ * Returns: POMODORO_EVENT flags for the move, or -1 on failure
+ */
+static int relocate(Pomodoro *p, int64_t now) {
+    const Schedule *s = p->schedule;
+    int last_phase = p->pos.phase_index;
+    int64_t elapsed = (now - p->day_start) / NSEC_PER_SEC;
+    int next = last_phase + 1;
+    if (next < s->count && elapsed >= p->pos.phase_end
+            && elapsed < s->phases[next].end) {
+        /* The usual case: straight on to the following phase */
+        schedule_position(s, next, &p->pos);
+    } else {
+        int rc = Schedule_locate(s, elapsed, &p->pos);
+        check(rc == 0, "Could not locate current phase");
+    }
+    p->deadline = p->day_start + p->pos.phase_end * NSEC_PER_SEC;
+
+    int events = POMODORO_EV_NONE;
+    if (p->pos.phase_index == last_phase) {
+        return events;
+    }
+    if (last_phase >= 0) {
+        events |= POMODORO_EV_PHASE_END;
+    }
+    if (p->pos.phase_index > last_phase + 1) {
+        p->missed += p->pos.phase_index - last_phase - 1;
+        events |= POMODORO_EV_MISSED;
+    }
+    events |= p->pos.state == POMODORO_DONE
+            ? POMODORO_EV_DONE : POMODORO_EV_PHASE_START;
+
+    return events;
+error:
+    return -1;
+}
+
+int Pomodoro_step(Pomodoro *p, int64_t now, PomodoroStatus *status) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    check(status != NULL, "Got NULL PomodoroStatus pointer.");
+
+    int events = POMODORO_EV_NONE;
+    if (!p->started) {
+        p->started = 1;
+        p->day_start = now;
+        events = relocate(p, now);
+    } else if (p->paused_at == -1 && now >= p->deadline
+            && p->pos.state != POMODORO_DONE) {
+        events = relocate(p, now);
+    }
+    check(events != -1, "Failed to advance the day");
+
+    status->state = p->pos.state;
+    status->set_num = p->pos.set_num;
+    status->phase_index = p->pos.phase_index;
+    status->deadline_ns = p->deadline;
+    status->remaining_ns = p->deadline - (p->paused_at == -1 ? now
+            : p->paused_at);
+    if (status->remaining_ns < 0 || p->pos.state == POMODORO_DONE) {
+        status->remaining_ns = 0;
+    }
+    status->events = events;
+    status->missed = p->missed;
+    status->paused = p->paused_at != -1;
+
+    return 0;
+error:
+    return -1;
+}
+
+int Pomodoro_restore(Pomodoro *p, int phase_index, int64_t deadline,
+        int64_t now, int paused) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    check(!p->started, "Can only restore a day that has not started");
+    check(phase_index >= 0 && phase_index < p->schedule->count,
+            "No phase %d in the schedule", phase_index);
+
+    schedule_position(p->schedule, phase_index, &p->pos);
+    p->started = 1;
+    p->day_start = deadline - p->pos.phase_end * NSEC_PER_SEC;
+    p->deadline = deadline;
+    p->paused_at = paused ? now : -1;
+
+    return 0;
+error:
+    return -1;
+}
+
+int Pomodoro_pause(Pomodoro *p, int64_t now) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    if (p->paused_at == -1) {
+        p->paused_at = now;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Pomodoro_resume(Pomodoro *p, int64_t now) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    if (p->paused_at != -1) {
+        p->day_start += now - p->paused_at;
+        p->deadline += now - p->paused_at;
+        p->paused_at = -1;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Pomodoro_skip(Pomodoro *p, int64_t now) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    /* Shift the day so the current phase ends right now */
+    p->day_start = now - p->pos.phase_end * NSEC_PER_SEC;
+    p->deadline = now;
+    p->paused_at = -1;
+
+    return 0;
+error:
+    return -1;
+}
+
+int Pomodoro_reschedule(Pomodoro *p, const Schedule *schedule) {
+    check(p != NULL, "Got NULL Pomodoro pointer.");
+    check(schedule != NULL && schedule->count > 0,
+            "Need a schedule with at least one phase");
+
+    p->schedule = schedule;
+    if (!p->started || p->pos.state == POMODORO_DONE) {
+        return 0;
+    }
+    /*
+     * Shift the day so the phase at the same index of the new schedule ends
+     * at the current deadline. A schedule too short to have that phase ends
+     * the day when the current phase does.
+     */
+    int i = p->pos.phase_index < schedule->count
+            ? p->pos.phase_index : schedule->count - 1;
+    p->pos.phase_index = i;
+    p->pos.phase_end = schedule->phases[i].end;
+    p->day_start = p->deadline - p->pos.phase_end * NSEC_PER_SEC;
+
+    return 0;
+error:
+    return -1;
+}
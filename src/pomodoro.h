@@ -1,16 +1,253 @@
 #ifndef POMODORO_H
 #define POMODORO_H
 
+#include <stdint.h>
+#include <time.h>
+
 /* Timer tick length, in seconds */
 #define TIMER_PULSE 1
 
 #define SECONDS_PER_MINUTE 60
 #define MINUTES_PER_HOUR 60
 
+#define NSEC_PER_SEC 1000000000LL
+
+/* Marks a Clock as virtual rather than backed by a system clock */
+#define CLOCK_VIRTUAL ((clockid_t)-1)
+
+/*
+ * A source of time. System clocks read and sleep on the kernel clock named by
+ * id. Virtual clocks only move when told to, and sleeping on one jumps
+ * straight to the wake-up time, so code driven by them runs as fast as the
+ * CPU allows and always sees the same times.
+ */
+typedef struct Clock {
+    /* Read the current time, in nanoseconds */
+    int64_t (*now)(struct Clock *c);
+    /* Block until the clock reaches when_ns. Returns 0, or -1 on failure */
+    int (*sleep_until)(struct Clock *c, int64_t when_ns);
+    /* Backing system clock, or CLOCK_VIRTUAL */
+    clockid_t id;
+    /* Current time of a virtual clock, in nanoseconds */
+    int64_t virtual_ns;
+} Clock;
+
 typedef struct {
+    /* Whole seconds remaining, rounded up, as of the last tick */
     int seconds;
+    /* Time on clock at which the timer expires, in nanoseconds */
+    int64_t deadline_ns;
+    /* Clock the timer runs against; the monotonic clock unless changed */
+    Clock *clock;
 } Timer;
 
+/* Most timers a TimerSet may hold */
+#define TIMERSET_MAX (1 << 24)
+
+/* next_free of a slot that holds a timer */
+#define TIMERSET_IN_USE (-2)
+
+/* What TimerSet_next_deadline gives when no timer is armed */
+#define TIMERSET_NEVER INT64_MAX
+
+/* A timer in a TimerSet, known to callers by its index */
+typedef struct {
+    /* Time on the set's clock at which the timer expires, in nanoseconds */
+    int64_t deadline_ns;
+    /* Place in the heap, or -1 while not armed */
+    int heap_index;
+    /*
+     * Next free slot while the slot is free, -1 for the last free slot, or
+     * TIMERSET_IN_USE
+     */
+    int next_free;
+    /* Whatever the caller keeps with the timer, e.g. whose it is */
+    void *data;
+} TimerSlot;
+
+/*
+ * Any number of independent timers against one clock, e.g. one per user of a
+ * shared server. Timers live in a pool of slots that grows by doubling, so
+ * adding and removing one allocates nothing once the pool is big enough, and
+ * a timer keeps its index however the pool grows. Armed timers sit in a
+ * binary min-heap keyed on their deadlines: arming, cancelling and expiring
+ * one is O(log n), and the earliest deadline is read in O(1), so a caller
+ * waits once for that deadline, e.g. on a timerfd, rather than once per
+ * timer.
+ */
+typedef struct {
+    Clock *clock;
+    TimerSlot *slots;
+    int capacity;
+    /* First free slot, or -1 if the pool is full */
+    int free_head;
+    /* Slots in use */
+    int count;
+    /* Slots of armed timers, earliest deadline first */
+    int *heap;
+    int heap_len;
+} TimerSet;
+
+typedef enum {
+    POMODORO_WORK,
+    POMODORO_SHORT_REST,
+    POMODORO_LONG_REST,
+    POMODORO_DONE,
+    POMODORO_ERROR = -1
+} STATE;
+
+/* Where a point in time falls within a day of pomodoro sets */
+typedef struct {
+    STATE state;
+    /* 1-based number of the current set */
+    int set_num;
+    /* 0-based index of the current phase within the day */
+    int phase_index;
+    /* Offset of the end of the current phase from the start of the day, in s */
+    int64_t phase_end;
+} PomodoroPosition;
+
+/* One phase of a compiled Schedule */
+typedef struct {
+    STATE state;
+    /* 1-based set the phase belongs to; a set ends with each long rest */
+    int set_num;
+    /* Offset of the end of the phase from the start of the day, in s */
+    int64_t end;
+} SchedulePhase;
+
+/*
+ * A day of phases compiled into a flat array. Because every phase carries its
+ * cumulative end offset, finding the phase at a given time is a binary search
+ * and the length of the whole day is a single lookup.
+ */
+typedef struct {
+    int count;
+    int capacity;
+    SchedulePhase *phases;
+} Schedule;
+
+/* Most phases a Schedule may expand to */
+#define SCHEDULE_MAX_PHASES (1 << 20)
+
+/*
+ * Longest day a Schedule may add up to, in s: a quarter of what nanosecond
+ * deadlines can hold, leaving the rest for the clock reading the day
+ * starts at
+ */
+#define SCHEDULE_MAX_SECONDS (INT64_MAX / NSEC_PER_SEC / 4)
+
+/* Things that can happen during a Pomodoro_step; combined as bit flags */
+typedef enum {
+    POMODORO_EV_NONE = 0,
+    /* A new phase began, or the day started */
+    POMODORO_EV_PHASE_START = 1 << 0,
+    /* The previous phase ran out; time to alert the user */
+    POMODORO_EV_PHASE_END = 1 << 1,
+    /* Phases ran out without ever being current, e.g. during a suspend */
+    POMODORO_EV_MISSED = 1 << 2,
+    /* Every set is over */
+    POMODORO_EV_DONE = 1 << 3
+} POMODORO_EVENT;
+
+/*
+ * A day of pomodoro sets as a state machine. It never reads a clock, sleeps
+ * or draws: the caller passes in the time with each call and acts on what
+ * comes back, so any frontend or test can drive it.
+ */
+typedef struct {
+    /* The phases to run through; not owned by the Pomodoro */
+    const Schedule *schedule;
+    /* Time the phases are measured from; moved by pauses and skips */
+    int64_t day_start;
+    /* Time the current pause began, or -1 while running */
+    int64_t paused_at;
+    /* Absolute end of the current phase, cached from pos */
+    int64_t deadline;
+    PomodoroPosition pos;
+    /* Total phases that ran out without being current */
+    int missed;
+    /* Whether the first step has happened yet */
+    int started;
+} Pomodoro;
+
+/* What a Pomodoro_step found */
+typedef struct {
+    STATE state;
+    int set_num;
+    int phase_index;
+    /* Absolute end of the current phase, on the caller's clock */
+    int64_t deadline_ns;
+    /* Time left in the current phase, in nanoseconds */
+    int64_t remaining_ns;
+    /* POMODORO_EVENT flags for this step */
+    int events;
+    /* Total phases that ran out without being current */
+    int missed;
+    int paused;
+} PomodoroStatus;
+
+/*
+ * Set up a Clock backed by a system clock. CLOCK_MONOTONIC stops while the
+ * machine is suspended; CLOCK_BOOTTIME and CLOCK_REALTIME keep counting, so a
+ * timer on either of them expires on schedule across a suspend.
+ *
+ * Parameters:
+ *     c: the Clock to set up
+ *     id: one of CLOCK_MONOTONIC, CLOCK_BOOTTIME or CLOCK_REALTIME
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Clock_init_system(Clock *c, clockid_t id);
+
+/*
+ * Set up a virtual Clock.
+ *
+ * Parameters:
+ *     c: the Clock to set up
+ *     start_ns: the time the clock reads until it is advanced
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Clock_init_virtual(Clock *c, int64_t start_ns);
+
+/*
+ * Move a virtual Clock forward.
+ *
+ * Parameters:
+ *     c: the virtual Clock to advance
+ *     delta_ns: how far to move it; must not be negative
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Clock_advance(Clock *c, int64_t delta_ns);
+
+/*
+ * Read a Clock.
+ *
+ * Parameters:
+ *     c: the Clock to read
+ * Returns:
+ *     on success, the current time in nanoseconds
+ *     on failure, -1
+ */
+int64_t Clock_now(Clock *c);
+
+/*
+ * Wait until a Clock reaches a given time. Returns at once if it already has.
+ *
+ * Parameters:
+ *     c: the Clock to wait on
+ *     when_ns: the time to wait for
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Clock_sleep_until(Clock *c, int64_t when_ns);
+
 /*
  * Allocates memory for a Timer object.
  * 
@@ -23,7 +260,31 @@ typedef struct {
 Timer *Timer_alloc();
 
 /*
- * Sets a Timer to the specified time.
+ * Choose the clock a Timer runs against.
+ *
+ * Parameters:
+ *     t: the Timer to modify
+ *     clock: the Clock to use; must outlive the Timer
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Timer_set_clock(Timer *t, Clock *clock);
+
+/*
+ * Read the clock a Timer runs against.
+ *
+ * Parameters:
+ *     t: the Timer whose clock to read
+ * Returns:
+ *     on success, the current time in nanoseconds
+ *     on failure, -1
+ */
+int64_t Timer_now(Timer *t);
+
+/*
+ * Sets a Timer to the specified time. The deadline is fixed against the
+ * Timer's clock at the moment of the call.
  *
  * Parameters:
  *     hours: the number of hours to put on the timer; must not be negative
@@ -37,6 +298,19 @@ Timer *Timer_alloc();
  */
 int Timer_set(Timer *t, int hours, int minutes, int seconds);
 
+/*
+ * Sets a Timer to expire at an absolute time on its clock. A deadline that
+ * has already passed leaves the timer expired.
+ *
+ * Parameters:
+ *     t: the Timer to set
+ *     deadline_ns: the expiry time, as returned by Timer_now
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Timer_set_deadline(Timer *t, int64_t deadline_ns);
+
 /* 
  * Destroy a Timer object
  *
@@ -47,15 +321,437 @@ int Timer_set(Timer *t, int hours, int minutes, int seconds);
 void Timer_destroy(Timer *t);
 
 /*
- * Make a timer count down
+ * Make a timer count down. Sleeps until the next whole-second boundary
+ * before the deadline, then recomputes the time remaining from the clock, so
+ * time spent between ticks never accumulates as drift.
  *
  * Parameters:
  *     t: The timer to count down
  * 
  * Returns:
  *     on success, the number of seconds remaining
- *     on failure, -1
+ *     once the timer has already expired, or on failure, -1
  */
 int Timer_tick(Timer *t);
 
+/*
+ * Bring a timer up to date with its clock without sleeping. For use from an
+ * event loop that waits on its own; see Timer_next_tick.
+ *
+ * Parameters:
+ *     t: The timer to update
+ *
+ * Returns:
+ *     on success, the number of seconds remaining
+ *     on failure, -1
+ */
+int Timer_update(Timer *t);
+
+/*
+ * Work out when the displayed time of a timer next changes.
+ *
+ * Parameters:
+ *     t: The timer to look at
+ *
+ * Returns:
+ *     on success, the time on the Timer's clock of the next whole-second
+ *     boundary before the deadline, or the deadline itself once it is less
+ *     than a second away
+ *     on failure, -1
+ */
+int64_t Timer_next_tick(Timer *t);
+
+/*
+ * Work out when the time left on a timer, rounded up to a whole number of
+ * steps, next changes. Deadlines are whole steps apart from those moments, so
+ * the last change lands exactly on the deadline.
+ *
+ * Parameters:
+ *     t: The timer to look at
+ *     step: the display step, in seconds; must be greater than 0
+ *
+ * Returns:
+ *     on success, the time on the Timer's clock of the next step boundary
+ *     before the deadline, or the deadline itself once it is less than a
+ *     step away
+ *     on failure, -1
+ */
+int64_t Timer_next_change(Timer *t, int step);
+
+/*
+ * Work out when to draw the next frame of a display that changes every
+ * step_ns nanoseconds, drawing at most fps frames a second. Frames fall on
+ * whole multiples of 1/fps seconds of the Timer's clock, so a caller that
+ * wakes up late skips the frames it missed instead of queueing them. The
+ * deadline itself is never put off.
+ *
+ * Parameters:
+ *     t: The timer to look at
+ *     step_ns: how often the display changes, in nanoseconds; must be
+ *              greater than 0
+ *     fps: most frames to draw per second; must be greater than 0
+ *
+ * Returns:
+ *     on success, the time on the Timer's clock to draw the next frame at
+ *     on failure, -1
+ */
+int64_t Timer_next_frame(Timer *t, int64_t step_ns, int fps);
+
+/*
+ * Pick a coarse display step for a timer, for a low-power display that only
+ * wakes up when something worth showing changes: five minutes while more than
+ * ten minutes are left, a minute while more than a minute is left, and ten
+ * seconds after that. Each step divides the threshold above it, so rounding
+ * up to the step never skips over a change of step.
+ *
+ * Parameters:
+ *     t: The timer to look at, as of its last update
+ *
+ * Returns:
+ *     on success, the step, in seconds
+ *     on failure, -1
+ */
+int Timer_coarse_step(Timer *t);
+
+/*
+ * Set up an empty TimerSet.
+ *
+ * Parameters:
+ *     s: the TimerSet to set up
+ *     clock: the Clock deadlines are measured on; must outlive the set
+ *     capacity: timers to make room for up front; the pool grows past it
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int TimerSet_init(TimerSet *s, Clock *clock, int capacity);
+
+/*
+ * Free a TimerSet's pool. The timers in it go with it.
+ *
+ * Parameters:
+ *     s: the TimerSet to tear down
+ * Returns: none
+ */
+void TimerSet_destroy(TimerSet *s);
+
+/*
+ * Take a timer from the pool. It starts out disarmed.
+ *
+ * Parameters:
+ *     s: the TimerSet to add to
+ *     data: kept with the timer, for TimerSet_data
+ * Returns:
+ *     on success, the timer's index, which stays valid until it is removed
+ *     on failure, -1
+ */
+int TimerSet_add(TimerSet *s, void *data);
+
+/*
+ * Give a timer back to the pool, disarming it first.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ *     id: a timer from TimerSet_add
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int TimerSet_remove(TimerSet *s, int id);
+
+/*
+ * Arm a timer to expire at an absolute time on the set's clock, or move its
+ * deadline if it is already armed. A deadline that has already passed
+ * expires on the next TimerSet_expire.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ *     id: a timer from TimerSet_add
+ *     deadline_ns: the expiry time, as returned by Clock_now
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int TimerSet_arm(TimerSet *s, int id, int64_t deadline_ns);
+
+/*
+ * Disarm a timer without giving it back. Disarming one that is not armed
+ * does nothing.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ *     id: a timer from TimerSet_add
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int TimerSet_cancel(TimerSet *s, int id);
+
+/*
+ * Read what was kept with a timer.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ *     id: a timer from TimerSet_add
+ * Returns: the data passed to TimerSet_add, or NULL on failure
+ */
+void *TimerSet_data(TimerSet *s, int id);
+
+/*
+ * Find the earliest deadline of any armed timer: the one time the caller
+ * needs to wake up at.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ * Returns: the deadline, on the set's clock, or TIMERSET_NEVER if no timer
+ * is armed
+ */
+int64_t TimerSet_next_deadline(TimerSet *s);
+
+/*
+ * Disarm the timers whose deadlines have passed, earliest first. Timers
+ * stay in the pool, to be armed again or removed.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ *     now: the current time on the set's clock
+ *     expired: filled in with the indices of the timers that expired
+ *     max: room in expired; any more are left for the next call
+ * Returns:
+ *     on success, the number of timers that expired
+ *     on failure, -1
+ */
+int TimerSet_expire(TimerSet *s, int64_t now, int *expired, int max);
+
+/*
+ * Sleep on the set's clock until its earliest deadline, then expire what is
+ * due, as TimerSet_expire. Returns at once if nothing is armed.
+ *
+ * Parameters:
+ *     s: the TimerSet
+ *     expired: filled in with the indices of the timers that expired
+ *     max: room in expired
+ * Returns:
+ *     on success, the number of timers that expired
+ *     on failure, -1
+ */
+int TimerSet_wait(TimerSet *s, int *expired, int max);
+
+/*
+ * Short name of a phase, as used in events, over the daemon socket and in
+ * exported history.
+ *
+ * Parameters:
+ *     state: the phase
+ *
+ * Returns:
+ *     "work", "short_break", "long_break" or "done", or "error" for anything
+ *     else
+ */
+const char *Pomodoro_state_name(STATE state);
+
+/*
+ * The phase a short name from Pomodoro_state_name stands for.
+ *
+ * Parameters:
+ *     name: the short name
+ *
+ * Returns:
+ *     on success, the phase
+ *     on an unknown name, POMODORO_ERROR
+ */
+STATE Pomodoro_state_parse(const char *name);
+
+/*
+ * Allocates memory for an empty Schedule.
+ *
+ * Parameters: none
+ *
+ * Returns:
+ *     on success, a pointer to the new Schedule
+ *     on failure, NULL
+ */
+Schedule *Schedule_alloc();
+
+/*
+ * Destroy a Schedule object
+ *
+ * Parameters:
+ *     s: the Schedule to destroy
+ * Returns: none
+ */
+void Schedule_destroy(Schedule *s);
+
+/*
+ * Fill a Schedule with the classic layout: num_sets sets, each of
+ * sessions_per_set (work, short break) pairs and then a long break.
+ * Zero-length breaks are left out.
+ *
+ * Parameters:
+ *     s: the Schedule to fill; anything already in it is replaced
+ *     work_len: length of a work session, in seconds
+ *     short_b_len: length of a short break, in seconds
+ *     long_b_len: length of a long break, in seconds
+ *     sessions_per_set: number of work sessions per set
+ *     num_sets: number of sets in the day
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Schedule_from_sets(Schedule *s, int work_len, int short_b_len,
+        int long_b_len, int sessions_per_set, int num_sets);
+
+/*
+ * Compile a schedule description into a Schedule. A description is a list
+ * of phases separated by spaces or commas. Each phase is a letter for its
+ * type (w: work, s: short break, l: long break) followed by its length in
+ * minutes. Any phase or parenthesised group may be repeated by putting a
+ * count and '*' in front of it. The classic day is "3*(w25 s5) l30".
+ *
+ * Parameters:
+ *     s: the Schedule to fill; anything already in it is replaced
+ *     spec: the description to compile
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Schedule_compile(Schedule *s, const char *spec);
+
+/*
+ * Find the phase a Schedule is in a given number of seconds after it
+ * started, by binary search.
+ *
+ * Parameters:
+ *     s: the Schedule to search
+ *     elapsed: seconds since the start of the day; must not be negative
+ *     pos: filled in with the current phase. Once every phase is over, state
+ *          is POMODORO_DONE and phase_index is one past the last phase.
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Schedule_locate(const Schedule *s, int64_t elapsed, PomodoroPosition *pos);
+
+/*
+ * Length of a whole Schedule.
+ *
+ * Parameters:
+ *     s: the Schedule to measure
+ * Returns:
+ *     on success, the length of the day in seconds
+ *     on failure, -1
+ */
+int64_t Schedule_length(const Schedule *s);
+
+/*
+ * Fingerprint a Schedule, so a saved position can be checked against the
+ * schedule it is restored into. Equal schedules hash the same.
+ *
+ * Parameters:
+ *     s: the Schedule to hash
+ * Returns:
+ *     on success, a 64-bit FNV-1a hash of the phases
+ *     on failure, 0
+ */
+uint64_t Schedule_hash(const Schedule *s);
+
+/*
+ * Set up a day of pomodoro sets. The day starts at the first Pomodoro_step.
+ *
+ * Parameters:
+ *     p: the Pomodoro to set up
+ *     schedule: the phases to run through; must hold at least one phase and
+ *               outlive the Pomodoro
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Pomodoro_init(Pomodoro *p, const Schedule *schedule);
+
+/*
+ * Advance a day of pomodoro sets to a given time. Steps that stay in the
+ * same phase only do a subtraction, moving on to the following phase is a
+ * constant-time check, and jumping further is a binary search.
+ *
+ * Parameters:
+ *     p: the Pomodoro to advance
+ *     now: the current time, in nanoseconds; must not go backwards
+ *     status: filled in with the current phase and what happened
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Pomodoro_step(Pomodoro *p, int64_t now, PomodoroStatus *status);
+
+/*
+ * Put a freshly set up day back in the middle of a phase, e.g. one saved
+ * before the program last exited. The phases before it count as done, not
+ * missed. If the deadline has already passed, the next Pomodoro_step moves
+ * on as if the program had been suspended.
+ *
+ * Parameters:
+ *     p: the Pomodoro to restore, fresh from Pomodoro_init
+ *     phase_index: the phase to put it in
+ *     deadline: when that phase ends, on the caller's clock; for a paused
+ *               phase, now plus the time it had left
+ *     now: the current time, in nanoseconds
+ *     paused: whether the phase is paused
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Pomodoro_restore(Pomodoro *p, int phase_index, int64_t deadline,
+        int64_t now, int paused);
+
+/*
+ * Pause or resume the current phase. Pausing a paused day, or resuming a
+ * running one, does nothing.
+ *
+ * Parameters:
+ *     p: the Pomodoro to pause or resume
+ *     now: the current time, in nanoseconds
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Pomodoro_pause(Pomodoro *p, int64_t now);
+int Pomodoro_resume(Pomodoro *p, int64_t now);
+
+/*
+ * End the current phase early. The next Pomodoro_step starts the following
+ * phase. A paused day is resumed.
+ *
+ * Parameters:
+ *     p: the Pomodoro to skip ahead
+ *     now: the current time, in nanoseconds
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Pomodoro_skip(Pomodoro *p, int64_t now);
+
+/*
+ * Switch a day over to a new schedule from the next phase on. The current
+ * phase keeps its state, set and deadline, paused or not; the phases after
+ * it come from the same place in the new schedule. If the new schedule has
+ * no phase after that place, the day is done when the current phase ends.
+ *
+ * Parameters:
+ *     p: the Pomodoro to switch over
+ *     schedule: the phases to run through from now on; must hold at least
+ *               one phase and outlive the Pomodoro
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Pomodoro_reschedule(Pomodoro *p, const Schedule *schedule);
+
 #endif
@@ -0,0 +1,327 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomic_file.h"
+#include "dbg.h"
+#include "pomodoro.h"
+#include "stats.h"
+
+/* Marks a file as saved rollups: "PSTA" */
+#define STATS_MAGIC 0x41545350u
+
+/* Bump whenever the layout of the rollup file changes */
+#define STATS_VERSION 1
+
+/* Records of the history log read into columns at a time */
+#define STATS_CHUNK 1024
+
+/* Start of a rollup file; the StatsDay array follows it */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* sizeof(StatsDay) when written */
+    uint32_t record_size;
+    uint32_t reserved;
+    int64_t history_created;
+    int64_t utc_offset;
+    uint64_t folded;
+    uint64_t count;
+} stats_header;
+
+StatsIndex *Stats_alloc() {
+    StatsIndex *idx = calloc(1, sizeof(StatsIndex));
+    check_mem(idx);
+
+    return idx;
+error:
+    return NULL;
+}
+
+void Stats_destroy(StatsIndex *idx) {
+    if (idx != NULL) {
+        free(idx->days);
+        free(idx);
+    }
+}
+
+int32_t Stats_day_of(int64_t time, int64_t utc_offset) {
+    int64_t local = time + utc_offset;
+    /* Round down, not towards zero, for times before the epoch */
+    if (local < 0) {
+        return -(int32_t)((-local + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
+    }
+    return local / SECONDS_PER_DAY;
+}
+
+/* Index of the first rollup on or after a day */
+static size_t lower_bound(const StatsIndex *idx, int32_t day) {
+    size_t lo = 0;
+    size_t hi = idx->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->days[mid].day < day) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Find the rollup of a day, adding an empty one if there is none. Records
+ * come in time order, so the last rollup is checked first.
+ *
+ * Returns: the rollup, or NULL if there is no memory for it
+ */
+static StatsDay *day_slot(StatsIndex *idx, int32_t day) {
+    if (idx->count > 0 && idx->days[idx->count - 1].day == day) {
+        return &idx->days[idx->count - 1];
+    }
+    size_t i = idx->count > 0 && idx->days[idx->count - 1].day < day
+            ? idx->count : lower_bound(idx, day);
+    if (i < idx->count && idx->days[i].day == day) {
+        return &idx->days[i];
+    }
+    if (idx->count == idx->capacity) {
+        size_t capacity = idx->capacity > 0 ? 2 * idx->capacity : 64;
+        StatsDay *days = realloc(idx->days, capacity * sizeof(StatsDay));
+        check_mem(days);
+        idx->days = days;
+        idx->capacity = capacity;
+    }
+    memmove(&idx->days[i + 1], &idx->days[i],
+            (idx->count - i) * sizeof(StatsDay));
+    memset(&idx->days[i], 0, sizeof(StatsDay));
+    idx->days[i].day = day;
+    idx->count++;
+
+    return &idx->days[i];
+error:
+    return NULL;
+}
+
+long Stats_update(StatsIndex *idx, const HistoryMap *m, int64_t utc_offset) {
+    check(idx != NULL, "Got NULL StatsIndex pointer");
+    check(m != NULL && m->map != NULL, "History log is not mapped");
+    const HistoryHeader *hdr = (const HistoryHeader *)m->map;
+    if (idx->history_created != hdr->created || idx->utc_offset != utc_offset
+            || idx->folded > m->count) {
+        idx->count = 0;
+        idx->folded = 0;
+        idx->history_created = hdr->created;
+        idx->utc_offset = utc_offset;
+    }
+
+    int64_t start[STATS_CHUNK];
+    int32_t day[STATS_CHUNK];
+    uint32_t focused[STATS_CHUNK];
+    uint16_t started[STATS_CHUNK];
+    uint16_t completed[STATS_CHUNK];
+    uint16_t interrupted[STATS_CHUNK];
+    size_t first = idx->folded;
+    for (size_t base = first; base < m->count; base += STATS_CHUNK) {
+        size_t n = m->count - base < STATS_CHUNK ? m->count - base
+                : STATS_CHUNK;
+        const HistoryRecord *r = m->records + base;
+
+        /* Damaged records and breaks count for nothing */
+        for (size_t i = 0; i < n; i++) {
+            start[i] = r[i].start;
+            if (r[i].outcome == HISTORY_SUMMARY) {
+                const HistorySummary *sum = (const HistorySummary *)&r[i];
+                int ok = History_record_ok(&r[i]);
+                focused[i] = ok ? sum->focused : 0;
+                started[i] = ok ? sum->started : 0;
+                completed[i] = ok ? sum->completed : 0;
+                interrupted[i] = ok ? sum->interrupted : 0;
+                continue;
+            }
+            int work = r[i].state == POMODORO_WORK && History_record_ok(&r[i]);
+            focused[i] = work ? r[i].duration : 0;
+            started[i] = work && r[i].outcome != HISTORY_MISSED;
+            completed[i] = work && r[i].outcome == HISTORY_COMPLETED;
+            interrupted[i] = work && (r[i].outcome == HISTORY_SKIPPED
+                    || r[i].outcome == HISTORY_INTERRUPTED);
+        }
+        for (size_t i = 0; i < n; i++) {
+            day[i] = Stats_day_of(start[i], utc_offset);
+        }
+
+        /* Each run of records from the same day goes into its rollup */
+        for (size_t i = 0; i < n;) {
+            StatsDay sum = { .day = day[i] };
+            size_t j = i;
+            for (; j < n && day[j] == day[i]; j++) {
+                sum.focused += focused[j];
+                sum.started += started[j];
+                sum.completed += completed[j];
+                sum.interrupted += interrupted[j];
+            }
+            i = j;
+            if (sum.focused == 0 && sum.started == 0) {
+                continue;
+            }
+            StatsDay *slot = day_slot(idx, sum.day);
+            check(slot != NULL, "No room for another day of rollups");
+            slot->focused += sum.focused;
+            slot->started += sum.started;
+            slot->completed += sum.completed;
+            slot->interrupted += sum.interrupted;
+        }
+        idx->folded = base + n;
+    }
+
+    return idx->folded - first;
+error:
+    return -1;
+}
+
+int Stats_sum(const StatsIndex *idx, int32_t from, int32_t to,
+        StatsTotals *out) {
+    check(idx != NULL, "Got NULL StatsIndex pointer");
+    check(out != NULL, "Got NULL StatsTotals pointer");
+    memset(out, 0, sizeof(*out));
+    for (size_t i = lower_bound(idx, from);
+            i < idx->count && idx->days[i].day <= to; i++) {
+        out->focused += idx->days[i].focused;
+        out->started += idx->days[i].started;
+        out->completed += idx->days[i].completed;
+        out->interrupted += idx->days[i].interrupted;
+        out->active_days += idx->days[i].completed > 0;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Stats_streaks(const StatsIndex *idx, int32_t today, int *longest,
+        int *current) {
+    check(idx != NULL, "Got NULL StatsIndex pointer");
+    check(longest != NULL && current != NULL, "Got NULL streak pointer");
+    *longest = 0;
+    *current = 0;
+    int run = 0;
+    int32_t last = 0;
+    for (size_t i = 0; i < idx->count; i++) {
+        if (idx->days[i].completed == 0) {
+            continue;
+        }
+        run = run > 0 && idx->days[i].day == last + 1 ? run + 1 : 1;
+        last = idx->days[i].day;
+        if (run > *longest) {
+            *longest = run;
+        }
+    }
+    if (run > 0 && (last == today || last == today - 1)) {
+        *current = run;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int Stats_load(StatsIndex *idx, const char *path) {
+    char *buf = NULL;
+    int fd = -1;
+    check(idx != NULL, "Got NULL StatsIndex pointer");
+    check(idx->count == 0, "Can only load into an empty StatsIndex");
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(stats_header)) {
+        close(fd);
+        return 0;
+    }
+    buf = malloc(st.st_size);
+    check_mem(buf);
+    ssize_t got = read(fd, buf, st.st_size);
+    close(fd);
+    fd = -1;
+
+    stats_header *h = (stats_header *)buf;
+    if (got == st.st_size && h->magic == STATS_MAGIC
+            && h->version == STATS_VERSION
+            && h->record_size == sizeof(StatsDay)
+            && (off_t)(sizeof(stats_header) + h->count * sizeof(StatsDay))
+                    == st.st_size) {
+        if (h->count > 0) {
+            idx->days = malloc(h->count * sizeof(StatsDay));
+            check_mem(idx->days);
+            memcpy(idx->days, buf + sizeof(stats_header),
+                    h->count * sizeof(StatsDay));
+        }
+        idx->count = h->count;
+        idx->capacity = h->count;
+        idx->history_created = h->history_created;
+        idx->utc_offset = h->utc_offset;
+        idx->folded = h->folded;
+    }
+    free(buf);
+
+    return 0;
+error:
+    if (fd != -1) {
+        close(fd);
+    }
+    free(buf);
+    return -1;
+}
+
+int Stats_save(const StatsIndex *idx, const char *path) {
+    AtomicFile out = { .fd = -1 };
+    check(idx != NULL, "Got NULL StatsIndex pointer");
+
+    stats_header h = { .magic = STATS_MAGIC, .version = STATS_VERSION,
+            .record_size = sizeof(StatsDay), .reserved = 0,
+            .history_created = idx->history_created,
+            .utc_offset = idx->utc_offset, .folded = idx->folded,
+            .count = idx->count };
+    int rc = AtomicFile_open(&out, path);
+    check(rc == 0, "Failed to open rollup file '%s'", out.tmp_path);
+    check(write(out.fd, &h, sizeof(h)) == (ssize_t)sizeof(h),
+            "Failed to write rollups");
+    ssize_t size = idx->count * sizeof(StatsDay);
+    check(size == 0 || write(out.fd, idx->days, size) == size,
+            "Failed to write rollups");
+    rc = AtomicFile_commit(&out);
+    check(rc == 0, "Failed to move rollups into place");
+
+    return 0;
+error:
+    AtomicFile_abort(&out);
+    return -1;
+}
+
+int Stats_refresh(StatsIndex *idx, const char *history_path,
+        const char *rollup_path, int64_t utc_offset) {
+    int rc = Stats_load(idx, rollup_path);
+    check(rc == 0, "Failed to load rollups");
+    if (access(history_path, F_OK) != 0) {
+        return 0;
+    }
+    HistoryMap m;
+    rc = HistoryMap_open(&m, history_path);
+    check(rc == 0, "Failed to read history log");
+    long got = Stats_update(idx, &m, utc_offset);
+    HistoryMap_close(&m);
+    check(got != -1, "Failed to roll up history log");
+    /* The rollups can always be built again, so failing to save is fine */
+    if (got > 0) {
+        Stats_save(idx, rollup_path);
+    }
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,180 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "history.h"
+
+#define SECONDS_PER_DAY 86400
+
+/* What was done on one day; only work sessions count */
+typedef struct {
+    /* Days since 1970-01-01 in local time; see Stats_day_of */
+    int32_t day;
+    /* Seconds of work */
+    uint32_t focused;
+    /* Work sessions begun, i.e. not missed */
+    uint32_t started;
+    /* Work sessions that ran their course */
+    uint32_t completed;
+    /* Work sessions skipped or cut short by quitting */
+    uint32_t interrupted;
+} StatsDay;
+
+/* StatsDay figures added up over a range of days */
+typedef struct {
+    uint64_t focused;
+    uint32_t started;
+    uint32_t completed;
+    uint32_t interrupted;
+    /* Days with at least one completed work session */
+    uint32_t active_days;
+} StatsTotals;
+
+/*
+ * Per-day rollups of a history log, sorted by day. The rollups are saved
+ * next to the log and remember how many of its records they cover, so
+ * bringing them up to date only reads the records appended since.
+ */
+typedef struct {
+    /* HistoryHeader.created of the log the rollups came from */
+    int64_t history_created;
+    /* Offset from UTC, in s, that days were counted in */
+    int64_t utc_offset;
+    /* Records of the log covered so far */
+    uint64_t folded;
+    size_t count;
+    size_t capacity;
+    StatsDay *days;
+} StatsIndex;
+
+/*
+ * Allocates memory for an empty StatsIndex.
+ *
+ * Parameters: none
+ *
+ * Returns:
+ *     on success, a pointer to the new StatsIndex
+ *     on failure, NULL
+ */
+StatsIndex *Stats_alloc();
+
+/*
+ * Destroy a StatsIndex object
+ *
+ * Parameters:
+ *     idx: the StatsIndex to destroy
+ * Returns: none
+ */
+void Stats_destroy(StatsIndex *idx);
+
+/*
+ * The local day a time falls on.
+ *
+ * Parameters:
+ *     time: seconds since the epoch
+ *     utc_offset: the local offset from UTC, in s
+ *
+ * Returns: days since 1970-01-01
+ */
+int32_t Stats_day_of(int64_t time, int64_t utc_offset);
+
+/*
+ * Bring a StatsIndex up to date with a history log. Only records past the
+ * ones already covered are read, unless the log was started again or
+ * compacted, or days are now counted in another UTC offset, in which case
+ * the rollups are built again from scratch. Day summaries count as the
+ * phases they stand for. Records are read a chunk at a time into one array
+ * per field, and each step runs down a whole column.
+ *
+ * Parameters:
+ *     idx: the StatsIndex to update
+ *     m: the mapped history log
+ *     utc_offset: the local offset from UTC, in s
+ *
+ * Returns:
+ *     on success, the number of records read
+ *     on failure, -1
+ */
+long Stats_update(StatsIndex *idx, const HistoryMap *m, int64_t utc_offset);
+
+/*
+ * Add up the rollups of a range of days, found by binary search.
+ *
+ * Parameters:
+ *     idx: the StatsIndex to read
+ *     from: the first day, as from Stats_day_of
+ *     to: the last day, inclusive
+ *     out: filled in with the totals
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Stats_sum(const StatsIndex *idx, int32_t from, int32_t to,
+        StatsTotals *out);
+
+/*
+ * Find the longest run of days in a row with a completed work session,
+ * and the run still going. A run that reached yesterday is still going,
+ * since today may yet have one.
+ *
+ * Parameters:
+ *     idx: the StatsIndex to read
+ *     today: the current day, as from Stats_day_of
+ *     longest: set to the longest run, in days
+ *     current: set to the run still going, in days
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Stats_streaks(const StatsIndex *idx, int32_t today, int *longest,
+        int *current);
+
+/*
+ * Load saved rollups. A missing, damaged or outdated file leaves the
+ * StatsIndex empty, to be built again by Stats_update.
+ *
+ * Parameters:
+ *     idx: the StatsIndex to fill; must be empty
+ *     path: the rollup file
+ *
+ * Returns:
+ *     on success, 0, whether or not anything was loaded
+ *     on failure, -1
+ */
+int Stats_load(StatsIndex *idx, const char *path);
+
+/*
+ * Save rollups, replacing the old file with an AtomicFile.
+ *
+ * Parameters:
+ *     idx: the StatsIndex to save
+ *     path: the rollup file
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Stats_save(const StatsIndex *idx, const char *path);
+
+/*
+ * Load the rollups of a history log, bring them up to date with it, and
+ * save them again if anything changed.
+ *
+ * Parameters:
+ *     idx: the StatsIndex to fill; must be empty
+ *     history_path: the history log; a missing log just has no records
+ *     rollup_path: the rollup file
+ *     utc_offset: the local offset from UTC, in s
+ *
+ * Returns:
+ *     on success, 0
+ *     on failure, -1
+ */
+int Stats_refresh(StatsIndex *idx, const char *history_path,
+        const char *rollup_path, int64_t utc_offset);
+
+#endif
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "ui.h"
+
+/* Font for the big clock, in font pixels */
+#define FONT_DIGIT_W 3
+#define FONT_COLON_W 1
+#define FONT_H 5
+/* Blank font pixels between glyphs */
+#define FONT_GAP 1
+
+/* Glyphs in the atlas: 0-9, ':', '.', then a blank */
+#define GLYPH_COLON 10
+#define GLYPH_DOT 11
+#define GLYPH_BLANK 12
+#define GLYPH_COUNT 13
+
+static const char *FONT[GLYPH_COUNT][FONT_H] = {
+    { "###", "# #", "# #", "# #", "###" },
+    { "  #", "  #", "  #", "  #", "  #" },
+    { "###", "  #", "###", "#  ", "###" },
+    { "###", "  #", "###", "  #", "###" },
+    { "# #", "# #", "###", "  #", "  #" },
+    { "###", "#  ", "###", "  #", "###" },
+    { "###", "#  ", "###", "# #", "###" },
+    { "###", "  #", "  #", "  #", "  #" },
+    { "###", "# #", "###", "# #", "###" },
+    { "###", "# #", "###", "  #", "###" },
+    { " ", "#", " ", "#", " " },
+    { " ", " ", " ", " ", "#" },
+    { "   ", "   ", "   ", "   ", "   " }
+};
+
+/* Width of "HH:MM:SS" in font pixels */
+static const int CLOCK_FONT_W = 6 * FONT_DIGIT_W + 2 * FONT_COLON_W
+        + (UI_CLOCK_GLYPHS - 1) * FONT_GAP;
+
+/* Whether a clock character is drawn with a narrow glyph */
+static bool is_narrow(char c) {
+    return c == ':' || c == '.';
+}
+
+int alert_user(ALERT_TYPE type) {
+    check(type == ALERT_BEEP || type == ALERT_FLASH,
+            "Invalid alert type %d. Choose ALERT_BEEP or ALERT_FLASH", type);
+    int rc = 0;
+    switch (type) {
+        case ALERT_BEEP:
+            rc = beep();
+            break;
+        case ALERT_FLASH:
+            rc = flash();
+            break;
+        default:
+            sentinel("I shouldn't run");
+            break;
+    }
+    check(rc == OK, "Alert failed");
+    return 0;
+error:
+    return -1;
+}
+
+void destroy_win(WINDOW *win) {
+    check(win != NULL, "Got NULL Window pointer");
+    wborder(win, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
+    delwin(win);
+error:
+    return;
+}
+
+/*
+ * Work out the largest big clock that fits the timer window and rasterize
+ * every glyph at that scale. A window too small for it gets scale 0, and the
+ * time is shown as text instead.
+ *
+ * Parameters:
+ *     ui: the Ui whose timer window to lay the clock out in
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+static int layout_clock(Ui *ui) {
+    UiAtlas *a = &ui->atlas;
+    free(a->cells);
+    memset(a, 0, sizeof(UiAtlas));
+    ui->clock_text[0] = '\0';
+
+    int win_h = 0;
+    int win_w = 0;
+    getmaxyx(ui->timer_win, win_h, win_w);
+    /* Inside the border, less the label row and a blank row under it */
+    int scale_x = (win_w - 2) / CLOCK_FONT_W;
+    int scale_y = (win_h - 4) / FONT_H;
+    /* Cells are about twice as tall as wide; keep the font's proportions */
+    scale_y = scale_y < scale_x ? scale_y : scale_x;
+    scale_x = scale_x < 2 * scale_y ? scale_x : 2 * scale_y;
+    if (scale_x <= 0 || scale_y <= 0) {
+        return 0;
+    }
+
+    a->scale_x = scale_x;
+    a->scale_y = scale_y;
+    a->digit_w = FONT_DIGIT_W * scale_x;
+    a->colon_w = FONT_COLON_W * scale_x;
+    a->glyph_h = FONT_H * scale_y;
+    a->cells = malloc(sizeof(chtype) * GLYPH_COUNT * a->glyph_h * a->digit_w);
+    check_mem(a->cells);
+    for (int g = 0; g < GLYPH_COUNT; g++) {
+        int font_w = g == GLYPH_COLON || g == GLYPH_DOT ? FONT_COLON_W
+                : FONT_DIGIT_W;
+        for (int r = 0; r < a->glyph_h; r++) {
+            chtype *row = &a->cells[(g * a->glyph_h + r) * a->digit_w];
+            for (int c = 0; c < a->digit_w; c++) {
+                int font_c = c / scale_x;
+                bool on = font_c < font_w
+                        && FONT[g][r / scale_y][font_c] == '#';
+                row[c] = on ? ' ' | A_REVERSE : ' ';
+            }
+        }
+    }
+    a->y = (win_h - a->glyph_h - 2) / 2 + 2;
+
+    return 0;
+error:
+    memset(a, 0, sizeof(UiAtlas));
+    return -1;
+}
+
+/*
+ * Row of the timer window the time left text goes on: the label row above
+ * the big clock, or the middle of the window when there is no big clock.
+ */
+static int time_row(Ui *ui) {
+    if (ui->atlas.scale_x > 0) {
+        return ui->atlas.y - 2;
+    }
+    return getmaxy(ui->timer_win) / 2 - 1;
+}
+
+/*
+ * Copy one glyph out of the atlas onto the timer window.
+ */
+static void blit_glyph(Ui *ui, char c, int x, int w) {
+    UiAtlas *a = &ui->atlas;
+    int g = c == ':' ? GLYPH_COLON : c == '.' ? GLYPH_DOT
+            : c >= '0' && c <= '9' ? c - '0' : GLYPH_BLANK;
+    for (int r = 0; r < a->glyph_h; r++) {
+        mvwaddchnstr(ui->timer_win, a->y + r, x,
+                &a->cells[(g * a->glyph_h + r) * a->digit_w], w);
+    }
+}
+
+/*
+ * Paint the big clock, copying rows out of the atlas for only the glyphs
+ * that differ from what is on screen. Text of a different shape (length, or
+ * where the narrow glyphs fall) clears the old clock and is centered afresh.
+ *
+ * Parameters:
+ *     ui: the Ui to draw on; must have a big clock
+ *     text: up to UI_CLOCK_GLYPHS glyphs, e.g. "HH:MM:SS" or "MM:SS.T", or
+ *           "" to blank the clock
+ */
+static void put_clock(Ui *ui, const char *text) {
+    UiAtlas *a = &ui->atlas;
+    int len = strnlen(text, UI_CLOCK_GLYPHS);
+    int old_len = strlen(ui->clock_text);
+    bool same_shape = len == old_len;
+    for (int i = 0; same_shape && i < len; i++) {
+        same_shape = is_narrow(text[i]) == is_narrow(ui->clock_text[i]);
+    }
+
+    if (!same_shape) {
+        for (int i = 0; i < old_len; i++) {
+            blit_glyph(ui, ' ', a->x[i],
+                    is_narrow(ui->clock_text[i]) ? a->colon_w : a->digit_w);
+        }
+        int width = (len - 1) * FONT_GAP * a->scale_x;
+        for (int i = 0; i < len; i++) {
+            width += is_narrow(text[i]) ? a->colon_w : a->digit_w;
+        }
+        int x = (getmaxx(ui->timer_win) - width) / 2;
+        for (int i = 0; i < len; i++) {
+            a->x[i] = x;
+            x += (is_narrow(text[i]) ? a->colon_w : a->digit_w)
+                    + FONT_GAP * a->scale_x;
+        }
+    }
+    for (int i = 0; i < len; i++) {
+        if (same_shape && text[i] == ui->clock_text[i]) {
+            continue;
+        }
+        blit_glyph(ui, text[i], a->x[i],
+                is_narrow(text[i]) ? a->colon_w : a->digit_w);
+    }
+    memcpy(ui->clock_text, text, len);
+    ui->clock_text[len] = '\0';
+}
+
+/* The Frontend operations, each handing on to its Ui_ counterpart */
+
+static int ui_alert(Frontend *f, ALERT_TYPE type) {
+    (void)f;
+    return alert_user(type);
+}
+
+static void ui_show_message(Frontend *f, const char *msg) {
+    Ui_show_message((Ui *)f, msg);
+}
+
+static void ui_show_session(Frontend *f, STATE state, int set_num,
+        int missed, int time_left) {
+    Ui_show_session((Ui *)f, state, set_num, missed, time_left);
+}
+
+static void ui_show_time_left(Frontend *f, int time_left, int tenths,
+        bool paused) {
+    Ui_show_time_left((Ui *)f, time_left, tenths, paused);
+}
+
+static void ui_flush(Frontend *f) {
+    Ui_flush((Ui *)f);
+}
+
+static int ui_resize(Frontend *f, int rows, int cols) {
+    return Ui_resize((Ui *)f, rows, cols);
+}
+
+static int ui_read_key(Frontend *f) {
+    (void)f;
+    int ch;
+    /* SIGWINCH is handled by the event loop, so KEY_RESIZE is redundant */
+    while ((ch = getch()) == KEY_RESIZE);
+    return ch == ERR ? -1 : ch;
+}
+
+int Ui_init(Ui *ui) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    ui->status_win = NULL;
+    ui->timer_win = NULL;
+    ui->atlas.cells = NULL;
+
+    int rc = 0;
+    int row = 0;
+    int col = 0;
+    getmaxyx(stdscr, row, col); // get window dimensions
+    check(row >= UI_MIN_ROWS, "Terminal must be >=%d rows tall", UI_MIN_ROWS);
+
+    /*
+     * Status window sits in the top-left corner and stretches all the way
+     * from left to right. It is minimal size for centered messages:
+     *     2 rows for borders
+     *     2 rows for padding
+     *     2 rows for messages:
+     *         1 row for number of current set
+     *         1 row for status message from pomodoro_status()
+     */
+    ui->status_win = newwin(UI_STATUS_HEIGHT, col, 0, 0);
+    check(ui->status_win != NULL, "Failed to create status window");
+
+    /* Timer window sits right under it and takes whatever rows are left */
+    ui->timer_win = newwin(row - UI_STATUS_HEIGHT, col, UI_STATUS_HEIGHT, 0);
+    check(ui->timer_win != NULL, "Failed to create timer window");
+
+    memset(&ui->set_line, 0, sizeof(UiLine));
+    memset(&ui->state_line, 0, sizeof(UiLine));
+    memset(&ui->time_line, 0, sizeof(UiLine));
+    ui->needs_border = true;
+    ui->base = (Frontend) {
+        .alert = ui_alert,
+        .show_message = ui_show_message,
+        .show_session = ui_show_session,
+        .show_time_left = ui_show_time_left,
+        .flush = ui_flush,
+        .resize = ui_resize,
+        .read_key = ui_read_key,
+        .low_power = false,
+        .fps = 0,
+        .sync_output = false,
+        .tick = 0
+    };
+    nodelay(stdscr, TRUE);
+    rc = layout_clock(ui);
+    check(rc == 0, "Failed to lay out the clock");
+
+    /*
+     * Until the first endwin(), ncurses flushes the terminal after every
+     * cursor movement, so one update costs a write(2) per changed run of
+     * cells. Leaving curses mode once now, before anything is drawn, makes
+     * the next doupdate switch to flushing once per update.
+     */
+    endwin();
+
+    return 0;
+error:
+    if (ui != NULL) {
+        Ui_destroy(ui);
+    }
+    return -1;
+}
+
+void Ui_destroy(Ui *ui) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    if (ui->status_win != NULL) {
+        destroy_win(ui->status_win);
+        ui->status_win = NULL;
+    }
+    if (ui->timer_win != NULL) {
+        destroy_win(ui->timer_win);
+        ui->timer_win = NULL;
+    }
+    free(ui->atlas.cells);
+    ui->atlas.cells = NULL;
+error:
+    return;
+}
+
+/* Where put_run writes: a row of a window */
+typedef struct {
+    WINDOW *win;
+    int y;
+} window_row;
+
+static void put_run(void *ctx, int x, const char *run, int len) {
+    window_row *row = ctx;
+    mvwaddnstr(row->win, row->y, x, run, len);
+}
+
+/*
+ * Put a line of text centered on row y of a window, rewriting only the
+ * cells that differ from what the line last held.
+ *
+ * Parameters:
+ *     win: the window to draw in
+ *     y: the row to draw on
+ *     line: what is on that row now; updated to hold text
+ *     text: the new contents of the row
+ */
+static void put_line(WINDOW *win, int y, UiLine *line, const char *text) {
+    window_row row = { .win = win, .y = y };
+    Frontend_update_line(line, getmaxx(win), text, put_run, &row);
+}
+
+/*
+ * Put a line back on screen after its window was cleared, wherever its
+ * text now centers.
+ */
+static void replay_line(WINDOW *win, int y, UiLine *line) {
+    char text[UI_LINE_MAX];
+    memcpy(text, line->text, line->len);
+    text[line->len] = '\0';
+    memset(line, 0, sizeof(UiLine));
+    put_line(win, y, line, text);
+}
+
+int Ui_resize(Ui *ui, int rows, int cols) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    /* resizeterm() trims windows to the new screen, so look at them first */
+    int status_w = getmaxx(ui->status_win);
+    int timer_h = 0;
+    int timer_w = 0;
+    getmaxyx(ui->timer_win, timer_h, timer_w);
+    int rc = resizeterm(rows, cols);
+    check(rc == OK, "Failed to resize the screen to %dx%d", cols, rows);
+
+    /*
+     * Too small a terminal gets windows of the smallest usable size, and
+     * curses clips them to the screen.
+     */
+    rows = rows > UI_MIN_ROWS ? rows : UI_MIN_ROWS;
+    cols = cols > 1 ? cols : 1;
+
+    if (status_w != cols) {
+        rc = wresize(ui->status_win, UI_STATUS_HEIGHT, cols);
+        check(rc == OK, "Failed to resize status window");
+        werase(ui->status_win);
+        replay_line(ui->status_win, UI_STATUS_HEIGHT / 2 - 1, &ui->set_line);
+        replay_line(ui->status_win, UI_STATUS_HEIGHT / 2, &ui->state_line);
+        ui->needs_border = true;
+    }
+    if (timer_h != rows - UI_STATUS_HEIGHT || timer_w != cols) {
+        rc = wresize(ui->timer_win, rows - UI_STATUS_HEIGHT, cols);
+        check(rc == OK, "Failed to resize timer window");
+        werase(ui->timer_win);
+        memset(&ui->time_line, 0, sizeof(UiLine));
+        rc = layout_clock(ui);
+        check(rc == 0, "Failed to lay out the clock");
+        ui->needs_border = true;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+void Ui_show_message(Ui *ui, const char *msg) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    int status_win_h = getmaxy(ui->status_win);
+    put_line(ui->status_win, status_win_h / 2 - 1, &ui->set_line, "");
+    put_line(ui->status_win, status_win_h / 2, &ui->state_line, msg);
+error:
+    return;
+}
+
+void Ui_show_session(Ui *ui, STATE state, int set_num, int missed,
+        int time_left) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    char msg[UI_LINE_MAX];
+    int status_win_h = getmaxy(ui->status_win);
+
+    if (missed > 0) {
+        snprintf(msg, sizeof(msg),
+                "Current set: %d (%d phases elapsed while suspended)",
+                set_num, missed);
+    } else {
+        snprintf(msg, sizeof(msg), "Current set: %d", set_num);
+    }
+    put_line(ui->status_win, status_win_h / 2 - 1, &ui->set_line, msg);
+    put_line(ui->status_win, status_win_h / 2, &ui->state_line,
+            pomodoro_status(state));
+
+    if (state == POMODORO_DONE) {
+        put_line(ui->timer_win, time_row(ui), &ui->time_line, "");
+        if (ui->atlas.scale_x > 0) {
+            put_clock(ui, "");
+        }
+    } else {
+        Ui_show_time_left(ui, time_left, -1, false);
+    }
+error:
+    return;
+}
+
+void Ui_show_time_left(Ui *ui, int time_left, int tenths, bool paused) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    char msg[UI_LINE_MAX];
+    int hours = time_left / (SECONDS_PER_MINUTE * MINUTES_PER_HOUR);
+    int minutes = (time_left / SECONDS_PER_MINUTE) % MINUTES_PER_HOUR;
+    int seconds = time_left % SECONDS_PER_MINUTE;
+    if (ui->atlas.scale_x > 0 && hours < 100) {
+        if (tenths >= 0 && hours == 0) {
+            snprintf(msg, sizeof(msg), "%02d:%02d.%d", minutes, seconds,
+                    tenths);
+        } else {
+            snprintf(msg, sizeof(msg), "%02d:%02d:%02d", hours, minutes,
+                    seconds);
+        }
+        put_clock(ui, msg);
+        put_line(ui->timer_win, time_row(ui), &ui->time_line,
+                paused ? "[Paused] Time left" : "Time left");
+        return;
+    } else if (ui->atlas.scale_x > 0) {
+        put_clock(ui, "");
+    }
+    Frontend_format_time(msg, sizeof(msg), time_left, tenths, paused,
+            ui->base.low_power);
+    put_line(ui->timer_win, time_row(ui), &ui->time_line, msg);
+error:
+    return;
+}
+
+void Ui_flush(Ui *ui) {
+    check(ui != NULL, "Got NULL Ui pointer");
+    if (ui->needs_border) {
+        box(ui->status_win, 0, 0);
+        box(ui->timer_win, 0, 0);
+        ui->needs_border = false;
+    }
+    /*
+     * stdscr lies under both windows. Refreshing it first, while it is
+     * touched, keeps getch() from repainting it blank over them later.
+     */
+    wnoutrefresh(stdscr);
+    wnoutrefresh(ui->status_win);
+    wnoutrefresh(ui->timer_win);
+    if (ui->base.sync_output) {
+        /*
+         * curses has no way to put the markers in its own output buffer,
+         * but it empties that buffer at the end of every doupdate(), so
+         * writing them straight to the terminal around one keeps the order.
+         */
+        fflush(stdout);
+        Frontend_write_all(STDOUT_FILENO, SYNC_BEGIN, strlen(SYNC_BEGIN));
+        doupdate();
+        Frontend_write_all(STDOUT_FILENO, SYNC_END, strlen(SYNC_END));
+    } else {
+        doupdate();
+    }
+error:
+    return;
+}
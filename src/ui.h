@@ -0,0 +1,164 @@
+#ifndef UI_H
+#define UI_H
+
+#include <ncurses.h>
+#include <stdbool.h>
+
+#include "frontend.h"
+#include "pomodoro.h"
+
+/* Most glyphs in the big clock: HH:MM:SS, or MM:SS.T for tenths */
+#define UI_CLOCK_GLYPHS 8
+
+/*
+ * The big clock, laid out for one size of timer window. Every glyph is
+ * rasterized up front at the scale that fits, so painting a digit is a
+ * straight copy of its rows.
+ */
+typedef struct {
+    /* Cells per font pixel, across and down; 0 if the clock does not fit */
+    int scale_x;
+    int scale_y;
+    /* Width of a digit and of a colon, and height of any glyph, in cells */
+    int digit_w;
+    int colon_w;
+    int glyph_h;
+    /* Top row of the clock, and the column each glyph on screen starts at */
+    int y;
+    int x[UI_CLOCK_GLYPHS];
+    /* Glyphs 0-9, ':', '.' and a blank, each glyph_h rows of digit_w cells */
+    chtype *cells;
+} UiAtlas;
+
+/*
+ * The curses frontend. It remembers the last frame it painted, so each
+ * update only rewrites the cells that changed; borders are drawn once.
+ */
+typedef struct {
+    /* Operations and display settings; must come first */
+    Frontend base;
+    WINDOW *status_win;
+    WINDOW *timer_win;
+    /* "Current set" line of the status window */
+    UiLine set_line;
+    /* Status message line of the status window */
+    UiLine state_line;
+    /* Time left line of the timer window; a label above the big clock */
+    UiLine time_line;
+    UiAtlas atlas;
+    /* Glyphs of the big clock on screen, or "" if it is blank */
+    char clock_text[UI_CLOCK_GLYPHS + 1];
+    /* Whether the window borders still need painting */
+    bool needs_border;
+} Ui;
+
+/*
+ * Alert the user to the end of a timer session
+ *
+ * Parameters:
+ *     type: the type of alert to use
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1. Also emits a message to stderr
+ */
+int alert_user(ALERT_TYPE type);
+
+/*
+ * Destroy an ncurses window that isn't stdscr
+ *
+ * Parameters:
+ *     win: window to destroy
+ * Returns: none
+ */
+void destroy_win(WINDOW *win);
+
+/*
+ * Lay out the status and timer windows on stdscr and rasterize the big clock
+ * for the timer window, and fill in the Frontend operations so the Ui can be
+ * driven through &ui->base. Nothing is drawn until the first Ui_flush.
+ * Low-power display, the sub-second display and synchronized output all
+ * start off. Keys are read without waiting.
+ *
+ * Parameters:
+ *     ui: the Ui to set up
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Ui_init(Ui *ui);
+
+/*
+ * Destroy the windows and the glyph atlas of a Ui
+ *
+ * Parameters:
+ *     ui: the Ui to tear down
+ * Returns: none
+ */
+void Ui_destroy(Ui *ui);
+
+/*
+ * Fit the Ui to a new terminal size. Windows are resized in place; a window
+ * whose size did not change is left alone. The status window repaints its
+ * own lines, while the timer window is left blank with its clock laid out
+ * afresh, ready for the next Ui_present. Curses only sends the cells that
+ * end up different.
+ *
+ * Parameters:
+ *     ui: the Ui to resize
+ *     rows: the new terminal height
+ *     cols: the new terminal width
+ *
+ * Returns:
+ *     On success, 0
+ *     On failure, -1
+ */
+int Ui_resize(Ui *ui, int rows, int cols);
+
+/*
+ * Put a one-off message in the status window, e.g. a welcome splash
+ *
+ * Parameters:
+ *     ui: the Ui to draw on
+ *     msg: the message to show
+ */
+void Ui_show_message(Ui *ui, const char *msg);
+
+/*
+ * Show the start of a pomodoro session
+ *
+ * Parameters:
+ *     ui: the Ui to draw on
+ *     state: the type of timer --- working or resting
+ *     set_num: current set number
+ *     missed: number of phases that ran out while the machine was suspended
+ *     time_left: seconds left in the session
+ */
+void Ui_show_session(Ui *ui, STATE state, int set_num, int missed,
+        int time_left);
+
+/*
+ * Show the time left in the current session, in big digits when the timer
+ * window is large enough. Only glyphs that changed are repainted. Otherwise
+ * it is a line of text, where low-power mode shows a whole number of minutes
+ * as minutes only.
+ *
+ * Parameters:
+ *     ui: the Ui to draw on
+ *     time_left: seconds left in the session
+ *     tenths: tenths of a second to show after time_left, or -1 for none
+ *     paused: whether the session is paused
+ */
+void Ui_show_time_left(Ui *ui, int time_left, int tenths, bool paused);
+
+/*
+ * Send everything drawn since the last flush to the terminal in one update,
+ * as one synchronized frame if base.sync_output is set
+ *
+ * Parameters:
+ *     ui: the Ui to flush
+ */
+void Ui_flush(Ui *ui);
+
+#endif
@@ -1,6 +1,18 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "config.h"
+#include "daemon.h"
 #include "dbg.h"
+#include "export.h"
+#include "history.h"
 #include "minunit.h"
 #include "pomodoro.h"
+#include "stats.h"
 
 char *test_Timer_alloc() {
     Timer *t = Timer_alloc();
@@ -184,6 +196,1263 @@ char *test_Timer_tick_stops_at_zero() {
     return NULL;
 }
 
+char *test_Timer_tick_no_drift() {
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    int seconds = 2;
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long int rc = Timer_set(t, 0, 0, seconds);
+    mu_assert(rc == 0, "Timer_set failed");
+    while ((rc = Timer_tick(t)) > 0) {
+        usleep(300000); // simulate slow rendering between ticks
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1e9;
+    mu_assert(elapsed < seconds + 0.1,
+            "Expected %d s countdown to finish on time, took %f s",
+            seconds, elapsed);
+
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_Clock_init_system_bad_id() {
+    Clock c;
+    int rc = Clock_init_system(&c, CLOCK_PROCESS_CPUTIME_ID);
+    mu_assert(rc == -1, "With a CPU-time clock, expected rc -1, got %d", rc);
+    rc = Clock_init_system(&c, CLOCK_BOOTTIME);
+    mu_assert(rc == 0, "With CLOCK_BOOTTIME, expected rc 0, got %d", rc);
+    rc = Clock_advance(&c, NSEC_PER_SEC);
+    mu_assert(rc == -1, "Advancing a system clock, expected rc -1, got %d",
+            rc);
+
+    return NULL;
+}
+
+char *test_Clock_virtual() {
+    Clock c;
+    int rc = Clock_init_virtual(&c, 5 * NSEC_PER_SEC);
+    mu_assert(rc == 0, "Clock_init_virtual failed");
+    mu_assert(Clock_now(&c) == 5 * NSEC_PER_SEC,
+            "Expected virtual clock to start at 5 s");
+
+    rc = Clock_advance(&c, NSEC_PER_SEC);
+    mu_assert(rc == 0 && Clock_now(&c) == 6 * NSEC_PER_SEC,
+            "Expected virtual clock at 6 s after advancing");
+    rc = Clock_advance(&c, -1);
+    mu_assert(rc == -1, "Moving a clock backwards, expected rc -1, got %d",
+            rc);
+
+    rc = Clock_sleep_until(&c, 10 * NSEC_PER_SEC);
+    mu_assert(rc == 0 && Clock_now(&c) == 10 * NSEC_PER_SEC,
+            "Expected sleep to jump virtual clock to 10 s");
+    rc = Clock_sleep_until(&c, 3 * NSEC_PER_SEC);
+    mu_assert(rc == 0 && Clock_now(&c) == 10 * NSEC_PER_SEC,
+            "Expected sleep into the past to leave virtual clock alone");
+
+    return NULL;
+}
+
+char *test_Timer_tick_past_deadline() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    int rc = Timer_set_clock(t, &c);
+    mu_assert(rc == 0, "Timer_set_clock failed");
+
+    rc = Timer_set(t, 0, 1, 30);
+    mu_assert(rc == 0, "Timer_set failed");
+    /* As if the machine slept through the whole session */
+    Clock_advance(&c, 2 * SECONDS_PER_MINUTE * NSEC_PER_SEC);
+    rc = Timer_tick(t);
+    mu_assert(rc == 0, "Expected timer to land on 0 after suspend, got %d",
+            rc);
+    rc = Timer_tick(t);
+    mu_assert(rc == -1, "Expected expired timer to stop at once, got %d", rc);
+
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_Timer_tick_virtual_no_drift() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    Timer_set_clock(t, &c);
+
+    int rc = Timer_set(t, 0, 25, 0);
+    mu_assert(rc == 0, "Timer_set failed");
+    int ticks = 0;
+    while ((rc = Timer_tick(t)) > 0) {
+        ticks++;
+        Clock_advance(&c, NSEC_PER_SEC / 3); // slow rendering
+    }
+    mu_assert(Clock_now(&c) == 25 * SECONDS_PER_MINUTE * NSEC_PER_SEC,
+            "Expected session to end exactly at 25 min, ended at %lld ns",
+            (long long)Clock_now(&c));
+    mu_assert(ticks == 25 * SECONDS_PER_MINUTE - 1,
+            "Expected one tick per second, got %d", ticks);
+
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_TimerSet() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    TimerSet s;
+    int rc = TimerSet_init(&s, &c, 4);
+    mu_assert(rc == 0, "TimerSet_init failed");
+    mu_assert(TimerSet_next_deadline(&s) == TIMERSET_NEVER,
+            "Empty set has a deadline");
+    /* Free slots, the last on the free list included, are not timers */
+    mu_assert(TimerSet_arm(&s, s.capacity - 1, NSEC_PER_SEC) == -1,
+            "Armed the last free slot");
+    mu_assert(TimerSet_arm(&s, 3, NSEC_PER_SEC) == -1,
+            "Armed a timer that was never added");
+
+    /* More timers than the pool starts with, at scattered deadlines */
+    enum { N = 5000 };
+    static int ids[N];
+    uint32_t seed = 12345;
+    for (int i = 0; i < N; i++) {
+        ids[i] = TimerSet_add(&s, &ids[i]);
+        mu_assert(ids[i] == i, "Expected timer %d, got %d", i, ids[i]);
+        seed = seed * 1103515245 + 12345;
+        rc = TimerSet_arm(&s, ids[i], 2 * NSEC_PER_SEC + seed % 100000);
+        mu_assert(rc == 0, "TimerSet_arm failed");
+    }
+    mu_assert(TimerSet_data(&s, 42) == &ids[42], "Lost a timer's data");
+    /* Every third timer cancelled, every fifth moved to the end */
+    for (int i = 0; i < N; i += 3) {
+        TimerSet_cancel(&s, ids[i]);
+    }
+    for (int i = 0; i < N; i += 5) {
+        TimerSet_arm(&s, ids[i], 3 * NSEC_PER_SEC + i);
+    }
+    rc = TimerSet_remove(&s, ids[5]);
+    mu_assert(rc == 0, "TimerSet_remove failed");
+    mu_assert(TimerSet_remove(&s, ids[5]) == -1, "Removed a timer twice");
+    mu_assert(TimerSet_arm(&s, ids[5], 0) == -1, "Armed a removed timer");
+    int reused = TimerSet_add(&s, NULL);
+    mu_assert(reused == 5, "Pool did not reuse a slot");
+    mu_assert(TimerSet_add(&s, NULL) == N, "Handed out a slot twice");
+    /* The very start of the clock is a deadline like any other */
+    TimerSet_arm(&s, reused, 0);
+    int armed = s.heap_len;
+
+    /* Timers come out in deadline order, each only once */
+    static int expired[N];
+    int total = 0;
+    int64_t last = 0;
+    while (TimerSet_next_deadline(&s) != TIMERSET_NEVER) {
+        int64_t next = TimerSet_next_deadline(&s);
+        mu_assert(next >= last, "Deadlines out of order");
+        int got = TimerSet_wait(&s, expired, 7);
+        mu_assert(got > 0 && Clock_now(&c) == next,
+                "Expected to wake at the earliest deadline");
+        for (int j = 0; j < got; j++) {
+            mu_assert(s.slots[expired[j]].deadline_ns <= next,
+                    "Expired a timer early");
+            mu_assert(s.slots[expired[j]].heap_index == -1,
+                    "Expired timer still armed");
+        }
+        mu_assert(total > 0 || expired[0] == reused,
+                "Expected the timer at 0 first");
+        total += got;
+        last = next;
+    }
+    mu_assert(total == armed, "Expected %d timers to expire, got %d", armed,
+            total);
+    mu_assert(last == 3 * NSEC_PER_SEC + N - 5,
+            "Expected the last deadline at the end of the moved timers");
+    TimerSet_destroy(&s);
+
+    return NULL;
+}
+
+char *test_Schedule_from_sets() {
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+    PomodoroPosition pos;
+    /* 2 sets of 3 x (25 work, 5 rest) + 30 long rest, in seconds */
+    int rc = Schedule_from_sets(s, 25, 5, 30, 3, 2);
+    mu_assert(rc == 0 && s->count == 14, "Schedule_from_sets failed");
+    rc = Schedule_locate(s, 0, &pos);
+    mu_assert(rc == 0, "Schedule_locate failed");
+    mu_assert(pos.state == POMODORO_WORK && pos.phase_index == 0
+            && pos.set_num == 1 && pos.phase_end == 25,
+            "At 0 s, expected first work session, got state %d index %d",
+            pos.state, pos.phase_index);
+
+    rc = Schedule_locate(s, 57, &pos);
+    mu_assert(pos.state == POMODORO_SHORT_REST && pos.phase_index == 3
+            && pos.phase_end == 60,
+            "At 57 s, expected second short rest, got state %d index %d",
+            pos.state, pos.phase_index);
+
+    rc = Schedule_locate(s, 90, &pos);
+    mu_assert(pos.state == POMODORO_LONG_REST && pos.phase_index == 6
+            && pos.phase_end == 120,
+            "At 90 s, expected long rest, got state %d index %d",
+            pos.state, pos.phase_index);
+
+    rc = Schedule_locate(s, 125, &pos);
+    mu_assert(pos.state == POMODORO_WORK && pos.phase_index == 7
+            && pos.set_num == 2 && pos.phase_end == 145,
+            "At 125 s, expected work in set 2, got state %d index %d",
+            pos.state, pos.phase_index);
+
+    rc = Schedule_locate(s, 100000, &pos);
+    mu_assert(pos.state == POMODORO_DONE && pos.phase_index == 14,
+            "Long after the day, expected done, got state %d index %d",
+            pos.state, pos.phase_index);
+
+    rc = Schedule_locate(s, -1, &pos);
+    mu_assert(rc == -1, "With negative elapsed time, expected rc -1, got %d",
+            rc);
+
+    /* Zero-length breaks are left out */
+    rc = Schedule_from_sets(s, 25, 0, 0, 3, 2);
+    mu_assert(rc == 0 && s->count == 6, "Expected 6 work sessions, got %d",
+            s->count);
+    rc = Schedule_from_sets(s, 25, 5, 30, 0, 2);
+    mu_assert(rc == -1, "Expected a set without sessions to be rejected");
+
+    Schedule_destroy(s);
+    return NULL;
+}
+
+char *test_full_day_virtual() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    Timer_set_clock(t, &c);
+
+    /* 4 sets of 4 x (25 min work, 5 min rest) + 30 min long rest */
+    int work = 25 * SECONDS_PER_MINUTE;
+    int rest = 5 * SECONDS_PER_MINUTE;
+    int long_rest = 30 * SECONDS_PER_MINUTE;
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+    int rc = Schedule_from_sets(s, work, rest, long_rest, 4, 4);
+    mu_assert(rc == 0, "Schedule_from_sets failed");
+    int64_t day_start = Clock_now(&c);
+    int64_t expected_end = 0;
+    int phases = 0;
+    PomodoroPosition pos;
+    for (;;) {
+        int64_t elapsed = (Clock_now(&c) - day_start) / NSEC_PER_SEC;
+        rc = Schedule_locate(s, elapsed, &pos);
+        mu_assert(rc == 0, "Schedule_locate failed");
+        if (pos.state == POMODORO_DONE) {
+            break;
+        }
+        mu_assert(pos.phase_index == phases,
+                "Expected phase %d, got phase %d", phases, pos.phase_index);
+        expected_end += pos.state == POMODORO_WORK ? work
+                : pos.state == POMODORO_SHORT_REST ? rest : long_rest;
+        Timer_set_deadline(t, day_start + pos.phase_end * NSEC_PER_SEC);
+        while (Timer_tick(t) != -1);
+        /* The alert for this phase goes off now */
+        mu_assert(Clock_now(&c) - day_start == expected_end * NSEC_PER_SEC,
+                "Phase %d alert at %lld ns, expected %lld s", phases,
+                (long long)(Clock_now(&c) - day_start),
+                (long long)expected_end);
+        phases++;
+    }
+    mu_assert(phases == 4 * (2 * 4 + 1), "Expected 36 phases, got %d",
+            phases);
+    mu_assert(Clock_now(&c) == 600 * SECONDS_PER_MINUTE * NSEC_PER_SEC,
+            "Expected the day to take exactly 10 hours");
+
+    Schedule_destroy(s);
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_Timer_coarse_step() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    Timer_set_clock(t, &c);
+
+    int left[] = { 1500, 601, 600, 61, 60, 11, 10, 1, 0 };
+    int steps[] = { 300, 300, 60, 60, 10, 10, 10, 10, 1 };
+    for (size_t i = 0; i < sizeof(left) / sizeof(left[0]); i++) {
+        Timer_set_deadline(t, Clock_now(&c) + left[i] * NSEC_PER_SEC);
+        int step = Timer_coarse_step(t);
+        mu_assert(step == steps[i], "With %d s left expected a %d s step, "
+                "got %d", left[i], steps[i], step);
+    }
+
+    /* 25:00 left, 5 minute steps: the display changes at 20:00 left */
+    Timer_set_deadline(t, Clock_now(&c) + 1500 * NSEC_PER_SEC);
+    mu_assert(Timer_next_change(t, 300) == Clock_now(&c) + 300 * NSEC_PER_SEC,
+            "Expected the next change 5 minutes out");
+    mu_assert(Timer_next_change(t, 0) == -1, "Accepted a zero step");
+
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_Timer_next_frame() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    Timer_set_clock(t, &c);
+    int64_t tenth = NSEC_PER_SEC / 10;
+
+    /* Deadline off the frame grid: frames still land on the grid */
+    Timer_set_deadline(t, 5 * NSEC_PER_SEC + 12345);
+    int64_t frame = Timer_next_frame(t, tenth, 10);
+    mu_assert(frame == tenth, "Expected the first frame at 0.1 s, got "
+            "%lld", (long long)frame);
+
+    /* A 4 fps cap skips tenths that change between frames */
+    frame = Timer_next_frame(t, tenth, 4);
+    mu_assert(frame == NSEC_PER_SEC / 4, "Expected the frame at 0.25 s, got "
+            "%lld", (long long)frame);
+
+    /* Waking up late drops the missed frames instead of catching up */
+    Clock_advance(&c, 3 * tenth + tenth / 2);
+    frame = Timer_next_frame(t, tenth, 10);
+    mu_assert(frame == 5 * tenth, "Expected the next frame at 0.5 s, got "
+            "%lld", (long long)frame);
+
+    /* The last change, the deadline itself, is never put off */
+    Clock_advance(&c, 5 * NSEC_PER_SEC - 4 * tenth);
+    frame = Timer_next_frame(t, tenth, 10);
+    mu_assert(frame == t->deadline_ns, "Expected the deadline, got %lld",
+            (long long)frame);
+
+    /* Count a whole minute down and check the frame rate cap holds */
+    Timer_set_deadline(t, Clock_now(&c) + 60 * NSEC_PER_SEC);
+    int frames = 0;
+    int64_t last = Clock_now(&c);
+    while (Clock_now(&c) < t->deadline_ns) {
+        frame = Timer_next_frame(t, tenth, 8);
+        mu_assert(frame > last, "Frame did not move forward");
+        mu_assert(frame == t->deadline_ns
+                || frame - last >= NSEC_PER_SEC / 8,
+                "Frames %lld ns apart", (long long)(frame - last));
+        Clock_sleep_until(&c, frame);
+        last = frame;
+        frames++;
+    }
+    mu_assert(frames <= 60 * 8 + 1, "Drew %d frames in a minute", frames);
+    mu_assert(Timer_next_frame(t, tenth, 0) == -1, "Accepted 0 fps");
+
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_low_power_day_virtual() {
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    mu_assert(t != NULL, "Timer_alloc failed.");
+    Timer_set_clock(t, &c);
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+    int rc = Schedule_from_sets(s, 25 * SECONDS_PER_MINUTE,
+            5 * SECONDS_PER_MINUTE, 30 * SECONDS_PER_MINUTE, 4, 4);
+    mu_assert(rc == 0, "Schedule_from_sets failed");
+    Pomodoro p;
+    Pomodoro_init(&p, s);
+
+    /* Wake only when the coarse display changes, as Ui_present does */
+    PomodoroStatus st;
+    long wakeups = 0;
+    int phases = 0;
+    for (;;) {
+        rc = Pomodoro_step(&p, Clock_now(&c), &st);
+        mu_assert(rc == 0, "Pomodoro_step failed");
+        if (st.events & POMODORO_EV_PHASE_END) {
+            phases++;
+            mu_assert(Clock_now(&c) == s->phases[phases - 1].end
+                    * NSEC_PER_SEC, "Phase %d ended late", phases);
+        }
+        if (st.state == POMODORO_DONE) {
+            break;
+        }
+        Timer_set_deadline(t, st.deadline_ns);
+        Clock_sleep_until(&c, Timer_next_change(t, Timer_coarse_step(t)));
+        wakeups++;
+    }
+    mu_assert(phases == 36, "Expected 36 phases, got %d", phases);
+    double per_hour = (double)wakeups * 3600 * NSEC_PER_SEC / Clock_now(&c);
+    mu_assert(per_hour <= 60, "Woke %.1f times per hour", per_hour);
+
+    Schedule_destroy(s);
+    Timer_destroy(t);
+    return NULL;
+}
+
+char *test_Pomodoro_step_transitions() {
+    Pomodoro p;
+    PomodoroStatus st;
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+    /* 1 set of 2 x (25 s work, 5 s rest) + 30 s long rest: 5 phases, 90 s */
+    int rc = Schedule_from_sets(s, 25, 5, 30, 2, 1);
+    mu_assert(rc == 0, "Schedule_from_sets failed");
+    rc = Pomodoro_init(&p, s);
+    mu_assert(rc == 0, "Pomodoro_init failed");
+
+    rc = Pomodoro_step(&p, 0, &st);
+    mu_assert(rc == 0, "Pomodoro_step failed");
+    mu_assert(st.state == POMODORO_WORK
+            && st.events == POMODORO_EV_PHASE_START,
+            "At 0 s, expected work to start, got state %d events %d",
+            st.state, st.events);
+
+    Pomodoro_step(&p, 10 * NSEC_PER_SEC, &st);
+    mu_assert(st.events == POMODORO_EV_NONE
+            && st.remaining_ns == 15 * NSEC_PER_SEC,
+            "At 10 s, expected 15 s left and no events, got %lld ns events %d",
+            (long long)st.remaining_ns, st.events);
+
+    Pomodoro_step(&p, 25 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_SHORT_REST
+            && st.events == (POMODORO_EV_PHASE_END | POMODORO_EV_PHASE_START)
+            && st.deadline_ns == 30 * NSEC_PER_SEC,
+            "At 25 s, expected short rest to start, got state %d events %d",
+            st.state, st.events);
+
+    Pomodoro_step(&p, 200 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_DONE
+            && st.events == (POMODORO_EV_PHASE_END | POMODORO_EV_MISSED
+                    | POMODORO_EV_DONE)
+            && st.missed == 3 && st.remaining_ns == 0,
+            "At 200 s, expected done with 3 missed, got state %d events %d "
+            "missed %d", st.state, st.events, st.missed);
+
+    Pomodoro_step(&p, 300 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_DONE && st.events == POMODORO_EV_NONE,
+            "Once done, expected no further events, got %d", st.events);
+
+    Schedule_destroy(s);
+    return NULL;
+}
+
+char *test_Pomodoro_pause_skip() {
+    Pomodoro p;
+    PomodoroStatus st;
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+    Schedule_from_sets(s, 25, 5, 30, 2, 1);
+    Pomodoro_init(&p, s);
+    Pomodoro_step(&p, 0, &st);
+
+    int rc = Pomodoro_pause(&p, 10 * NSEC_PER_SEC);
+    mu_assert(rc == 0, "Pomodoro_pause failed");
+    Pomodoro_step(&p, 100 * NSEC_PER_SEC, &st);
+    mu_assert(st.paused && st.state == POMODORO_WORK
+            && st.remaining_ns == 15 * NSEC_PER_SEC,
+            "While paused, expected 15 s of work left, got state %d %lld ns",
+            st.state, (long long)st.remaining_ns);
+
+    rc = Pomodoro_resume(&p, 100 * NSEC_PER_SEC);
+    mu_assert(rc == 0, "Pomodoro_resume failed");
+    Pomodoro_step(&p, 114 * NSEC_PER_SEC, &st);
+    mu_assert(!st.paused && st.state == POMODORO_WORK
+            && st.remaining_ns == NSEC_PER_SEC,
+            "After resuming, expected 1 s of work left, got %lld ns",
+            (long long)st.remaining_ns);
+
+    rc = Pomodoro_skip(&p, 114 * NSEC_PER_SEC);
+    mu_assert(rc == 0, "Pomodoro_skip failed");
+    Pomodoro_step(&p, 114 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_SHORT_REST
+            && st.remaining_ns == 5 * NSEC_PER_SEC
+            && !(st.events & POMODORO_EV_MISSED),
+            "After skipping, expected a full short rest, got state %d %lld ns",
+            st.state, (long long)st.remaining_ns);
+
+    Schedule_destroy(s);
+    return NULL;
+}
+
+char *test_Pomodoro_step_many() {
+    Pomodoro p;
+    PomodoroStatus st;
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+    /* 4 sets of 4 x (25, 5) + 30, stepped every millisecond */
+    Schedule_from_sets(s, 25, 5, 30, 4, 4);
+    Pomodoro_init(&p, s);
+    int starts = 0;
+    int ends = 0;
+    int64_t now = 0;
+    do {
+        int rc = Pomodoro_step(&p, now, &st);
+        mu_assert(rc == 0, "Pomodoro_step failed at %lld ns", (long long)now);
+        starts += (st.events & POMODORO_EV_PHASE_START) != 0;
+        ends += (st.events & POMODORO_EV_PHASE_END) != 0;
+        now += NSEC_PER_SEC / 1000;
+    } while (st.state != POMODORO_DONE);
+
+    mu_assert(starts == 36 && ends == 36,
+            "Expected 36 phase starts and ends, got %d and %d", starts, ends);
+    mu_assert(now == 600 * NSEC_PER_SEC + NSEC_PER_SEC / 1000,
+            "Expected the day to end at 600 s, stepped to %lld ns",
+            (long long)now);
+
+    Schedule_destroy(s);
+    return NULL;
+}
+
+char *test_Pomodoro_reschedule() {
+    Pomodoro p;
+    PomodoroStatus st;
+    Schedule *s = Schedule_alloc();
+    Schedule *longer = Schedule_alloc();
+    Schedule *shorter = Schedule_alloc();
+    mu_assert(s != NULL && longer != NULL && shorter != NULL,
+            "Schedule_alloc failed");
+    Schedule_from_sets(s, 25, 5, 30, 2, 1);
+    Schedule_from_sets(longer, 50, 10, 60, 2, 1);
+    Schedule_compile(shorter, "w1 s1");
+    Pomodoro_init(&p, s);
+    Pomodoro_step(&p, 0, &st);
+    Pomodoro_step(&p, 10 * NSEC_PER_SEC, &st);
+
+    int rc = Pomodoro_reschedule(&p, longer);
+    mu_assert(rc == 0, "Pomodoro_reschedule failed");
+    Pomodoro_step(&p, 20 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_WORK && st.events == POMODORO_EV_NONE
+            && st.deadline_ns == 25 * NSEC_PER_SEC,
+            "Expected the current phase to keep its deadline, got state %d "
+            "deadline %lld ns", st.state, (long long)st.deadline_ns);
+    Pomodoro_step(&p, 25 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_SHORT_REST
+            && st.events == (POMODORO_EV_PHASE_END | POMODORO_EV_PHASE_START)
+            && st.deadline_ns == 35 * NSEC_PER_SEC,
+            "Expected a 10 s short rest next, got state %d deadline %lld ns",
+            st.state, (long long)st.deadline_ns);
+    Pomodoro_step(&p, 35 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_WORK && st.phase_index == 2
+            && st.deadline_ns == 85 * NSEC_PER_SEC,
+            "Expected 50 s of work third, got state %d deadline %lld ns",
+            st.state, (long long)st.deadline_ns);
+
+    /* Two phases in, a two-phase schedule has nothing left to run */
+    rc = Pomodoro_reschedule(&p, shorter);
+    mu_assert(rc == 0, "Pomodoro_reschedule failed");
+    Pomodoro_step(&p, 80 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_WORK
+            && st.remaining_ns == 5 * NSEC_PER_SEC,
+            "Expected 5 s of work left, got state %d %lld ns", st.state,
+            (long long)st.remaining_ns);
+    Pomodoro_step(&p, 85 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_DONE
+            && st.events == (POMODORO_EV_PHASE_END | POMODORO_EV_DONE),
+            "Expected the day to end with the phase, got state %d events %d",
+            st.state, st.events);
+
+    Schedule_destroy(s);
+    Schedule_destroy(longer);
+    Schedule_destroy(shorter);
+    return NULL;
+}
+
+char *test_Pomodoro_restore() {
+    Pomodoro p;
+    PomodoroStatus st;
+    Schedule *s = Schedule_alloc();
+    Schedule *same = Schedule_alloc();
+    mu_assert(s != NULL && same != NULL, "Schedule_alloc failed");
+    Schedule_from_sets(s, 25 * SECONDS_PER_MINUTE, 5 * SECONDS_PER_MINUTE,
+            30 * SECONDS_PER_MINUTE, 2, 1);
+    Schedule_compile(same, "2*(w25 s5) l30");
+    mu_assert(Schedule_hash(s) == Schedule_hash(same),
+            "Equal schedules hashed differently");
+    Schedule_compile(same, "2*(w25 s5) l31");
+    mu_assert(Schedule_hash(s) != Schedule_hash(same),
+            "Different schedules hashed the same");
+
+    /* Two phases in, with 7 s of the work session left */
+    Pomodoro_init(&p, s);
+    int rc = Pomodoro_restore(&p, 2, 1007 * NSEC_PER_SEC,
+            1000 * NSEC_PER_SEC, 0);
+    mu_assert(rc == 0, "Pomodoro_restore failed");
+    Pomodoro_step(&p, 1000 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_WORK && st.phase_index == 2
+            && st.events == POMODORO_EV_NONE
+            && st.remaining_ns == 7 * NSEC_PER_SEC,
+            "Expected 7 s left in phase 2, got state %d index %d %lld ns",
+            st.state, st.phase_index, (long long)st.remaining_ns);
+    Pomodoro_step(&p, 1007 * NSEC_PER_SEC, &st);
+    mu_assert(st.state == POMODORO_SHORT_REST && st.phase_index == 3
+            && st.missed == 0 && st.deadline_ns == 1307 * NSEC_PER_SEC,
+            "Expected the short rest next, got state %d index %d",
+            st.state, st.phase_index);
+    rc = Pomodoro_restore(&p, 0, 0, 0, 0);
+    mu_assert(rc == -1, "Expected a started day not to be restored");
+
+    /* Paused, the time left holds until the day is resumed */
+    Pomodoro_init(&p, s);
+    Pomodoro_restore(&p, 4, 30 * NSEC_PER_SEC, 10 * NSEC_PER_SEC, 1);
+    Pomodoro_step(&p, 500 * NSEC_PER_SEC, &st);
+    mu_assert(st.paused && st.state == POMODORO_LONG_REST
+            && st.remaining_ns == 20 * NSEC_PER_SEC,
+            "Expected a paused long rest with 20 s left, got state %d "
+            "%lld ns", st.state, (long long)st.remaining_ns);
+    rc = Pomodoro_restore(&p, 5, 0, 0, 0);
+    mu_assert(rc == -1, "Expected a phase past the end to be rejected");
+
+    Checkpoint cp = { .schedule_hash = Schedule_hash(s), .phase_index = 2,
+            .paused = 0, .deadline_ns = 1234, .remaining_ns = 0,
+            .profile = "deep" };
+    Checkpoint back;
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    int fd = mkstemp(path);
+    mu_assert(fd != -1, "Failed to make a temporary checkpoint file");
+    close(fd);
+    mu_assert(Checkpoint_load(path, &back) == -1,
+            "Expected an empty checkpoint to be rejected");
+    rc = Checkpoint_save(path, &cp);
+    mu_assert(rc == 0, "Checkpoint_save failed");
+    rc = Checkpoint_load(path, &back);
+    mu_assert(rc == 0 && memcmp(&cp, &back, sizeof(cp)) == 0,
+            "Checkpoint did not load back the same");
+    rc = Checkpoint_clear(path);
+    mu_assert(rc == 0 && Checkpoint_load(path, &back) == -1
+            && Checkpoint_clear(path) == 0,
+            "Expected a cleared checkpoint to be gone");
+    char long_path[PATH_MAX];
+    memset(long_path, 'a', sizeof(long_path) - 1);
+    long_path[sizeof(long_path) - 1] = '\0';
+    mu_assert(Checkpoint_save(long_path, &cp) == -1,
+            "Expected a checkpoint path too long for its temporary file to "
+            "be rejected");
+
+    Schedule_destroy(same);
+    Schedule_destroy(s);
+    return NULL;
+}
+
+char *test_Schedule_compile() {
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+
+    int rc = Schedule_compile(s, "3*(w25 s5) l30");
+    mu_assert(rc == 0, "Failed to compile the classic day");
+    mu_assert(s->count == 7, "Expected 7 phases, got %d", s->count);
+    mu_assert(Schedule_length(s) == 120 * SECONDS_PER_MINUTE,
+            "Expected a 120 minute day, got %lld s",
+            (long long)Schedule_length(s));
+
+    /* Must match the same day laid out from the set lengths */
+    Schedule *sets = Schedule_alloc();
+    mu_assert(sets != NULL, "Schedule_alloc failed");
+    rc = Schedule_from_sets(sets, 25 * SECONDS_PER_MINUTE,
+            5 * SECONDS_PER_MINUTE, 30 * SECONDS_PER_MINUTE, 3, 1);
+    mu_assert(rc == 0 && Schedule_hash(s) == Schedule_hash(sets),
+            "Compiled schedule differs from Schedule_from_sets");
+    PomodoroPosition a;
+    PomodoroPosition b;
+    for (int64_t t = 0; t <= 130 * SECONDS_PER_MINUTE; t += 7) {
+        Schedule_locate(s, t, &a);
+        Schedule_locate(sets, t, &b);
+        mu_assert(a.state == b.state && a.phase_index == b.phase_index
+                && a.phase_end == b.phase_end && a.set_num == b.set_num,
+                "At %lld s, compiled schedule disagrees with "
+                "Schedule_from_sets", (long long)t);
+    }
+    Schedule_destroy(sets);
+
+    rc = Schedule_compile(s, "2*(2*(w50,s10) l30), w90");
+    mu_assert(rc == 0, "Failed to compile a nested schedule");
+    mu_assert(s->count == 11, "Expected 11 phases, got %d", s->count);
+    rc = Schedule_locate(s, 300 * SECONDS_PER_MINUTE, &a);
+    mu_assert(a.state == POMODORO_WORK && a.set_num == 3
+            && a.phase_index == 10,
+            "At 300 min, expected the final work session of set 3, got state "
+            "%d set %d index %d", a.state, a.set_num, a.phase_index);
+
+    char *bad[] = { "", "w", "x25", "w0", "3*", "(w25", "w25)", "3 w25" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        rc = Schedule_compile(s, bad[i]);
+        mu_assert(rc == -1, "Expected '%s' to be rejected", bad[i]);
+    }
+
+    Schedule_destroy(s);
+    return NULL;
+}
+
+char *test_Schedule_large() {
+    Schedule *s = Schedule_alloc();
+    mu_assert(s != NULL, "Schedule_alloc failed");
+
+    /* 1000 sets of 4 x (w25 s5) + l30: 9000 phases */
+    int rc = Schedule_compile(s, "1000*(4*(w25 s5) l30)");
+    mu_assert(rc == 0, "Failed to compile a long schedule");
+    mu_assert(s->count == 9000, "Expected 9000 phases, got %d", s->count);
+    mu_assert(Schedule_length(s) == 1000LL * 150 * SECONDS_PER_MINUTE,
+            "Unexpected day length %lld s", (long long)Schedule_length(s));
+
+    PomodoroPosition pos;
+    rc = Schedule_locate(s, 999LL * 150 * SECONDS_PER_MINUTE + 1, &pos);
+    mu_assert(rc == 0 && pos.phase_index == 8991 && pos.set_num == 1000,
+            "Expected first phase of the last set, got index %d set %d",
+            pos.phase_index, pos.set_num);
+
+    rc = Schedule_compile(s, "9999*(9999*(w1))");
+    mu_assert(rc == -1, "Expected an oversized schedule to be rejected");
+    /* Few phases, but too long a day to count in nanoseconds */
+    rc = Schedule_compile(s, "1000*(w1048576)");
+    mu_assert(rc == -1, "Expected an overlong day to be rejected");
+
+    Schedule_destroy(s);
+    return NULL;
+}
+
+/* Replace the contents of a file; returns 0 on success, -1 on failure */
+static int rewrite_file(const char *path, const char *text) {
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t len = strlen(text);
+    ssize_t written = write(fd, text, len);
+    close(fd);
+    return written == len ? 0 : -1;
+}
+
+/* Load a config file; returns its [timer] work_length, or -1 on failure */
+static int loaded_work_length(const char *path) {
+    ConfigFile *cf = Config_alloc();
+    configuration c;
+    int rc = cf != NULL ? Config_load(cf, path) : -1;
+    rc = rc == 0 ? Config_resolve(cf, 0, &c) : rc;
+    if (cf != NULL) {
+        Config_destroy(cf);
+    }
+    if (rc != 0) {
+        return -1;
+    }
+    free(c.schedule);
+    return c.work_length;
+}
+
+char *test_Config_load_profiles() {
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    char cache_path[sizeof(path) + 6];
+    int fd = mkstemp(path);
+    mu_assert(fd != -1, "Failed to make a temporary config file");
+    snprintf(cache_path, sizeof(cache_path), "%s.cache", path);
+    const char *ini = "[timer]\nwork_length = 25\nalert_type = beep\n"
+            "[profile.deep]\nschedule = 2*(w50 s10) l30\n"
+            "[profile.meetings]\nwork_length = 15\n";
+    mu_assert(write(fd, ini, strlen(ini)) == (ssize_t)strlen(ini),
+            "Failed to write the temporary config file");
+    close(fd);
+
+    /* Parsed and cached the first time, read from the cache the second */
+    for (int pass = 0; pass < 2; pass++) {
+        ConfigFile *cf = Config_alloc();
+        mu_assert(cf != NULL, "Config_alloc failed");
+        int rc = Config_load(cf, path);
+        mu_assert(rc == 0, "Config_load failed on pass %d", pass);
+        mu_assert(access(cache_path, F_OK) == 0, "No cache was written");
+        mu_assert(cf->count == 3, "Expected 3 sections, got %d", cf->count);
+
+        int deep = Config_find(cf, "deep");
+        int meetings = Config_find(cf, "meetings");
+        mu_assert(deep == 1 && meetings == 2,
+                "Expected profiles at 1 and 2, got %d and %d", deep, meetings);
+        mu_assert(Config_find(cf, "none") == -1, "Found a missing profile");
+
+        configuration c;
+        rc = Config_resolve(cf, deep, &c);
+        mu_assert(rc == 0, "Config_resolve failed");
+        mu_assert(c.work_length == 25 && c.alert_type == ALERT_BEEP
+                && c.schedule != NULL
+                && strcmp(c.schedule, "2*(w50 s10) l30") == 0,
+                "Profile deep did not keep [timer] and add its schedule");
+        free(c.schedule);
+        rc = Config_resolve(cf, meetings, &c);
+        mu_assert(rc == 0 && c.work_length == 15 && c.schedule == NULL,
+                "Profile meetings did not override work_length");
+        Config_destroy(cf);
+    }
+
+    /* A different file is parsed again */
+    struct stat st;
+    mu_assert(rewrite_file(path, "[timer]\nwork_length = 30\n") == 0,
+            "Failed to rewrite the config file");
+    mu_assert(stat(path, &st) == 0, "Failed to stat the config file");
+    mu_assert(loaded_work_length(path) == 30,
+            "Expected the rewritten work_length loaded");
+
+    /* Only the size and mtime are compared, so both must be looked at */
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    mu_assert(rewrite_file(path, "[timer]\nwork_length = 35\n") == 0,
+            "Failed to rewrite the config file");
+    utimensat(AT_FDCWD, path, times, 0);
+    mu_assert(loaded_work_length(path) == 30,
+            "Expected the cache used while size and mtime match");
+    times[1].tv_sec += 1;
+    utimensat(AT_FDCWD, path, times, 0);
+    mu_assert(loaded_work_length(path) == 35,
+            "Expected a new mtime to invalidate the cache");
+
+    /* A damaged cache is parsed around and written again */
+    mu_assert(rewrite_file(cache_path, "garbage") == 0,
+            "Failed to corrupt the cache");
+    mu_assert(loaded_work_length(path) == 35,
+            "Expected a clean parse past a corrupt cache");
+    mu_assert(stat(cache_path, &st) == 0 && st.st_size > 7,
+            "Corrupt cache was not written again");
+    mu_assert(truncate(cache_path, st.st_size - 1) == 0,
+            "Failed to truncate the cache");
+    mu_assert(loaded_work_length(path) == 35,
+            "Expected a clean parse past a truncated cache");
+
+    unlink(cache_path);
+    unlink(path);
+    return NULL;
+}
+
+/*
+ * A phase for a test history log, planned to run as long as it did.
+ */
+static HistoryRecord phase(int64_t start, uint32_t duration, STATE state,
+        HISTORY_OUTCOME outcome) {
+    HistoryRecord r;
+    memset(&r, 0, sizeof(r));
+    r.start = start;
+    r.duration = duration;
+    r.planned = duration;
+    r.state = state;
+    r.outcome = outcome;
+    return r;
+}
+
+/*
+ * Make a temporary history log holding the records given.
+ *
+ * Parameters:
+ *     path: a mkstemp template, filled in with the log's path
+ *     records: the records to log
+ *     n: the number of records
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int make_history(char *path, HistoryRecord *records, int n) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        return -1;
+    }
+    close(fd);
+    History h;
+    if (History_open(&h, path) != 0) {
+        return -1;
+    }
+    int rc = 0;
+    for (int i = 0; rc == 0 && i < n; i += HISTORY_BATCH) {
+        int batch = n - i < HISTORY_BATCH ? n - i : HISTORY_BATCH;
+        rc = History_append(&h, records + i, batch);
+    }
+    History_close(&h);
+    return rc;
+}
+
+char *test_History_append_map() {
+    HistoryRecord batch[] = {
+        phase(1000, 60, POMODORO_WORK, HISTORY_COMPLETED),
+        phase(1060, 60, POMODORO_SHORT_REST, HISTORY_COMPLETED),
+        phase(1120, 60, POMODORO_WORK, HISTORY_COMPLETED)
+    };
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    int rc = make_history(path, batch, 3);
+    mu_assert(rc == 0, "Failed to make a history log");
+
+    History h;
+    rc = History_open(&h, path);
+    mu_assert(rc == 0, "History_open failed to reopen the log");
+    /* Half a record, as a crash in the middle of a write would leave */
+    rc = write(h.fd, &batch[0], sizeof(HistoryRecord) / 2);
+    History_close(&h);
+
+    rc = History_open(&h, path);
+    mu_assert(rc == 0, "History_open failed to reopen the log again");
+    batch[0].start = 2000;
+    batch[0].outcome = HISTORY_SKIPPED;
+    rc = History_append(&h, batch, 1);
+    mu_assert(rc == 0, "History_append failed after reopening");
+    History_close(&h);
+
+    HistoryMap m;
+    rc = HistoryMap_open(&m, path);
+    mu_assert(rc == 0, "HistoryMap_open failed");
+    mu_assert(m.count == 4, "Expected the torn record cut off, got %zu "
+            "records", m.count);
+    for (size_t i = 0; i < m.count; i++) {
+        mu_assert(History_record_ok(&m.records[i]),
+                "Record %zu failed its checksum", i);
+    }
+    mu_assert(m.records[2].start == 1120 && m.records[3].start == 2000
+            && m.records[3].outcome == HISTORY_SKIPPED,
+            "Records did not map back in order");
+    HistoryRecord changed = m.records[1];
+    changed.duration = 59;
+    mu_assert(!History_record_ok(&changed),
+            "Expected a changed record to fail its checksum");
+    HistoryMap_close(&m);
+
+    /* A header torn by a crash while the log was being started */
+    rc = truncate(path, 7);
+    mu_assert(rc == 0, "Failed to tear the header");
+    rc = History_open(&h, path);
+    mu_assert(rc == 0, "History_open failed on a torn header");
+    rc = History_append(&h, batch, 1);
+    mu_assert(rc == 0, "History_append failed after a torn header");
+    History_close(&h);
+    rc = HistoryMap_open(&m, path);
+    mu_assert(rc == 0 && m.count == 1 && History_record_ok(&m.records[0]),
+            "Expected the log started again with 1 record");
+    HistoryMap_close(&m);
+
+    unlink(path);
+    return NULL;
+}
+
+char *test_Stats_rollups() {
+    /* Work on days 100, 101 and 103, with a break and a skip on day 101 */
+    HistoryRecord batch[] = {
+        phase(100 * SECONDS_PER_DAY, 1500, POMODORO_WORK, HISTORY_COMPLETED),
+        phase(101 * SECONDS_PER_DAY + 3600, 1500, POMODORO_WORK,
+                HISTORY_COMPLETED),
+        phase(101 * SECONDS_PER_DAY + 7200, 1500, POMODORO_SHORT_REST,
+                HISTORY_COMPLETED),
+        phase(101 * SECONDS_PER_DAY + 10800, 1500, POMODORO_WORK,
+                HISTORY_SKIPPED),
+        phase(103 * SECONDS_PER_DAY + 14400, 1500, POMODORO_WORK,
+                HISTORY_COMPLETED)
+    };
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    char rollup_path[sizeof(path) + 7];
+    int rc = make_history(path, batch, 4);
+    mu_assert(rc == 0, "Failed to make a history log");
+    snprintf(rollup_path, sizeof(rollup_path), "%s.rollup", path);
+
+    StatsIndex *idx = Stats_alloc();
+    mu_assert(idx != NULL, "Stats_alloc failed");
+    rc = Stats_refresh(idx, path, rollup_path, 0);
+    mu_assert(rc == 0 && idx->count == 2 && idx->folded == 4,
+            "Expected 2 days from 4 records, got %zu from %llu", idx->count,
+            (unsigned long long)idx->folded);
+    Stats_destroy(idx);
+
+    /* Only the new record is read, on top of the saved rollups */
+    History h;
+    History_open(&h, path);
+    History_append(&h, &batch[4], 1);
+    History_close(&h);
+    HistoryMap m;
+    idx = Stats_alloc();
+    Stats_load(idx, rollup_path);
+    mu_assert(idx->count == 2, "Rollups did not load back");
+    HistoryMap_open(&m, path);
+    long got = Stats_update(idx, &m, 0);
+    mu_assert(got == 1, "Expected 1 new record read, got %ld", got);
+
+    StatsTotals t;
+    Stats_sum(idx, 101, 101, &t);
+    mu_assert(t.focused == 3000 && t.started == 2 && t.completed == 1
+            && t.interrupted == 1,
+            "Unexpected day 101: %llu s, %u started, %u done, %u cut",
+            (unsigned long long)t.focused, t.started, t.completed,
+            t.interrupted);
+    Stats_sum(idx, INT32_MIN, INT32_MAX, &t);
+    mu_assert(t.completed == 3 && t.active_days == 3,
+            "Expected 3 sessions on 3 days, got %u on %u", t.completed,
+            t.active_days);
+    int longest;
+    int current;
+    Stats_streaks(idx, 104, &longest, &current);
+    mu_assert(longest == 2 && current == 1,
+            "Expected streaks of 2 and 1, got %d and %d", longest, current);
+    Stats_streaks(idx, 105, &longest, &current);
+    mu_assert(current == 0, "Expected the streak over, got %d", current);
+
+    /* Counted in another offset, the days are built again */
+    got = Stats_update(idx, &m, -7200);
+    mu_assert(got == 5 && idx->days[0].day == 99,
+            "Expected a rebuild into day 99, got %ld records, day %d", got,
+            idx->days[0].day);
+    HistoryMap_close(&m);
+    Stats_destroy(idx);
+
+    unlink(rollup_path);
+    unlink(path);
+    return NULL;
+}
+
+char *test_Export_history() {
+    char out_path[] = "/tmp/pomodoro_tests_XXXXXX";
+    int out = mkstemp(out_path);
+    mu_assert(out != -1, "Failed to make a temporary output file");
+
+    int32_t day;
+    int rc = Export_parse_date("2024-02-29", &day);
+    mu_assert(rc == 0 && day == 19782, "Expected day 19782, got %d", day);
+    rc = Export_parse_date("2024-2-30x", &day);
+    mu_assert(rc == -1, "Parsed a date with junk after it");
+    mu_assert(Export_parse_format("ics") == EXPORT_ICS
+            && Export_parse_format("xml") == -1, "Bad export format names");
+
+    /* A work session missed on 2024-02-28, then one done on 2024-02-29 */
+    HistoryRecord batch[] = {
+        phase(19781LL * SECONDS_PER_DAY + 3600, 0, POMODORO_WORK,
+                HISTORY_MISSED),
+        phase(19782LL * SECONDS_PER_DAY + 23 * 3600 + 50 * 60, 1500,
+                POMODORO_WORK, HISTORY_COMPLETED)
+    };
+    batch[0].planned = 1500;
+    batch[1].paused = 60;
+    batch[1].phase_index = 2;
+    batch[1].set_num = 1;
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    rc = make_history(path, batch, 2);
+    mu_assert(rc == 0, "Failed to make a history log");
+
+    HistoryMap m;
+    HistoryMap_open(&m, path);
+    Exporter *e = malloc(sizeof(Exporter));
+    Export_begin(e, out, EXPORT_CSV, 0, INT32_MIN, INT32_MAX);
+    long got = Export_history(e, &m);
+    Export_end(e);
+    mu_assert(got == 2, "Expected 2 CSV lines, got %ld", got);
+    Export_begin(e, out, EXPORT_ICS, 0, day, day);
+    got = Export_history(e, &m);
+    Export_end(e);
+    mu_assert(got == 1, "Expected 1 event, got %ld", got);
+    HistoryMap_close(&m);
+    free(e);
+
+    char text[2048];
+    ssize_t len = pread(out, text, sizeof(text) - 1, 0);
+    close(out);
+    mu_assert(len > 0, "Nothing was exported");
+    text[len] = '\0';
+    mu_assert(strstr(text, "1,2024-02-28 01:00:00,2024-02-28 01:00:00,work,"
+            "0,0,0,1500,0,missed,0,0,0\n") != NULL, "Missing the missed session");
+    mu_assert(strstr(text, "1,2024-02-29 23:50:00,2024-03-01 00:16:00,work,"
+            "1,2,1500,1500,60,completed,1,1,0\n") != NULL,
+            "Missing the completed session");
+    mu_assert(strstr(text, "DTSTART:20240229T235000Z\r\n"
+            "DTEND:20240301T001600Z\r\n") != NULL, "Bad event times");
+    mu_assert(strstr(text, "SUMMARY:Work session (missed)") == NULL,
+            "Exported a missed session as an event");
+    mu_assert(strstr(text, "END:VCALENDAR\r\n") != NULL,
+            "Calendar left open");
+
+    unlink(out_path);
+    unlink(path);
+    return NULL;
+}
+
+char *test_Export_date_range() {
+    /* A work session every hour for a year, so most are passed over */
+    int n = 366 * 24;
+    HistoryRecord *batch = malloc(n * sizeof(HistoryRecord));
+    mu_assert(batch != NULL, "Failed to allocate records");
+    for (int i = 0; i < n; i++) {
+        batch[i] = phase(19723LL * SECONDS_PER_DAY + i * 3600LL, 1500,
+                POMODORO_WORK, HISTORY_COMPLETED);
+    }
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    int rc = make_history(path, batch, n);
+    free(batch);
+    mu_assert(rc == 0, "Failed to make a history log");
+    int out = open("/dev/null", O_WRONLY);
+    mu_assert(out != -1, "Failed to open /dev/null");
+
+    HistoryMap m;
+    HistoryMap_open(&m, path);
+    Exporter *e = malloc(sizeof(Exporter));
+    int32_t day = 19723 + 300;
+    Export_begin(e, out, EXPORT_CSV, 0, day, day);
+    long got = Export_history(e, &m);
+    Export_end(e);
+    mu_assert(got == 24, "Expected 24 CSV lines for one day, got %ld", got);
+    Export_begin(e, out, EXPORT_ICS, 0, day - 1, day + 1);
+    got = Export_history(e, &m);
+    Export_end(e);
+    mu_assert(got == 72, "Expected 72 events for three days, got %ld", got);
+    for (int i = 0; i < n; i++) {
+        mu_assert(History_record_ok(&m.records[i]),
+                "Record %d unreadable after its pages were dropped", i);
+    }
+    HistoryMap_close(&m);
+    free(e);
+
+    close(out);
+    unlink(path);
+    return NULL;
+}
+
+char *test_History_compact() {
+    /* Two work sessions and a break on day 100, one on day 101 and 200 */
+    HistoryRecord batch[] = {
+        phase(100 * SECONDS_PER_DAY, 1500, POMODORO_WORK, HISTORY_COMPLETED),
+        phase(100 * SECONDS_PER_DAY + 1800, 300, POMODORO_SHORT_REST,
+                HISTORY_COMPLETED),
+        phase(100 * SECONDS_PER_DAY + 3600, 1500, POMODORO_WORK,
+                HISTORY_SKIPPED),
+        phase(101 * SECONDS_PER_DAY + 5400, 1500, POMODORO_WORK,
+                HISTORY_COMPLETED),
+        phase(200 * SECONDS_PER_DAY + 7200, 1500, POMODORO_WORK,
+                HISTORY_COMPLETED)
+    };
+    char path[] = "/tmp/pomodoro_tests_XXXXXX";
+    int rc = make_history(path, batch, 5);
+    mu_assert(rc == 0, "Failed to make a history log");
+    /* Open before compacting, as a running timer would be */
+    History h;
+    History_open(&h, path);
+
+    StatsIndex *idx = Stats_alloc();
+    HistoryMap m;
+    HistoryMap_open(&m, path);
+    Stats_update(idx, &m, 0);
+    HistoryMap_close(&m);
+    StatsTotals full;
+    Stats_sum(idx, INT32_MIN, INT32_MAX, &full);
+
+    long got = History_compact(path, 150, 0);
+    mu_assert(got == 4, "Expected 4 records compacted, got %ld", got);
+    /* Still open on the old log, which has to follow it to the new one */
+    batch[0].start = 201LL * SECONDS_PER_DAY;
+    rc = History_append(&h, batch, 1);
+    mu_assert(rc == 0, "History_append failed after compaction");
+    History_close(&h);
+
+    HistoryMap_open(&m, path);
+    mu_assert(m.count == 4, "Expected 2 summaries and 2 records, got %zu",
+            m.count);
+    const HistorySummary *sum = (const HistorySummary *)&m.records[0];
+    mu_assert(History_record_ok(&m.records[0])
+            && sum->outcome == HISTORY_SUMMARY && sum->phases == 3
+            && sum->focused == 3000 && sum->started == 2
+            && sum->completed == 1 && sum->interrupted == 1
+            && sum->start == 100 * SECONDS_PER_DAY && sum->span == 5100,
+            "Bad summary of day 100");
+    mu_assert(m.records[2].start == 200 * SECONDS_PER_DAY + 7200
+            && m.records[3].start == 201 * SECONDS_PER_DAY,
+            "Recent records were not kept as they were");
+
+    /* The rollups see a new log, and count the same as before */
+    got = Stats_update(idx, &m, 0);
+    mu_assert(got == 4, "Expected the rollups rebuilt, got %ld records",
+            got);
+    StatsTotals now;
+    Stats_sum(idx, INT32_MIN, 200, &now);
+    mu_assert(now.focused == full.focused && now.started == full.started
+            && now.completed == full.completed
+            && now.interrupted == full.interrupted,
+            "Compaction changed the totals");
+    HistoryMap_close(&m);
+    Stats_destroy(idx);
+
+    got = History_compact(path, 150, 0);
+    mu_assert(got == 0, "Compacted %ld records a second time", got);
+
+    unlink(path);
+    return NULL;
+}
+
+char *test_Daemon_clients() {
+    for (STATE st = POMODORO_WORK; st <= POMODORO_DONE; st++) {
+        mu_assert(Pomodoro_state_parse(Pomodoro_state_name(st)) == st,
+                "Phase %d did not survive its name", st);
+    }
+    mu_assert(Pomodoro_state_parse("error") == POMODORO_ERROR,
+            "Parsed a name no phase has");
+
+    DaemonEvent ev;
+    int rc = Daemon_parse_event("start short_break 2 1 1500 0", &ev);
+    mu_assert(rc == 0 && ev.kind == DAEMON_EV_START
+            && ev.state == POMODORO_SHORT_REST && ev.set_num == 2
+            && ev.missed == 1 && ev.left_ns == 1500000000LL && !ev.paused,
+            "Misread a start line");
+    rc = Daemon_parse_event("alert flash", &ev);
+    mu_assert(rc == 0 && ev.kind == DAEMON_EV_ALERT
+            && ev.alert == ALERT_FLASH, "Misread an alert line");
+    rc = Daemon_parse_event("state work 1 0 5", &ev);
+    mu_assert(rc == -1, "Parsed a state line with fields missing");
+
+    char dir[] = "/tmp/pomodoro_tests_XXXXXX";
+    mu_assert(mkdtemp(dir) != NULL, "Failed to make a temporary directory");
+    char path[64];
+    snprintf(path, sizeof(path), "%s/socket", dir);
+    Clock c;
+    Clock_init_virtual(&c, 0);
+    Timer *t = Timer_alloc();
+    Timer_set_clock(t, &c);
+    Timer_set_deadline(t, 90 * NSEC_PER_SEC);
+
+    int listen_fd = Daemon_listen(path);
+    mu_assert(listen_fd != -1, "Daemon_listen failed");
+    mu_assert(Daemon_listen(path) == -1, "Started a second daemon");
+    Daemon *d = malloc(sizeof(Daemon));
+    rc = Daemon_init(d, listen_fd, path, t);
+    mu_assert(rc == 0, "Daemon_init failed");
+    Frontend *f = &d->base;
+    f->show_session(f, POMODORO_WORK, 1, 0, 90);
+    f->flush(f);
+
+    /* A client is sent where the day stands as soon as it attaches */
+    int client = Daemon_connect(path);
+    mu_assert(client != -1, "Daemon_connect failed");
+    mu_assert(f->read_key(f) == -1, "Got a key nobody sent");
+    char buf[256];
+    ssize_t len = read(client, buf, sizeof(buf) - 1);
+    mu_assert(len > 0, "Nothing sent on attaching");
+    buf[len] = '\0';
+    mu_assert(strcmp(buf, "state work 1 0 90000 0\n") == 0,
+            "Bad snapshot: %s", buf);
+
+    /* Commands come back as keys; status is answered there and then */
+    const char *commands = "pause\nstatus\nbogus\n";
+    rc = write(client, commands, strlen(commands));
+    mu_assert(rc == 19, "Failed to send commands");
+    mu_assert(f->read_key(f) == 'p', "Expected the pause key");
+    mu_assert(f->read_key(f) == -1, "Got a key for a bad command");
+    len = read(client, buf, sizeof(buf) - 1);
+    mu_assert(len > 0 && strncmp(buf, "state work", 10) == 0,
+            "No answer to status");
+    rc = f->alert(f, ALERT_FLASH);
+    f->flush(f);
+    len = read(client, buf, sizeof(buf) - 1);
+    mu_assert(rc == 0 && len == 12 && strncmp(buf, "alert flash\n", 12) == 0,
+            "Alert not sent");
+
+    Daemon_destroy(d);
+    free(d);
+    mu_assert(read(client, buf, sizeof(buf)) == 0,
+            "Client still attached after Daemon_destroy");
+    mu_assert(Daemon_send_command(client, "pause") == -1,
+            "Sent a command to a daemon that has gone");
+    mu_assert(access(path, F_OK) == -1, "Socket file left behind");
+    close(client);
+    Timer_destroy(t);
+    rmdir(dir);
+    return NULL;
+}
+
 char *all_tests() {
     mu_suite_start();
 
@@ -202,6 +1471,35 @@ char *all_tests() {
     mu_run_test(test_Timer_tick_negative_seconds);
     mu_run_test(test_Timer_tick_decrements);
     mu_run_test(test_Timer_tick_stops_at_zero);
+    mu_run_test(test_Timer_tick_no_drift);
+    mu_run_test(test_Clock_init_system_bad_id);
+    mu_run_test(test_Clock_virtual);
+    mu_run_test(test_Timer_tick_past_deadline);
+    mu_run_test(test_Timer_tick_virtual_no_drift);
+
+    mu_run_test(test_TimerSet);
+    mu_run_test(test_Schedule_from_sets);
+    mu_run_test(test_full_day_virtual);
+    mu_run_test(test_Timer_coarse_step);
+    mu_run_test(test_low_power_day_virtual);
+    mu_run_test(test_Timer_next_frame);
+
+    mu_run_test(test_Pomodoro_step_transitions);
+    mu_run_test(test_Pomodoro_pause_skip);
+    mu_run_test(test_Pomodoro_step_many);
+    mu_run_test(test_Pomodoro_reschedule);
+    mu_run_test(test_Pomodoro_restore);
+
+    mu_run_test(test_Schedule_compile);
+    mu_run_test(test_Schedule_large);
+
+    mu_run_test(test_Config_load_profiles);
+    mu_run_test(test_History_append_map);
+    mu_run_test(test_Stats_rollups);
+    mu_run_test(test_Export_history);
+    mu_run_test(test_Export_date_range);
+    mu_run_test(test_History_compact);
+    mu_run_test(test_Daemon_clients);
 
     return NULL;
 }
@@ -0,0 +1,234 @@
+/*
+ * Terminal output benchmark for the curses UI.
+ *
+ * Runs a full pomodoro set through the same Frontend_present path the program
+ * uses, on a virtual clock, with curses writing into a pseudo-terminal.
+ * The process's write(2) calls and bytes written are read from
+ * /proc/self/io around every frame, and the bytes arriving at the terminal
+ * side of the pty are counted too. The report shows what each frame costs
+ * in output and in CPU time.
+ *
+ * Usage: render_bench [TERM]
+ * Prints one JSON object per terminal size to stdout.
+ */
+#include <fcntl.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "pomodoro.h"
+#include "ui.h"
+
+/* Terminal sizes to measure, as rows x columns */
+static const int SIZES[][2] = { { 10, 40 }, { 24, 80 }, { 43, 132 },
+        { 60, 200 } };
+
+/* Write accounting for the whole process, from /proc/self/io */
+typedef struct {
+    long long bytes;
+    long long writes;
+} io_counts;
+
+/*
+ * Read the write counters of this process.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int read_io(int proc_fd, io_counts *io) {
+    char buf[512];
+    ssize_t len = pread(proc_fd, buf, sizeof(buf) - 1, 0);
+    check(len > 0, "Failed to read /proc/self/io");
+    buf[len] = '\0';
+    char *wchar = strstr(buf, "wchar:");
+    char *syscw = strstr(buf, "syscw:");
+    check(wchar != NULL && syscw != NULL, "Unexpected /proc/self/io format");
+    io->bytes = atoll(wchar + strlen("wchar:"));
+    io->writes = atoll(syscw + strlen("syscw:"));
+
+    return 0;
+error:
+    return -1;
+}
+
+static int64_t cpu_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Throw away whatever the terminal side of the pty has received, so the
+ * slave never blocks on a full buffer.
+ *
+ * Returns: the number of bytes thrown away
+ */
+static long long drain(int master) {
+    char buf[4096];
+    long long total = 0;
+    ssize_t len;
+    while ((len = read(master, buf, sizeof(buf))) > 0) {
+        total += len;
+    }
+    return total;
+}
+
+/*
+ * Run one full set at the given terminal size and print its report.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int bench_size(const char *term, int rows, int cols, int proc_fd) {
+    int master = -1;
+    int slave = -1;
+    FILE *out = NULL;
+    FILE *in = NULL;
+    SCREEN *screen = NULL;
+    Schedule *schedule = NULL;
+    Timer *t = NULL;
+    Ui ui = { .status_win = NULL, .timer_win = NULL };
+
+    struct winsize ws = { .ws_row = rows, .ws_col = cols };
+    int rc = openpty(&master, &slave, NULL, NULL, &ws);
+    check(rc == 0, "openpty failed");
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    out = fdopen(dup(slave), "w");
+    check(out != NULL, "fdopen failed");
+    in = fdopen(dup(slave), "r");
+    check(in != NULL, "fdopen failed");
+
+    /* Let curses size itself from the pty rather than the environment */
+    unsetenv("LINES");
+    unsetenv("COLUMNS");
+    screen = newterm(term, out, in);
+    check(screen != NULL, "newterm failed for TERM=%s", term);
+    set_term(screen);
+    cbreak();
+    noecho();
+    curs_set(0);
+
+    Clock clock;
+    Clock_init_virtual(&clock, 0);
+    schedule = Schedule_alloc();
+    check(schedule != NULL, "Schedule_alloc failed");
+    rc = Schedule_from_sets(schedule, 25 * SECONDS_PER_MINUTE,
+            5 * SECONDS_PER_MINUTE, 30 * SECONDS_PER_MINUTE, 3, 1);
+    check(rc == 0, "Schedule_from_sets failed");
+    t = Timer_alloc();
+    check(t != NULL, "Timer_alloc failed");
+    Timer_set_clock(t, &clock);
+    Pomodoro day;
+    Pomodoro_init(&day, schedule);
+
+    rc = Ui_init(&ui);
+    check(rc == 0, "Ui_init failed");
+
+    long long frames = 0;
+    io_counts first = { 0, 0 };
+    io_counts total = { 0, 0 };
+    long long tty_bytes = 0;
+    int64_t cpu = 0;
+    int64_t worst_cpu = 0;
+    PomodoroStatus status;
+    int64_t wake = 0;
+    do {
+        io_counts before;
+        io_counts after;
+        rc = read_io(proc_fd, &before);
+        check(rc == 0, "Could not read write counters");
+        int64_t start = cpu_now();
+        rc = Pomodoro_step(&day, Clock_now(&clock), &status);
+        check(rc == 0, "Pomodoro_step failed");
+        wake = Frontend_present(&ui.base, t, &status, ALERT_BEEP);
+        check(wake != -1, "Frontend_present failed");
+        int64_t spent = cpu_now() - start;
+        rc = read_io(proc_fd, &after);
+        check(rc == 0, "Could not read write counters");
+        tty_bytes += drain(master);
+
+        if (frames == 0) {
+            first.bytes = after.bytes - before.bytes;
+            first.writes = after.writes - before.writes;
+        } else {
+            total.bytes += after.bytes - before.bytes;
+            total.writes += after.writes - before.writes;
+            cpu += spent;
+            worst_cpu = spent > worst_cpu ? spent : worst_cpu;
+        }
+        frames++;
+        Clock_sleep_until(&clock, wake);
+    } while (wake != 0);
+
+    long long steady = frames > 1 ? frames - 1 : 1;
+    printf("{\"term\":\"%s\",\"rows\":%d,\"cols\":%d,\"frames\":%lld,"
+            "\"simulated_s\":%lld,"
+            "\"first_frame_bytes\":%lld,\"first_frame_writes\":%lld,"
+            "\"steady_bytes\":%lld,\"steady_writes\":%lld,"
+            "\"tty_bytes\":%lld,"
+            "\"bytes_per_frame\":%.2f,\"writes_per_frame\":%.3f,"
+            "\"cpu_ns_per_frame\":%lld,\"cpu_ns_worst_frame\":%lld}\n",
+            term, rows, cols, frames,
+            (long long)(Clock_now(&clock) / NSEC_PER_SEC),
+            first.bytes, first.writes, total.bytes, total.writes, tty_bytes,
+            (double)total.bytes / steady, (double)total.writes / steady,
+            (long long)(cpu / steady), (long long)worst_cpu);
+    fflush(stdout);
+
+    Ui_destroy(&ui);
+    endwin();
+    delscreen(screen);
+    fclose(out);
+    fclose(in);
+    Timer_destroy(t);
+    Schedule_destroy(schedule);
+    close(slave);
+    close(master);
+    return 0;
+error:
+    Ui_destroy(&ui);
+    if (screen != NULL) {
+        endwin();
+        delscreen(screen);
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (t != NULL) {
+        Timer_destroy(t);
+    }
+    if (schedule != NULL) {
+        Schedule_destroy(schedule);
+    }
+    if (slave != -1) {
+        close(slave);
+    }
+    if (master != -1) {
+        close(master);
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *term = argc > 1 ? argv[1] : "xterm-256color";
+    int proc_fd = open("/proc/self/io", O_RDONLY);
+    check(proc_fd != -1, "Failed to open /proc/self/io");
+
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++) {
+        int rc = bench_size(term, SIZES[i][0], SIZES[i][1], proc_fd);
+        check(rc == 0, "Benchmark failed at %dx%d", SIZES[i][1],
+                SIZES[i][0]);
+    }
+
+    close(proc_fd);
+    return 0;
+error:
+    return 1;
+}
@@ -0,0 +1,314 @@
+/*
+ * Startup benchmark for the frontends.
+ *
+ * Starts the program again and again inside a pseudo-terminal, with a
+ * throwaway HOME holding a default config, and measures how long it takes
+ * from fork() until the first frame of the running timer has reached the
+ * terminal, and the peak resident set size (VmHWM) once the welcome
+ * message has gone up after it. Each
+ * command is run as given, so the curses and raw-ANSI frontends, or the
+ * curses and curses-free builds, can be set side by side.
+ *
+ * Usage: startup_bench [-n RUNS] COMMAND...
+ *     -n  runs per command (default 5)
+ * Each COMMAND is a program and its arguments separated by spaces, e.g.
+ * "./bin/pomodoro_curses --frontend ansi". Prints one JSON object per
+ * command to stdout.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "pomodoro.h"
+
+/* Most arguments in one command */
+#define MAX_ARGS 32
+
+/* Most runs of one command */
+#define MAX_RUNS 100
+
+/* Give up on a run that has not shown its first timer frame by then */
+#define RUN_TIMEOUT_MS 10000
+
+/* Shortest config the program accepts, with one-minute sessions */
+static const char *CONFIG =
+        "[timer]\n"
+        "alert_type = beep\n"
+        "short_break_length = 1\n"
+        "long_break_length = 1\n"
+        "set_count = 1\n"
+        "pomodoros_per_set = 1\n"
+        "work_length = 1\n";
+
+/* Measurements of one run */
+typedef struct {
+    /* From fork() to the first timer frame on the terminal */
+    double startup_ms;
+    /* Peak resident set size, in KiB */
+    long peak_rss_kb;
+} run_result;
+
+static double ms_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3
+            + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Set up a HOME directory holding the program's default config.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int make_home(char *home, size_t size) {
+    snprintf(home, size, "/tmp/startup_bench_XXXXXX");
+    check(mkdtemp(home) != NULL, "mkdtemp failed");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/.config", home);
+    check(mkdir(path, 0700) == 0, "mkdir %s failed", path);
+    snprintf(path, sizeof(path), "%s/.config/pomodoro_curses", home);
+    check(mkdir(path, 0700) == 0, "mkdir %s failed", path);
+    snprintf(path, sizeof(path), "%s/.config/pomodoro_curses/config.ini",
+            home);
+    FILE *config = fopen(path, "w");
+    check(config != NULL, "Failed to write %s", path);
+    fputs(CONFIG, config);
+    fclose(config);
+
+    return 0;
+error:
+    return -1;
+}
+
+static void remove_home(const char *home) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/.config/pomodoro_curses/config.ini",
+            home);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.config/pomodoro_curses", home);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/.config", home);
+    rmdir(path);
+    rmdir(home);
+}
+
+/*
+ * Read the peak resident set size of a process from /proc.
+ *
+ * Returns: the peak in KiB, or -1 on failure
+ */
+static long read_peak_rss(pid_t pid) {
+    char path[64];
+    char buf[4096];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    int fd = open(path, O_RDONLY);
+    check(fd != -1, "Failed to open %s", path);
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    check(len > 0, "Failed to read %s", path);
+    buf[len] = '\0';
+    char *hwm = strstr(buf, "VmHWM:");
+    check(hwm != NULL, "No VmHWM in %s", path);
+    return atol(hwm + strlen("VmHWM:"));
+error:
+    return -1;
+}
+
+/*
+ * Read what the program has written to the terminal until text shows up
+ * in it, keeping a window of the latest output to search.
+ *
+ * Returns: 0 once text was seen, -1 on timeout or failure
+ */
+static int wait_for(int master, const char *text, char *seen, size_t size,
+        size_t *len, struct timespec *start) {
+    while (strstr(seen, text) == NULL) {
+        int left = RUN_TIMEOUT_MS - (int)ms_since(start);
+        check(left > 0, "Timed out waiting for '%s'", text);
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+        int rc = poll(&pfd, 1, left);
+        check(rc == 1, "Timed out waiting for '%s'", text);
+        /* Keep the tail, in case text is split across reads */
+        if (*len > size / 2) {
+            memmove(seen, seen + *len - size / 4, size / 4);
+            *len = size / 4;
+        }
+        ssize_t n = read(master, seen + *len, size - 1 - *len);
+        check(n > 0, "The program went away");
+        *len += n;
+        seen[*len] = '\0';
+        /* Escape sequences never hold NULs, but make sure strstr goes on */
+        for (size_t i = *len - n; i < *len; i++) {
+            if (seen[i] == '\0') {
+                seen[i] = ' ';
+            }
+        }
+    }
+    return 0;
+error:
+    return -1;
+}
+
+/*
+ * Start a command in a fresh 24x80 pseudo-terminal, time its startup, take
+ * its peak RSS once it has shown the welcome message, then press 'q'.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int run_once(char **args, const char *home, run_result *res) {
+    char seen[8192] = "";
+    size_t len = 0;
+    int master = -1;
+    struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = forkpty(&master, NULL, NULL, &ws);
+    check(pid != -1, "forkpty failed");
+    if (pid == 0) {
+        setenv("HOME", home, 1);
+        if (getenv("TERM") == NULL) {
+            setenv("TERM", "xterm-256color", 1);
+        }
+        unsetenv("LINES");
+        unsetenv("COLUMNS");
+        execvp(args[0], args);
+        _exit(127);
+    }
+
+    int rc = wait_for(master, "Current set", seen, sizeof(seen), &len,
+            &start);
+    check(rc == 0, "%s never showed a session", args[0]);
+    res->startup_ms = ms_since(&start);
+    rc = wait_for(master, "Welcome", seen, sizeof(seen), &len, &start);
+    check(rc == 0, "%s never showed its welcome message", args[0]);
+    res->peak_rss_kb = read_peak_rss(pid);
+    check(res->peak_rss_kb != -1, "Could not read the peak RSS");
+
+    rc = write(master, "q", 1);
+    check(rc == 1, "Failed to press q");
+    /* Keep the terminal drained so the program can finish writing */
+    char buf[4096];
+    while (waitpid(pid, NULL, WNOHANG) == 0) {
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+        if (poll(&pfd, 1, 10) == 1 && read(master, buf, sizeof(buf)) <= 0) {
+            waitpid(pid, NULL, 0);
+            break;
+        }
+    }
+    close(master);
+    return 0;
+error:
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    if (master != -1) {
+        close(master);
+    }
+    return -1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Run one command the given number of times and print its report.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int bench_command(const char *command, int runs, const char *home) {
+    char line[1024];
+    char *args[MAX_ARGS + 1];
+    int argc = 0;
+    snprintf(line, sizeof(line), "%s", command);
+    for (char *arg = strtok(line, " "); arg != NULL && argc < MAX_ARGS;
+            arg = strtok(NULL, " ")) {
+        args[argc++] = arg;
+    }
+    args[argc] = NULL;
+    check(argc > 0, "Empty command");
+
+    double startup[MAX_RUNS];
+    long rss[MAX_RUNS];
+    for (int i = 0; i < runs; i++) {
+        run_result res;
+        int rc = run_once(args, home, &res);
+        check(rc == 0, "Run %d of '%s' failed", i + 1, command);
+        startup[i] = res.startup_ms;
+        rss[i] = res.peak_rss_kb;
+    }
+    qsort(startup, runs, sizeof(double), cmp_double);
+    qsort(rss, runs, sizeof(long), cmp_long);
+
+    printf("{\"command\":\"%s\",\"runs\":%d,"
+            "\"startup_ms\":{\"min\":%.2f,\"p50\":%.2f,\"max\":%.2f},"
+            "\"peak_rss_kb\":{\"min\":%ld,\"p50\":%ld,\"max\":%ld}}\n",
+            command, runs, startup[0], startup[(runs - 1) / 2],
+            startup[runs - 1], rss[0], rss[(runs - 1) / 2], rss[runs - 1]);
+    fflush(stdout);
+
+    return 0;
+error:
+    return -1;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: startup_bench [-n RUNS] COMMAND...\n");
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 5;
+    char home[64] = "";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+    check(runs > 0 && runs <= MAX_RUNS, "Runs must be between 1 and %d",
+            MAX_RUNS);
+
+    int rc = make_home(home, sizeof(home));
+    check(rc == 0, "Failed to set up a HOME for the program");
+    for (int i = optind; i < argc; i++) {
+        rc = bench_command(argv[i], runs, home);
+        check(rc == 0, "Benchmark of '%s' failed", argv[i]);
+    }
+
+    remove_home(home);
+    return 0;
+error:
+    if (home[0] != '\0') {
+        remove_home(home);
+    }
+    return 1;
+}
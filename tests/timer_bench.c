@@ -0,0 +1,325 @@
+/*
+ * Timer accuracy benchmark.
+ *
+ * Counts a real Timer down on a real clock and records how late every tick
+ * wakes up compared with the boundary it was aiming for, plus how far the
+ * end of the session lands from the deadline. Synthetic CPU and I/O load can
+ * run alongside in child processes.
+ *
+ * Usage: timer_bench [-d SECONDS] [-k CLOCK] [-b BACKEND] [-c N] [-i N]
+ *                    [-f FORMAT]
+ *     -d  session length in seconds (default 10)
+ *     -k  clock: monotonic, boottime or realtime (default monotonic)
+ *     -b  backend: nanosleep (Timer_tick) or timerfd (the event loop's
+ *         timerfd + poll + Timer_update path) (default nanosleep)
+ *     -c  number of CPU-burning processes to run alongside (default 0)
+ *     -i  number of fsync-heavy writer processes to run alongside (default 0)
+ *     -f  output format: json or csv (default json)
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "pomodoro.h"
+
+/* Histogram buckets: [0, 1) us, [1, 2) us, [2, 4) us, ... */
+#define BUCKETS 24
+
+/* Most load processes of each kind */
+#define MAX_LOAD 64
+
+typedef enum {
+    BACKEND_NANOSLEEP,
+    BACKEND_TIMERFD
+} BACKEND;
+
+/* Results of one run */
+typedef struct {
+    int ticks;
+    /* Lateness of each tick, in nanoseconds */
+    int64_t *late;
+    /* How far past the deadline the session ended, in nanoseconds */
+    int64_t end_error;
+    long long histogram[BUCKETS];
+} bench_result;
+
+static void burn_cpu() {
+    volatile unsigned long x = 0;
+    for (;;) {
+        x++;
+    }
+}
+
+static void churn_io() {
+    char path[] = "/tmp/timer_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        _exit(1);
+    }
+    unlink(path);
+    char buf[64 * 1024];
+    memset(buf, 'x', sizeof(buf));
+    for (;;) {
+        for (int i = 0; i < 16; i++) {
+            if (write(fd, buf, sizeof(buf)) == -1) {
+                _exit(1);
+            }
+        }
+        fsync(fd);
+        lseek(fd, 0, SEEK_SET);
+    }
+}
+
+/*
+ * Start n load processes running work().
+ *
+ * Returns: the number of processes started
+ */
+static int start_load(pid_t *pids, int n, void (*work)()) {
+    int started = 0;
+    for (int i = 0; i < n; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            work();
+            _exit(0);
+        }
+        check(pid != -1, "fork failed");
+        pids[started++] = pid;
+    }
+error:
+    return started;
+}
+
+static void stop_load(pid_t *pids, int n) {
+    for (int i = 0; i < n; i++) {
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, 0);
+    }
+}
+
+/*
+ * Wait for the next tick the way the curses event loop does: arm a
+ * timerfd for the next boundary, poll it, then bring the Timer up to date.
+ */
+static int timerfd_tick(Timer *t, int fd) {
+    if (t->seconds == 0) {
+        return -1;
+    }
+    int64_t when = Timer_next_tick(t);
+    struct itimerspec its = { .it_interval = { 0, 0 },
+            .it_value = { .tv_sec = when / NSEC_PER_SEC,
+                    .tv_nsec = when % NSEC_PER_SEC } };
+    int rc = timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+    check(rc == 0, "Failed to arm timerfd");
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    while ((rc = poll(&pfd, 1, -1)) == -1 && errno == EINTR);
+    check(rc == 1, "poll failed");
+    uint64_t expirations;
+    rc = read(fd, &expirations, sizeof(expirations));
+    check(rc == sizeof(expirations), "Failed to read timerfd");
+
+    return Timer_update(t);
+error:
+    return -1;
+}
+
+static int bucket_of(int64_t late_ns) {
+    int64_t us = late_ns / 1000;
+    int b = 0;
+    while (us > 0 && b < BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static int cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Count a session down and record every tick's lateness.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int run(Clock *clock, BACKEND backend, int seconds,
+        bench_result *res) {
+    int fd = -1;
+    Timer *t = Timer_alloc();
+    check(t != NULL, "Timer_alloc failed");
+    Timer_set_clock(t, clock);
+    res->late = calloc(seconds + 1, sizeof(int64_t));
+    check_mem(res->late);
+    if (backend == BACKEND_TIMERFD) {
+        fd = timerfd_create(clock->id, TFD_CLOEXEC);
+        check(fd != -1, "timerfd_create failed");
+    }
+
+    int rc = Timer_set(t, seconds / (SECONDS_PER_MINUTE * MINUTES_PER_HOUR),
+            (seconds / SECONDS_PER_MINUTE) % MINUTES_PER_HOUR,
+            seconds % SECONDS_PER_MINUTE);
+    check(rc == 0, "Timer_set failed");
+    res->ticks = 0;
+    for (;;) {
+        int64_t target = Timer_next_tick(t);
+        int left = backend == BACKEND_TIMERFD ? timerfd_tick(t, fd)
+                : Timer_tick(t);
+        if (left == -1) {
+            break;
+        }
+        int64_t late = Clock_now(clock) - target;
+        res->late[res->ticks++] = late;
+        res->histogram[bucket_of(late)]++;
+        if (left == 0) {
+            res->end_error = Clock_now(clock) - t->deadline_ns;
+            break;
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+    Timer_destroy(t);
+    return 0;
+error:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (t != NULL) {
+        Timer_destroy(t);
+    }
+    return -1;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: timer_bench [-d SECONDS] [-k CLOCK] "
+            "[-b nanosleep|timerfd] [-c N] [-i N] [-f json|csv]\n");
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = 10;
+    clockid_t clock_id = CLOCK_MONOTONIC;
+    const char *clock_name = "monotonic";
+    BACKEND backend = BACKEND_NANOSLEEP;
+    int cpu_load = 0;
+    int io_load = 0;
+    bool csv = false;
+    pid_t pids[2 * MAX_LOAD];
+    int loaders = 0;
+    bench_result res;
+    memset(&res, 0, sizeof(res));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:k:b:c:i:f:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            case 'k':
+                clock_name = optarg;
+                if (strcmp(optarg, "monotonic") == 0) {
+                    clock_id = CLOCK_MONOTONIC;
+                } else if (strcmp(optarg, "boottime") == 0) {
+                    clock_id = CLOCK_BOOTTIME;
+                } else if (strcmp(optarg, "realtime") == 0) {
+                    clock_id = CLOCK_REALTIME;
+                } else {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'b':
+                if (strcmp(optarg, "nanosleep") == 0) {
+                    backend = BACKEND_NANOSLEEP;
+                } else if (strcmp(optarg, "timerfd") == 0) {
+                    backend = BACKEND_TIMERFD;
+                } else {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'c':
+                cpu_load = atoi(optarg);
+                break;
+            case 'i':
+                io_load = atoi(optarg);
+                break;
+            case 'f':
+                csv = strcmp(optarg, "csv") == 0;
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    check(seconds > 0, "Session length must be greater than 0");
+    check(cpu_load >= 0 && cpu_load <= MAX_LOAD
+            && io_load >= 0 && io_load <= MAX_LOAD,
+            "Load must be between 0 and %d processes", MAX_LOAD);
+
+    Clock clock;
+    int rc = Clock_init_system(&clock, clock_id);
+    check(rc == 0, "Bad clock");
+
+    loaders += start_load(pids + loaders, cpu_load, burn_cpu);
+    loaders += start_load(pids + loaders, io_load, churn_io);
+    rc = run(&clock, backend, seconds, &res);
+    stop_load(pids, loaders);
+    check(rc == 0, "Benchmark run failed");
+
+    int64_t sum = 0;
+    for (int i = 0; i < res.ticks; i++) {
+        sum += res.late[i];
+    }
+    qsort(res.late, res.ticks, sizeof(int64_t), cmp_int64);
+    int n = res.ticks > 0 ? res.ticks : 1;
+    double p50 = res.late[(n - 1) * 50 / 100] / 1e3;
+    double p90 = res.late[(n - 1) * 90 / 100] / 1e3;
+    double p99 = res.late[(n - 1) * 99 / 100] / 1e3;
+    double max = res.late[n - 1] / 1e3;
+    double mean = (double)sum / n / 1e3;
+    const char *backend_name = backend == BACKEND_TIMERFD ? "timerfd"
+            : "nanosleep";
+
+    if (csv) {
+        printf("backend,clock,duration_s,ticks,cpu_load,io_load,p50_us,"
+                "p90_us,p99_us,max_us,mean_us,end_error_us\n");
+        printf("%s,%s,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+                backend_name, clock_name, seconds, res.ticks, cpu_load,
+                io_load, p50, p90, p99, max, mean, res.end_error / 1e3);
+        printf("\nbucket_lt_us,count\n");
+        for (int b = 0; b < BUCKETS; b++) {
+            printf("%lld,%lld\n", 1LL << b, res.histogram[b]);
+        }
+    } else {
+        printf("{\"backend\":\"%s\",\"clock\":\"%s\",\"duration_s\":%d,"
+                "\"ticks\":%d,\"cpu_load\":%d,\"io_load\":%d,"
+                "\"lateness_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,"
+                "\"max\":%.1f,\"mean\":%.1f},\"end_error_us\":%.1f,"
+                "\"histogram\":[", backend_name, clock_name, seconds,
+                res.ticks, cpu_load, io_load, p50, p90, p99, max, mean,
+                res.end_error / 1e3);
+        for (int b = 0; b < BUCKETS; b++) {
+            printf("%s{\"lt_us\":%lld,\"count\":%lld}", b > 0 ? "," : "",
+                    1LL << b, res.histogram[b]);
+        }
+        printf("]}\n");
+    }
+
+    free(res.late);
+    return 0;
+error:
+    free(res.late);
+    return 1;
+}